@@ -3,30 +3,466 @@
 #include <deque>
 #include <raylib.h>
 #include <raymath.h>
+#include <rlgl.h>
 #include <cstdio>
 #include <string>
 #include <ctime>
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdarg>
+#include <new>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+// --- Allocation Counter ---
+// Every operator new on a thread bumps that thread's heapAllocations, so a stretch of code can be
+// checked for heap traffic by comparing the count before and after (see AllocationCheck).
+// The replacements cover every plain, array, sized and nothrow form and are kept out of line:
+// inlined into callers, GCC would see malloc/free pairs where the code says new/delete.
+thread_local uint64_t heapAllocations = 0;
+
+#if defined(__GNUC__)
+#define ALLOC_NOINLINE __attribute__((noinline))
+#else
+#define ALLOC_NOINLINE
+#endif
+
+ALLOC_NOINLINE void* operator new(size_t size)
+{
+    heapAllocations++;
+    while (true)
+    {
+        void* memory = malloc(size ? size : 1);
+        if (memory) return memory;
+        new_handler handler = get_new_handler();
+        if (!handler) throw bad_alloc();
+        handler();
+    }
+}
+ALLOC_NOINLINE void* operator new[](size_t size) { return operator new(size); }
+ALLOC_NOINLINE void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    try { return operator new(size); }
+    catch (...) { return nullptr; }
+}
+ALLOC_NOINLINE void* operator new[](size_t size, const nothrow_t&) noexcept { return operator new(size, nothrow); }
+ALLOC_NOINLINE void operator delete(void* memory) noexcept { free(memory); }
+ALLOC_NOINLINE void operator delete[](void* memory) noexcept { operator delete(memory); }
+ALLOC_NOINLINE void operator delete(void* memory, size_t) noexcept { operator delete(memory); }
+ALLOC_NOINLINE void operator delete[](void* memory, size_t) noexcept { operator delete(memory); }
+ALLOC_NOINLINE void operator delete(void* memory, const nothrow_t&) noexcept { operator delete(memory); }
+ALLOC_NOINLINE void operator delete[](void* memory, const nothrow_t&) noexcept { operator delete(memory); }
+
 // --- Global Variables and Helper Functions ---
-static bool allowMove = false;
 Color green = {173, 204, 96, 255};
 Color darkGreen = {43, 51, 24, 255};
 Color explosiveFoodColor = {255, 0, 0, 255};
+Color titleColors[] = {
+    (Color){0, 121, 241, 255},
+    (Color){0, 173, 239, 255},
+    (Color){0, 204, 255, 255},
+    (Color){102, 0, 204, 255},
+    (Color){153, 51, 255, 255},
+    (Color){204, 0, 102, 255},
+    (Color){255, 0, 0, 255},
+    (Color){255, 128, 0, 255},
+    (Color){255, 255, 0, 255},
+    (Color){102, 255, 0, 255},
+    (Color){0, 204, 0, 255},
+    (Color){0, 153, 0, 255}
+};
+int numTitleColors = sizeof(titleColors) / sizeof(titleColors[0]);
 int cellSize = 30;
 int cellCount = 25;
+const int maxCellCount = 60;    // largest board tuning.cfg may ask for
 int offset = 75;
 double lastUpdateTime = 0;
 double gameSpeed = 0.2;
 bool isHardMode = false;
 
-bool ElementInDeque(Vector2 element, deque<Vector2> deque)
+// Render quality, lowered by QualityGovernor while frames run over budget.
+enum RenderQuality { QUALITY_FULL, QUALITY_LEAN, QUALITY_SCALED, QUALITY_LOWEST };
+int renderQuality = QUALITY_FULL;
+
+// Tuning, overridable from snake.cfg (see Hot Reload).
+double easySpeed = 0.2;            // seconds per tick
+double hardSpeed = 0.1;
+int explosiveDuration = 7;         // whole seconds before explosive food vanishes
+int explosiveBasePoints = 100;
+int explosiveEvery = 5;            // explosive food joins every Nth food eaten
+
+// --- Null Render Backend ---
+// Built with -DRENDER_NULL (make bench-render), main.cpp links without raylib. The functions below
+// stand in for the parts of raylib the game calls. Window, input and audio calls do nothing. The
+// draw calls only count what raylib 4.2's rlgl would batch:
+//  - the vertices each shape emits;
+//  - a new draw call whenever the texture or primitive mode changes;
+//  - a flush when the vertex buffer or the draw-call table fills, and whenever a camera or render
+//    target switch forces one.
+// That is enough for --bench-render to track the GPU-side cost of a frame on a machine without one.
+struct RenderCounters {
+    uint64_t drawCalls = 0;
+    uint64_t vertices = 0;
+    uint64_t flushes = 0;
+};
+
+RenderCounters renderCounters;
+
+#ifdef RENDER_NULL
+const bool renderCounting = true;
+
+// rlgl's RL_DEFAULT_BATCH_BUFFER_ELEMENTS (quads per vertex buffer) and RL_DEFAULT_BATCH_DRAWCALLS.
+#if defined(PLATFORM_RPI)
+const int nullBatchQuads = 2048;
+#else
+const int nullBatchQuads = 8192;
+#endif
+const int nullBatchDrawCalls = 256;
+const unsigned int nullDefaultTexture = 1;   // rlgl's 1x1 white texture, also the shapes texture
+const unsigned int nullFontTexture = 2;
+
+class NullBatch {
+public:
+    int mode = RL_QUADS;
+    unsigned int texture = nullDefaultTexture;
+    int draws = 1;            // draw calls in the batch, the open one included
+    int drawVertices = 0;     // in the open draw call
+    int vertices = 0;         // in the batch
+    unsigned int nextId = nullFontTexture;
+
+    // A full batch is submitted and the open draw carries on; other flushes start from defaults.
+    void Flush(bool keepState = false)
+    {
+        if (vertices > 0)
+        {
+            renderCounters.flushes++;
+            renderCounters.drawCalls += drawVertices > 0 ? draws : draws - 1;
+            renderCounters.vertices += vertices;
+        }
+        draws = 1;
+        drawVertices = 0;
+        vertices = 0;
+        if (keepState) return;
+        mode = RL_QUADS;
+        texture = nullDefaultTexture;
+    }
+
+    void NextDraw()
+    {
+        if (drawVertices == 0) return;
+        draws++;
+        drawVertices = 0;
+        if (draws >= nullBatchDrawCalls) Flush(true);
+    }
+
+    void SetTexture(unsigned int id)
+    {
+        if (id == 0 || id == texture) return;
+        NextDraw();
+        texture = id;
+    }
+
+    void Begin(int newMode)
+    {
+        if (newMode == mode) return;
+        NextDraw();
+        mode = newMode;
+        texture = nullDefaultTexture;
+    }
+
+    bool CheckLimit(int count)
+    {
+        if (vertices + count < nullBatchQuads * 4) return false;
+        Flush(true);
+        return true;
+    }
+
+    void Vertices(int count)
+    {
+        vertices += count;
+        drawVertices += count;
+    }
+
+    void Quads(unsigned int id, int quads)
+    {
+        SetTexture(id);
+        Begin(RL_QUADS);
+        for (int i = 0; i < quads; i++)
+        {
+            CheckLimit(4 + 1);
+            Vertices(4);
+        }
+    }
+};
+
+NullBatch nullBatch;
+
+extern "C" {
+void InitWindow(int, int, const char*) {}
+void CloseWindow(void) {}
+bool WindowShouldClose(void) { return true; }
+void SetConfigFlags(unsigned int) {}
+void SetExitKey(int) {}
+void SetTargetFPS(int) {}
+double GetTime(void)
+{
+    static auto start = chrono::steady_clock::now();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+float GetFrameTime(void) { return 1 / 60.0f; }
+bool IsKeyPressed(int) { return false; }
+bool IsKeyDown(int) { return false; }
+int GetKeyPressed(void) { return 0; }
+bool IsMouseButtonPressed(int) { return false; }
+Vector2 GetMousePosition(void) { return Vector2{-1, -1}; }
+int GetRandomValue(int min, int max) { return min + rand() % (max - min + 1); }
+
+void BeginDrawing(void) {}
+void EndDrawing(void) { nullBatch.Flush(); }
+void ClearBackground(Color) {}
+void BeginMode2D(Camera2D) { nullBatch.Flush(); }
+void EndMode2D(void) { nullBatch.Flush(); }
+void BeginTextureMode(RenderTexture2D) { nullBatch.Flush(); }
+void EndTextureMode(void) { nullBatch.Flush(); }
+
+Image LoadImage(const char*) { return Image{}; }
+void UnloadImage(Image image) { free(image.data); }
+void ImageFormat(Image*, int) {}
+Texture2D LoadTextureFromImage(Image image)
+{
+    return Texture2D{++nullBatch.nextId, image.width ? image.width : 1, image.height ? image.height : 1, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+}
+void UnloadTexture(Texture2D) {}
+RenderTexture2D LoadRenderTexture(int width, int height)
+{
+    RenderTexture2D target = {};
+    target.id = ++nullBatch.nextId;
+    target.texture = Texture2D{++nullBatch.nextId, width, height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+    return target;
+}
+void UnloadRenderTexture(RenderTexture2D) {}
+void SetTextureFilter(Texture2D, int) {}
+
+void DrawRectangle(int, int, int, int, Color) { nullBatch.Quads(nullDefaultTexture, 1); }
+void DrawRectangleRec(Rectangle, Color) { nullBatch.Quads(nullDefaultTexture, 1); }
+// Four corners of segments quads each plus five filler rectangles; raylib picks segments below 4.
+void DrawRectangleRounded(Rectangle rect, float roundness, int segments, Color)
+{
+    if (roundness <= 0 || rect.width < 1 || rect.height < 1)
+    {
+        nullBatch.Quads(nullDefaultTexture, 1);
+        return;
+    }
+    if (segments < 4)
+    {
+        float radius = min(rect.width, rect.height) * min(roundness, 1.0f) / 2;
+        float th = acosf(2 * powf(1 - 0.5f / radius, 2) - 1);
+        segments = max(4, (int)(ceilf(2 * PI / th) / 4.0f));
+    }
+    nullBatch.Quads(nullDefaultTexture, 4 * segments + 5);
+}
+void DrawRectangleLinesEx(Rectangle, float, Color) { nullBatch.Quads(nullDefaultTexture, 4); }
+void DrawTexture(Texture2D texture, int, int, Color) { if (texture.id > 0) nullBatch.Quads(texture.id, 1); }
+void DrawTexturePro(Texture2D texture, Rectangle, Rectangle, Vector2, float, Color) { if (texture.id > 0) nullBatch.Quads(texture.id, 1); }
+
+// One font-atlas quad per visible codepoint.
+void DrawText(const char* text, int, int, int, Color)
+{
+    int glyphs = 0;
+    for (const unsigned char* c = (const unsigned char*)text; *c; c++)
+    {
+        if ((*c & 0xC0) != 0x80 && *c != ' ' && *c != '\t' && *c != '\n') glyphs++;
+    }
+    nullBatch.Quads(nullFontTexture, glyphs);
+}
+int MeasureText(const char* text, int fontSize) { return (int)strlen(text) * fontSize * 3 / 5; }
+const char* TextFormat(const char* format, ...)
+{
+    static char buffers[4][1024];
+    static int next = 0;
+    char* buffer = buffers[next];
+    next = (next + 1) % 4;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, 1024, format, args);
+    va_end(args);
+    return buffer;
+}
+
+bool CheckCollisionRecs(Rectangle a, Rectangle b)
+{
+    return a.x < b.x + b.width && a.x + a.width > b.x && a.y < b.y + b.height && a.y + a.height > b.y;
+}
+bool CheckCollisionPointRec(Vector2 point, Rectangle rect)
+{
+    return point.x >= rect.x && point.x < rect.x + rect.width && point.y >= rect.y && point.y < rect.y + rect.height;
+}
+Color Fade(Color color, float alpha)
+{
+    color.a = (unsigned char)(Clamp(alpha, 0, 1) * 255);
+    return color;
+}
+
+void InitAudioDevice(void) {}
+void CloseAudioDevice(void) {}
+Sound LoadSound(const char*) { return Sound{}; }
+Sound LoadSoundFromWave(Wave) { return Sound{}; }
+Wave LoadWave(const char*) { return Wave{}; }
+void UnloadWave(Wave) {}
+void UnloadSound(Sound) {}
+void PlaySound(Sound) {}
+void StopSound(Sound) {}
+bool IsSoundPlaying(Sound) { return false; }
+Music LoadMusicStream(const char*) { return Music{}; }
+void UnloadMusicStream(Music) {}
+void PlayMusicStream(Music) {}
+void StopMusicStream(Music) {}
+void UpdateMusicStream(Music) {}
+bool IsMusicStreamPlaying(Music) { return false; }
+
+void rlBegin(int mode) { nullBatch.Begin(mode); }
+void rlEnd(void) {}
+void rlVertex2f(float, float)
+{
+    if (nullBatch.drawVertices % 4 == 0) nullBatch.CheckLimit(4 + 1);
+    nullBatch.Vertices(1);
+}
+void rlColor4ub(unsigned char, unsigned char, unsigned char, unsigned char) {}
+void rlSetTexture(unsigned int id) { nullBatch.SetTexture(id); }
+bool rlCheckRenderBatchLimit(int count) { return nullBatch.CheckLimit(count); }
+unsigned int rlGetTextureIdDefault(void) { return nullDefaultTexture; }
+}
+#else
+const bool renderCounting = false;
+#endif
+
+// --- SnakeBody Class ---
+// Ring buffer with the part of deque's interface the game uses. Capacity for the whole board is
+// reserved once per snake, so moving and growing never touch the heap (a deque allocates and frees
+// a node every 64 moves); it only doubles if a body somehow outgrows the board.
+class SnakeBody
+{
+private:
+    unique_ptr<Vector2[]> cells;
+    size_t capacity = 0;    // power of two
+    size_t head = 0;        // slot of body[0]
+    size_t count = 0;
+
+public:
+    class const_iterator
+    {
+    public:
+        const SnakeBody* body;
+        size_t index;
+        const Vector2& operator*() const { return (*body)[index]; }
+        const_iterator& operator++() { index++; return *this; }
+        bool operator!=(const const_iterator& other) const { return index != other.index; }
+    };
+
+    SnakeBody() { Reserve(cellCount * cellCount + 1); }
+    SnakeBody(initializer_list<Vector2> list) : SnakeBody() { *this = list; }
+    SnakeBody(const SnakeBody& other) : SnakeBody() { *this = other; }
+
+    SnakeBody& operator=(const SnakeBody& other)
+    {
+        if (this == &other) return *this;
+        Reserve(other.count);
+        head = count = 0;
+        for (size_t i = 0; i < other.count; i++) push_back(other[i]);
+        return *this;
+    }
+
+    SnakeBody& operator=(initializer_list<Vector2> list)
+    {
+        Reserve(list.size());
+        head = count = 0;
+        for (const Vector2& cell : list) push_back(cell);
+        return *this;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Vector2& operator[](size_t i) { return cells[(head + i) & (capacity - 1)]; }
+    const Vector2& operator[](size_t i) const { return cells[(head + i) & (capacity - 1)]; }
+    Vector2& front() { return (*this)[0]; }
+    const Vector2& front() const { return (*this)[0]; }
+    Vector2& back() { return (*this)[count - 1]; }
+    const Vector2& back() const { return (*this)[count - 1]; }
+    const_iterator begin() const { return const_iterator{this, 0}; }
+    const_iterator end() const { return const_iterator{this, count}; }
+
+    void push_front(Vector2 cell)
+    {
+        Reserve(count + 1);
+        head = (head - 1) & (capacity - 1);
+        cells[head] = cell;
+        count++;
+    }
+
+    void push_back(Vector2 cell)
+    {
+        Reserve(count + 1);
+        cells[(head + count) & (capacity - 1)] = cell;
+        count++;
+    }
+
+    void pop_back() { count--; }
+    void clear() { head = count = 0; }
+
+    void resize(size_t size)
+    {
+        Reserve(size);
+        for (size_t i = count; i < size; i++) (*this)[i] = Vector2{0, 0};
+        count = size;
+    }
+
+private:
+    void Reserve(size_t needed)
+    {
+        if (needed <= capacity) return;
+        size_t grown = max<size_t>(16, capacity * 2);
+        while (grown < needed) grown *= 2;
+        unique_ptr<Vector2[]> moved(new Vector2[grown]);
+        for (size_t i = 0; i < count; i++) moved[i] = (*this)[i];
+        cells.swap(moved);
+        capacity = grown;
+        head = 0;
+    }
+};
+
+bool ElementInDeque(Vector2 element, const SnakeBody& body, size_t first = 0)
 {
-    for (unsigned int i = 0; i < deque.size(); i++)
+    for (size_t i = first; i < body.size(); i++)
     {
-        if (Vector2Equals(deque[i], element))
+        if (Vector2Equals(body[i], element))
         {
             return true;
         }
@@ -34,6 +470,58 @@ bool ElementInDeque(Vector2 element, deque<Vector2> deque)
     return false;
 }
 
+// Read-only view of the occupied cells: one snake body, or both in versus, without a merged copy.
+struct BodyView {
+    const SnakeBody* first;
+    const SnakeBody* second;
+
+    BodyView(const SnakeBody& body) : first(&body), second(nullptr) {}
+    BodyView(const SnakeBody& a, const SnakeBody& b) : first(&a), second(&b) {}
+
+    bool Contains(Vector2 cell) const { return ElementInDeque(cell, *first) || (second && ElementInDeque(cell, *second)); }
+};
+
+// --- Rng Class ---
+// Deterministic xorshift64* generator so two peers (or a rollback) produce the same food cells.
+class Rng {
+public:
+    uint64_t state;
+
+    Rng(uint64_t seed = 0x9E3779B97F4A7C15ull) { Seed(seed); }
+
+    void Seed(uint64_t seed) { state = seed ? seed : 0x9E3779B97F4A7C15ull; }
+
+    uint64_t Next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    int Range(int min, int max) {
+        return min + (int)(Next() % (uint64_t)(max - min + 1));
+    }
+};
+
+// Directions are 0 up, 1 down, 2 left, 3 right, so dir ^ 1 is the reverse.
+const int kernelDx[4] = {0, 0, -1, 1};
+const int kernelDy[4] = {-1, 1, 0, 0};
+
+void WriteU32(uint8_t* out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) out[i] = (uint8_t)(value >> (8 * i));
+}
+
+uint32_t ReadU32(const uint8_t* in)
+{
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+double NowSeconds()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 bool EventTriggered(double interval)
 {
     double currentTime = GetTime();
@@ -45,6 +533,30 @@ bool EventTriggered(double interval)
     return false;
 }
 
+// DrawRectangleRounded at the current render quality: half the corner segments, then plain squares.
+// raylib picks its own segment count below 4, so 4 is the floor.
+void DrawRounded(Rectangle rect, float roundness, int segments, Color color)
+{
+    if (renderQuality >= QUALITY_LOWEST) DrawRectangleRec(rect, color);
+    else DrawRectangleRounded(rect, roundness, renderQuality >= QUALITY_LEAN ? max(4, segments / 2) : segments, color);
+}
+
+// Per-letter rainbow title; one DrawText in a single colour once the quality drops.
+void DrawTitle(const char* text, int x, int y, int fontSize)
+{
+    if (renderQuality >= QUALITY_LEAN)
+    {
+        DrawText(text, x, y, fontSize, titleColors[0]);
+        return;
+    }
+    for (size_t i = 0; text[i] != '\0'; ++i)
+    {
+        char currentLetter[2] = {text[i], '\0'};
+        DrawText(currentLetter, x, y, fontSize, titleColors[i % numTitleColors]);
+        x += MeasureText(currentLetter, fontSize);
+    }
+}
+
 // --- Wall Class ---
 class Wall {
 private:
@@ -99,6 +611,14 @@ public:
 };
 
 // --- HardModeMap Class ---
+// Wall rectangles in cells; Maps/hard.map replaces them when present.
+vector<Rectangle> hardModeWalls = {
+    {3, 1, 1, 10},   // Tường dọc trái dài hơn
+    {3, 12, 8, 1},   // Tường ngang trên dài hơn
+    {19, 1, 1, 10},  // Tường dọc phải dài hơn
+    {11, 18, 8, 1},  // Tường ngang dưới dài hơn
+};
+
 class HardModeMap : public MapBase {
 public:
     HardModeMap(int blockSize = 30) : MapBase(blockSize) {
@@ -106,406 +626,8458 @@ public:
     }
     void LoadWalls() override {
         walls.clear();
-        walls.emplace_back(offset + 3 * blockSize, offset + 1 * blockSize, blockSize, 10 * blockSize); // Tường dọc trái dài hơn
-        walls.emplace_back(offset + 3 * blockSize, offset + 12 * blockSize, 8 * blockSize, blockSize); // Tường ngang trên dài hơn
-        walls.emplace_back(offset + 19 * blockSize, offset + 1 * blockSize, blockSize, 10 * blockSize); // Tường dọc phải dài hơn
-        walls.emplace_back(offset + 11 * blockSize, offset + 18 * blockSize, 8 * blockSize, blockSize); // Tường ngang dưới dài hơn
+        for (const Rectangle& wall : hardModeWalls) {
+            walls.emplace_back(offset + wall.x * blockSize, offset + wall.y * blockSize, wall.width * blockSize, wall.height * blockSize);
+        }
     }
 };
 
-// --- Food Class ---
-class Food
-{
-public:
-    Vector2 position;
-    Texture2D texture;
-    MapBase* map;
+// --- ProceduralMap Class ---
+// Seeded maze / cave / room layouts kept as a per-cell wall mask instead of Wall rectangles.
+// After generation a flood fill from the snake's start marks every pocket it cannot reach as
+// wall, so food placement (which only asks CheckCollision) never lands somewhere unreachable.
+enum MapStyle { MAP_STYLE_FIXED, MAP_STYLE_MAZE, MAP_STYLE_CAVES, MAP_STYLE_ROOMS };
 
-    Food(deque<Vector2> snakeBody, MapBase* map = nullptr) : map(map)
-    {
-        Image image = LoadImage("Graphics/food.png");
-        texture = LoadTextureFromImage(image);
-        UnloadImage(image);
-        position = GenerateRandomPos(snakeBody);
+MapStyle mapStyle = MAP_STYLE_FIXED;
+bool wrapEdges = false;
+bool dangerHints = false;
+
+const char* MapStyleName(int style)
+{
+    switch (style) {
+        case MAP_STYLE_MAZE: return "maze";
+        case MAP_STYLE_CAVES: return "caves";
+        case MAP_STYLE_ROOMS: return "rooms";
+        default: return "fixed";
     }
+}
 
-    ~Food()
-    {
-        UnloadTexture(texture);
+class ProceduralMap : public MapBase {
+public:
+    int size;
+    MapStyle style;
+    uint64_t seed;
+    vector<uint8_t> mask;     // 1 = wall, row-major size * size
+    int reachable = 0;        // free cells left after the flood fill
+
+    ProceduralMap(int size, MapStyle style, uint64_t seed, int blockSize = 30)
+        : MapBase(blockSize), size(size), style(style), seed(seed) {
+        LoadWalls();
     }
 
-    void Draw()
-    {
-        DrawTexture(texture, offset + position.x * cellSize, offset + position.y * cellSize, WHITE);
+    // Reuses the mask's storage for the next round's map.
+    void Generate(MapStyle newStyle, uint64_t newSeed) {
+        style = newStyle;
+        seed = newSeed;
+        LoadWalls();
     }
 
-public:
-    Vector2 GenerateRandomPos(deque<Vector2> snakeBody)
-    {
-        Vector2 position = GenerateRandomCell();
-        while (ElementInDeque(position, snakeBody) || (map && map->CheckCollision(Vector2{offset + position.x * cellSize, offset + position.y * cellSize})))
+    // Snake::Reset starts at (4..6, 9) heading right; that runway is always carved free.
+    void LoadWalls() override {
+        int startX = min(6, size - 1), startY = min(9, size - 1);
+        Rng rng(seed);
+        for (int attempt = 0; attempt < 8; attempt++)
         {
-            position = GenerateRandomCell();
+            if (style == MAP_STYLE_MAZE) GenerateMaze(rng);
+            else if (style == MAP_STYLE_CAVES) GenerateCaves(rng);
+            else GenerateRooms(rng);
+            for (int x = max(0, startX - 3); x <= min(size - 1, startX + 4); x++) mask[startY * size + x] = 0;
+            // The maze's rooms form one tree and every knock-out joins rooms, so a runway on a row of
+            // rooms leaves nothing to wall off.
+            bool connected = style == MAP_STYLE_MAZE && startY % 2 == 1 && startY <= 2 * ((size - 1) / 2) - 1;
+            reachable = connected ? CountOpen() : FillUnreachable(startY * size + startX);
+            if (reachable * 5 >= size * size * 2) break;   // caves can split up; retry until most of the board is open
         }
-        return position;
     }
 
-    static Vector2 GenerateRandomPosStatic(deque<Vector2> snakeBody, MapBase* map = nullptr)
-    {
-        Vector2 position = GenerateRandomCellStatic();
-        while (ElementInDeque(position, snakeBody) || (map && map->CheckCollision(Vector2{offset + position.x * cellSize, offset + position.y * cellSize})))
+    bool IsWall(int x, int y) const {
+        return x >= 0 && y >= 0 && x < size && y < size && mask[y * size + x];
+    }
+
+    void Draw() const override {
+        for (int y = 0; y < size; y++)
         {
-            position = GenerateRandomCellStatic();
+            for (int x = 0; x < size; )
+            {
+                if (!mask[y * size + x]) { x++; continue; }
+                int run = x;
+                while (run < size && mask[y * size + run]) run++;
+                DrawRectangleRec(Rectangle{(float)(offset + x * blockSize), (float)(offset + y * blockSize), (float)((run - x) * blockSize), (float)blockSize}, SKYBLUE);
+                x = run;
+            }
         }
-        return position;
     }
 
-private:
-    Vector2 GenerateRandomCell()
-    {
-        float x = GetRandomValue(0, cellCount - 1);
-        float y = GetRandomValue(0, cellCount - 1);
-        return Vector2{x, y};
+    bool CheckCollision(Vector2 point) const override {
+        return IsWall((int)floorf((point.x - offset) / blockSize), (int)floorf((point.y - offset) / blockSize));
     }
 
-    static Vector2 GenerateRandomCellStatic()
-    {
-        float x = GetRandomValue(0, cellCount - 1);
-        float y = GetRandomValue(0, cellCount - 1);
-        return Vector2{x, y};
+    bool CheckCollisionWithRect(Rectangle rect) const override {
+        int x0 = (int)floorf((rect.x - offset) / blockSize), x1 = (int)ceilf((rect.x + rect.width - offset) / blockSize) - 1;
+        int y0 = (int)floorf((rect.y - offset) / blockSize), y1 = (int)ceilf((rect.y + rect.height - offset) / blockSize) - 1;
+        for (int y = y0; y <= y1; y++)
+        {
+            for (int x = x0; x <= x1; x++)
+            {
+                if (IsWall(x, y)) return true;
+            }
+        }
+        return false;
     }
-};
 
-// --- ExplosiveFood Class ---
-class ExplosiveFood {
-public:
-    MapBase* map;
 private:
-    Vector2 position;
-    int points;
-    time_t spawnTime;
-    const int duration = 7;
-    const int basePoints = 100;
-    bool isActive;
+    vector<uint64_t> open;          // FillUnreachable scratch: one bit per free cell, rows padded to words
+    vector<int32_t> runBounds;      // start and end of every run of free cells, row by row
+    vector<int32_t> runParent;      // union-find over the runs
+    vector<int32_t> rowFirstRun;    // index of each row's first run, then the total
 
-public:
-    ExplosiveFood(MapBase* map = nullptr) : map(map) {
-        isActive = false;
-        points = basePoints;
-        spawnTime = 0;
-        position = {0, 0};
-    }
+    // Eller's algorithm over the odd cells: one row of rooms at a time, with a union-find over the
+    // row's columns, so the whole maze is a single streaming pass. A few walls are knocked out
+    // afterwards so there are loops to turn around in. Random bits are taken without branching on
+    // them (a refill is due every 64), and finds jump two links before looping, so the per-room
+    // work has no branch the coin flips can mispredict.
+    void GenerateMaze(Rng& rng) {
+        mask.assign(size * size, 1);
+        int rooms = (size - 1) / 2;
+        if (rooms < 1) { mask.assign(size * size, 0); return; }
+        vector<int32_t> parent(rooms), carried(rooms), firstOf(rooms);
+        vector<uint8_t> down(rooms), hasDown(rooms);
+        // Refilled as soon as it runs dry, which draws the same words as refilling on the next use.
+        uint64_t bits = 0;
+        int bitsLeft = 0;
+        if (rooms > 1) { bits = rng.Next(); bitsLeft = 64; }
+        auto take = [&](int count) {
+            bitsLeft -= count;
+            uint64_t bit = (bits >> (bitsLeft & 63)) & 1;
+            if (bitsLeft == 0) { bits = rng.Next(); bitsLeft = 64; }
+            return bit;
+        };
+        int32_t* up = parent.data();
+        auto find = [up](int column) {
+            column = up[up[column]];
+            while (up[column] != column) column = up[column] = up[up[column]];
+            return column;
+        };
+        for (int column = 0; column < rooms; column++) up[column] = column;
 
-    bool shouldSpawn(int foodEatenCount) {
-        return foodEatenCount % 5 == 0 && !isActive;
-    }
+        for (int ry = 0; ry < rooms; ry++)
+        {
+            uint8_t* row = &mask[(2 * ry + 1) * size];
+            bool lastRow = ry == rooms - 1;
+            row[1] = 0;
+            int left = find(0);
+            for (int rx = 0; rx + 1 < rooms; rx++)
+            {
+                row[2 * rx + 3] = 0;
+                int right = find(rx + 1);
+                int differ = left != right;
+                int join = differ & (lastRow | (int)take(differ & !lastRow));
+                up[right] = join ? left : right;
+                row[2 * rx + 2] = (uint8_t)!join;
+                left = join ? left : right;
+            }
+            if (lastRow) break;
 
-    void spawn(deque<Vector2> snakeBody) {
-        position = Food::GenerateRandomPosStatic(snakeBody, map);
-        points = basePoints;
-        spawnTime = time(nullptr);
-        isActive = true;
+            // Each set continues down at least once; the rest of the columns start new sets.
+            memset(hasDown.data(), 0, rooms);
+            for (int rx = 0; rx < rooms; rx++)
+            {
+                carried[rx] = find(rx);
+                down[rx] = (uint8_t)take(1);
+                hasDown[carried[rx]] |= down[rx];
+            }
+            for (int rx = rooms - 1; rx >= 0; rx--)
+            {
+                down[rx] |= !hasDown[carried[rx]];
+                hasDown[carried[rx]] = 1;
+            }
+            memset(firstOf.data(), 0xFF, rooms * sizeof(int32_t));
+            for (int rx = 0; rx < rooms; rx++)
+            {
+                int first = firstOf[carried[rx]];
+                first = (down[rx] & (first < 0)) ? rx : first;
+                firstOf[carried[rx]] = first;
+                up[rx] = down[rx] ? first : rx;
+                row[size + 2 * rx + 1] = !down[rx];
+            }
+        }
+        for (int y = 1; y < size - 1; y++)
+        {
+            uint8_t* line = &mask[y * size];
+            for (int x = 1 + (y & 1); x < size - 1; x += 2)
+            {
+                if (bitsLeft < 3) { bits = rng.Next(); bitsLeft = 64; }
+                bitsLeft -= 3;
+                line[x] &= ((bits >> bitsLeft) & 7) != 0;
+            }
+        }
     }
 
-    void update() {
-        if (!isActive) return;
+    // Cellular automaton: 45% noise, then four smoothing passes where a cell becomes wall when
+    // at least 5 of its 3x3 block are walls (outside counts as wall). Cells are bytes, so the
+    // block sums run eight cells per 64-bit word: a column sum, then a row sum over a padded line.
+    void GenerateCaves(Rng& rng) {
+        const uint64_t low7 = 0x7F7F7F7F7F7F7F7Full, ones = 0x0101010101010101ull;
+        int cells = size * size, x;
+        mask.resize(cells);
+        for (x = 0; x + 8 <= cells; x += 8)
+        {
+            uint64_t noise = ~((rng.Next() & low7) + 0x4747474747474747ull) >> 7 & ones;   // 7-bit value < 57
+            memcpy(&mask[x], &noise, 8);
+        }
+        for (; x < cells; x++) mask[x] = (rng.Next() & 127) < 57;
 
-        double elapsedTime = difftime(time(nullptr), spawnTime);
-        points = basePoints * pow(0.9, elapsedTime);
-        if (elapsedTime >= duration) {
-            isActive = false;
+        vector<uint8_t> next(cells);
+        vector<uint8_t> walls(size, 1), columns(size + 2, 3);
+        for (int pass = 0; pass < 4; pass++)
+        {
+            for (int y = 0; y < size; y++)
+            {
+                const uint8_t* above = y > 0 ? &mask[(y - 1) * size] : walls.data();
+                const uint8_t* here = &mask[y * size];
+                const uint8_t* below = y + 1 < size ? &mask[(y + 1) * size] : walls.data();
+                uint8_t* column = columns.data() + 1;
+                uint8_t* out = &next[y * size];
+                for (x = 0; x + 8 <= size; x += 8)
+                {
+                    uint64_t sum = Load8(above + x) + Load8(here + x) + Load8(below + x);
+                    memcpy(column + x, &sum, 8);
+                }
+                for (; x < size; x++) column[x] = above[x] + here[x] + below[x];
+                for (x = 0; x + 8 <= size; x += 8)
+                {
+                    uint64_t sum = Load8(column + x - 1) + Load8(column + x) + Load8(column + x + 1);
+                    uint64_t wall = (sum + 0x7B7B7B7B7B7B7B7Bull) >> 7 & ones;                   // sum >= 5
+                    memcpy(out + x, &wall, 8);
+                }
+                for (; x < size; x++) out[x] = column[x - 1] + column[x] + column[x + 1] >= 5;
+            }
+            mask.swap(next);
         }
     }
 
-    void Draw() {
-        if (isActive) {
-            Rectangle rect = {offset + position.x * cellSize, offset + position.y * cellSize, (float)cellSize, (float)cellSize};
-            DrawRectangleRounded(rect, 0.5, 6, explosiveFoodColor);
-            string pointsText = to_string(points);
-            int textWidth = MeasureText(pointsText.c_str(), 20);
-            DrawText(pointsText.c_str(), offset + position.x * cellSize + cellSize / 2 - textWidth / 2,
-                     offset + position.y * cellSize - 20, 20, WHITE);
+    // A grid of rooms whose shared walls each get a two-cell door; some walls are dropped entirely.
+    void GenerateRooms(Rng& rng) {
+        const int roomSize = 6;
+        mask.assign(size * size, 0);
+        for (int wallY = roomSize; wallY < size; wallY += roomSize)
+        {
+            for (int x = 0; x < size; x += roomSize)
+            {
+                if ((rng.Next() & 3) == 0) continue;
+                int end = min(size, x + roomSize), door = x + 1 + rng.Range(0, roomSize - 3);
+                for (int cell = x; cell < end; cell++)
+                {
+                    if (cell != door && cell != door + 1) mask[wallY * size + cell] = 1;
+                }
+            }
+        }
+        for (int wallX = roomSize; wallX < size; wallX += roomSize)
+        {
+            for (int y = 0; y < size; y += roomSize)
+            {
+                if ((rng.Next() & 3) == 0) continue;
+                int end = min(size, y + roomSize), door = y + 1 + rng.Range(0, roomSize - 3);
+                for (int cell = y; cell < end; cell++)
+                {
+                    if (cell != door && cell != door + 1) mask[cell * size + wallX] = 1;
+                }
+            }
         }
     }
 
-    bool isFoodActive() const {
-        return isActive;
+    static uint64_t Load8(const uint8_t* bytes) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        return word;
     }
 
-    Vector2 getPosition() const {
-        return position;
-    }
+    // Walls off every free cell not connected to start; returns the size of the connected area.
+    // Connected-component labelling over runs: the mask is packed into one bit per free cell, each
+    // row's runs come out of the words with ctz and join (union-find) the runs they overlap in the
+    // row above. A second pass walls off every run whose set is not start's. The scratch buffers
+    // are members, so a new map per round reuses them.
+    int FillUnreachable(int start) {
+        const uint64_t ones = 0x0101010101010101ull;
+        int rowWords = (size + 63) / 64;
+        open.assign((size_t)size * rowWords, 0);
+        for (int y = 0; y < size; y++)
+        {
+            const uint8_t* cells = &mask[y * size];
+            uint64_t* row = &open[(size_t)y * rowWords];
+            int x = 0;
+            for (; x + 8 <= size; x += 8)
+            {
+                uint64_t walls = ((Load8(cells + x) & ones) * 0x0102040810204080ull) >> 56;   // byte i -> bit i
+                row[x / 64] |= (~walls & 0xFF) << (x % 64);
+            }
+            for (; x < size; x++) row[x / 64] |= (uint64_t)(cells[x] == 0) << (x % 64);
+        }
 
-    int getPoints() const {
-        return points;
+        runBounds.clear();
+        runParent.clear();
+        rowFirstRun.assign(size + 1, 0);
+        for (int y = 0; y < size; y++)
+        {
+            const uint64_t* row = &open[(size_t)y * rowWords];
+            int above = y > 0 ? rowFirstRun[y - 1] : 0, aboveEnd = (int)runParent.size();
+            rowFirstRun[y] = aboveEnd;
+            for (int x = NextBit(row, 0, 0); x < size; )
+            {
+                int runEnd = NextBit(row, x, ~0ull), run = (int)runParent.size();
+                runBounds.push_back(x);
+                runBounds.push_back(runEnd);
+                runParent.push_back(run);
+                while (above < aboveEnd && runBounds[2 * above + 1] <= x) above++;
+                for (int other = above; other < aboveEnd && runBounds[2 * other] < runEnd; other++)
+                {
+                    int a = FindRun(run), b = FindRun(other);
+                    runParent[max(a, b)] = min(a, b);
+                }
+                x = NextBit(row, runEnd, 0);
+            }
+        }
+        rowFirstRun[size] = (int)runParent.size();
+
+        int startRow = start / size, startX = start % size, root = -1;
+        for (int run = rowFirstRun[startRow]; run < rowFirstRun[startRow + 1]; run++)
+        {
+            if (runBounds[2 * run] <= startX && startX < runBounds[2 * run + 1]) root = FindRun(run);
+        }
+        int filled = 0;
+        for (int y = 0; y < size; y++)
+        {
+            for (int run = rowFirstRun[y]; run < rowFirstRun[y + 1]; run++)
+            {
+                int x = runBounds[2 * run], length = runBounds[2 * run + 1] - x;
+                if (FindRun(run) == root) filled += length;
+                else memset(&mask[y * size + x], 1, length);
+            }
+        }
+        return filled;
+    }
+
+    int CountOpen() const {
+        int cells = size * size, walls = 0, x = 0;
+        while (x + 8 <= cells)
+        {
+            // Up to 255 words of 0/1 bytes per batch, so no byte lane overflows.
+            uint64_t sum = 0;
+            for (int end = min(cells - 7, x + 255 * 8); x < end; x += 8) sum += Load8(&mask[x]);
+            sum = (sum & 0x00FF00FF00FF00FFull) + (sum >> 8 & 0x00FF00FF00FF00FFull);
+            walls += (int)((sum * 0x0001000100010001ull) >> 48);
+        }
+        for (; x < cells; x++) walls += mask[x];
+        return cells - walls;
+    }
+
+    // First cell at or after x whose open bit differs from flip's; size if there is none.
+    int NextBit(const uint64_t* row, int x, uint64_t flip) const {
+        int words = (size + 63) / 64, word = x / 64;
+        if (word >= words) return size;
+        uint64_t bits = (row[word] ^ flip) & (~0ull << (x % 64));
+        while (bits == 0)
+        {
+            if (++word == words) return size;
+            bits = row[word] ^ flip;
+        }
+        return min(size, word * 64 + __builtin_ctzll(bits));
+    }
+
+    int FindRun(int run) {
+        while (runParent[run] != run) run = runParent[run] = runParent[runParent[run]];
+        return run;
+    }
+};
+
+// Generation time and open area per style; the bar is a new map per round with no visible load,
+// which means a few milliseconds at the default 512x512 (boards in play are at most 60x60).
+// Rounds call Generate on the map they already have (see UseProceduralMap), so that is what is timed.
+void BenchMaps(int boardSize)
+{
+    for (int style = MAP_STYLE_MAZE; style <= MAP_STYLE_ROOMS; style++)
+    {
+        double best = 1e9;
+        int reachable = 0;
+        ProceduralMap map(boardSize, (MapStyle)style, 1233, cellSize);
+        for (int run = 0; run < 10; run++)
+        {
+            auto start = chrono::steady_clock::now();
+            map.Generate((MapStyle)style, 1234 + run);
+            best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+            reachable = map.reachable;
+        }
+        printf("%-6s %dx%d: %.2f ms, %.1f%% reachable\n", MapStyleName(style), boardSize, boardSize, best,
+               100.0 * reachable / ((double)boardSize * boardSize));
+    }
+}
+
+// --- Reachability Class ---
+// Regions of free cells, kept up to date one move at a time instead of flood-filling the board
+// every tick. A cell the tail frees joins its neighbours' regions: the smaller ones are relabelled
+// into the largest, so relabelling is amortised. A cell the head takes can only split its region
+// if its free neighbours are not connected around it; only then are they searched, and only the
+// smaller pieces relabelled.
+class Reachability {
+public:
+    int size = 0;
+    bool wraps = false;
+
+    bool Ready() const { return ready; }
+    void Invalidate() { ready = false; }
+    int Label(int cell) const { return label[cell]; }
+    int RegionSize(int region) const { return regionSize[region]; }
+    bool Free(int cell) const { return label[cell] >= 0; }
+
+    // blocked holds size * size cells, nonzero for walls and snake.
+    void Rebuild(const uint8_t* blocked, int boardSize, bool wrapEdges)
+    {
+        size = boardSize;
+        wraps = wrapEdges;
+        int cells = size * size;
+        label.resize(cells);
+        regionSize.assign(cells, 0);
+        stamp.assign(cells, 0);
+        freeLabels.clear();
+        for (int region = cells - 1; region >= 0; region--) freeLabels.push_back(region);
+        for (int cell = 0; cell < cells; cell++) label[cell] = blocked[cell] ? -1 : -2;
+        for (int cell = 0; cell < cells; cell++)
+        {
+            if (label[cell] != -2) continue;
+            int region = NewLabel();
+            regionSize[region] = Fill(cell, -2, region);
+        }
+        ready = true;
+    }
+
+    void Block(int cell)
+    {
+        if (!ready || label[cell] < 0) return;
+        int region = label[cell];
+        label[cell] = -1;
+        if (--regionSize[region] == 0)
+        {
+            freeLabels.push_back(region);
+            return;
+        }
+        if (LocalGroups(cell) > 1) SplitPieces(cell, region);
+    }
+
+    void Unblock(int cell)
+    {
+        if (!ready || label[cell] >= 0) return;
+        int neighbours[4];
+        int count = Neighbours(cell, neighbours);
+        int target = -1;
+        for (int i = 0; i < count; i++)
+        {
+            int region = label[neighbours[i]];
+            if (region >= 0 && (target < 0 || regionSize[region] > regionSize[target])) target = region;
+        }
+        if (target < 0) target = NewLabel();
+        label[cell] = target;
+        regionSize[target]++;
+        for (int i = 0; i < count; i++)
+        {
+            int region = label[neighbours[i]];
+            if (region < 0 || region == target) continue;
+            regionSize[target] += Fill(neighbours[i], region, target);
+            regionSize[region] = 0;
+            freeLabels.push_back(region);
+        }
+    }
+
+    // True if a free neighbour of cell lies in region.
+    bool Touches(int cell, int region) const
+    {
+        int neighbours[4];
+        int count = Neighbours(cell, neighbours);
+        for (int i = 0; i < count; i++)
+        {
+            if (label[neighbours[i]] == region) return true;
+        }
+        return false;
+    }
+
+    // Whether a free cell can be reached from the snake's head now or from behind its tail.
+    bool Reachable(int cell, int head, int tail) const
+    {
+        return label[cell] >= 0 && (Touches(head, label[cell]) || Touches(tail, label[cell]));
+    }
+
+    bool TailReachable(int head, int tail) const
+    {
+        int neighbours[4];
+        int count = Neighbours(head, neighbours);
+        for (int i = 0; i < count; i++)
+        {
+            if (neighbours[i] == tail || (label[neighbours[i]] >= 0 && Touches(tail, label[neighbours[i]]))) return true;
+        }
+        return false;
+    }
+
+    // Whether the head can step in dir and still have room for k more ticks: the step lands on
+    // the tail as it moves away, or its region reaches the tail (the snake can follow it round), or
+    // the piece of the region the head can still enter holds k cells. O(1) unless the step could
+    // cut its region, and then a fill of at most k cells per piece.
+    bool SafeFor(int head, int tail, bool tailMoves, int dir, int k)
+    {
+        int x = head % size + kernelDx[dir], y = head / size + kernelDy[dir];
+        if (!Wrap(x, y)) return false;
+        int cell = y * size + x;
+        if (cell == tail) return tailMoves;
+        int region = label[cell];
+        if (region < 0) return false;
+        if (Touches(tail, region)) return true;
+        if (regionSize[region] - 1 < k) return false;
+        if (LocalGroups(cell) <= 1) return true;
+
+        if (++stampNow == 0)
+        {
+            fill(stamp.begin(), stamp.end(), 0);
+            stampNow = 1;
+        }
+        stamp[cell] = stampNow;
+        int neighbours[4];
+        int count = Neighbours(cell, neighbours);
+        for (int i = 0; i < count; i++)
+        {
+            if (label[neighbours[i]] == region && stamp[neighbours[i]] != stampNow && BoundedCount(neighbours[i], k) >= k) return true;
+        }
+        return false;
+    }
+
+private:
+    vector<int> label;          // region of a free cell; -1 blocked
+    vector<int> regionSize;
+    vector<int> freeLabels;
+    vector<int> stack;
+    vector<int> searches[4];
+    vector<uint32_t> stamp;
+    uint32_t stampNow = 0;
+    bool ready = false;
+
+    // Searches from each free neighbour of the blocked cell in lockstep; searches that meet are
+    // one piece. Once every piece but one has run out of cells, those are relabelled and the one
+    // still going keeps the region's label, so the work follows the smaller pieces.
+    void SplitPieces(int cell, int region)
+    {
+        int starts[4], group[4];
+        int count = 0, neighbours[4];
+        int n = Neighbours(cell, neighbours);
+        if (stampNow > 0xFFFFFFF0u)
+        {
+            fill(stamp.begin(), stamp.end(), 0);
+            stampNow = 0;
+        }
+        uint32_t base = stampNow;
+        stampNow += 4;
+        for (int i = 0; i < n; i++)
+        {
+            if (label[neighbours[i]] != region || stamp[neighbours[i]] > base) continue;
+            starts[count] = neighbours[i];
+            group[count] = count;
+            stamp[neighbours[i]] = base + 1 + count;
+            searches[count].assign(1, neighbours[i]);
+            count++;
+        }
+        auto root = [&group](int i) { while (group[i] != i) i = group[i]; return i; };
+
+        int keeper = 0;
+        bool changed = true;    // a search ran out or two met
+        while (true)
+        {
+            if (changed)
+            {
+                int roots = 0, running = 0;
+                for (int i = 0; i < count; i++)
+                {
+                    if (root(i) != i) continue;
+                    roots++;
+                    for (int j = 0; j < count; j++)
+                    {
+                        if (root(j) != i || searches[j].empty()) continue;
+                        running++;
+                        keeper = i;
+                        break;
+                    }
+                }
+                if (roots <= 1) return;
+                if (running <= 1) break;
+                changed = false;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                if (searches[i].empty()) continue;
+                int at = searches[i].back();
+                searches[i].pop_back();
+                int next[4];
+                int m = Neighbours(at, next);
+                for (int k = 0; k < m; k++)
+                {
+                    if (label[next[k]] != region) continue;
+                    if (stamp[next[k]] > base)
+                    {
+                        int a = root((int)(stamp[next[k]] - base - 1)), b = root(i);
+                        if (a != b) group[max(a, b)] = min(a, b);
+                        changed = changed || a != b;
+                        continue;
+                    }
+                    stamp[next[k]] = base + 1 + i;
+                    searches[i].push_back(next[k]);
+                }
+                changed = changed || searches[i].empty();
+            }
+        }
+        keeper = root(keeper);
+        for (int i = 0; i < count; i++)
+        {
+            if (root(i) != i || i == keeper) continue;
+            int piece = NewLabel();
+            regionSize[piece] = Fill(starts[i], region, piece);
+            regionSize[region] -= regionSize[piece];
+        }
+    }
+
+    int NewLabel()
+    {
+        int region = freeLabels.back();
+        freeLabels.pop_back();
+        return region;
+    }
+
+    bool Wrap(int& x, int& y) const
+    {
+        if (wraps)
+        {
+            x = (x + size) % size;
+            y = (y + size) % size;
+            return true;
+        }
+        return x >= 0 && y >= 0 && x < size && y < size;
+    }
+
+    bool OpenAt(int x, int y) const { return Wrap(x, y) && label[y * size + x] >= 0; }
+
+    // Up, down, left, right, skipping the ones off a board without wrapping.
+    int Neighbours(int cell, int* out) const
+    {
+        int y = cell / size, x = cell - y * size, count = 0;
+        if (y > 0) out[count++] = cell - size;
+        else if (wraps) out[count++] = cell + (size - 1) * size;
+        if (y < size - 1) out[count++] = cell + size;
+        else if (wraps) out[count++] = x;
+        if (x > 0) out[count++] = cell - 1;
+        else if (wraps) out[count++] = cell + size - 1;
+        if (x < size - 1) out[count++] = cell + 1;
+        else if (wraps) out[count++] = cell - size + 1;
+        return count;
+    }
+
+    // Groups the free orthogonal neighbours form when joined through the free diagonal cells
+    // between them; with at most one group, blocking cell cannot disconnect anything.
+    int LocalGroups(int cell) const
+    {
+        static const int ringDx[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+        static const int ringDy[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+        int x = cell % size, y = cell / size;
+        bool open[8];
+        for (int i = 0; i < 8; i++) open[i] = OpenAt(x + ringDx[i], y + ringDy[i]);
+        int groups = 0, openSides = 0;
+        for (int i = 0; i < 8; i += 2)
+        {
+            if (!open[i]) continue;
+            openSides++;
+            if (!(open[(i + 6) % 8] && open[(i + 7) % 8])) groups++;
+        }
+        return openSides > 0 && groups == 0 ? 1 : groups;
+    }
+
+    // Relabels the cells labelled from that connect to start; returns how many.
+    int Fill(int start, int from, int to)
+    {
+        int count = 0;
+        stack.clear();
+        stack.push_back(start);
+        label[start] = to;
+        while (!stack.empty())
+        {
+            int cell = stack.back();
+            stack.pop_back();
+            count++;
+            int neighbours[4];
+            int n = Neighbours(cell, neighbours);
+            for (int i = 0; i < n; i++)
+            {
+                if (label[neighbours[i]] != from) continue;
+                label[neighbours[i]] = to;
+                stack.push_back(neighbours[i]);
+            }
+        }
+        return count;
+    }
+
+    // Free cells connected to start without crossing stamped ones, counting no further than limit.
+    int BoundedCount(int start, int limit)
+    {
+        int count = 0;
+        stack.clear();
+        stack.push_back(start);
+        stamp[start] = stampNow;
+        while (!stack.empty() && count < limit)
+        {
+            int cell = stack.back();
+            stack.pop_back();
+            count++;
+            int neighbours[4];
+            int n = Neighbours(cell, neighbours);
+            for (int i = 0; i < n; i++)
+            {
+                if (label[neighbours[i]] < 0 || stamp[neighbours[i]] == stampNow) continue;
+                stamp[neighbours[i]] = stampNow;
+                stack.push_back(neighbours[i]);
+            }
+        }
+        return count;
+    }
+};
+
+// --- Resource Tracker ---
+// Textures, render targets, sounds and music streams are loaded and unloaded through the wrappers
+// below. Each one is recorded with its owner and an estimate of the memory it holds. Releasing
+// something that is not loaded counts as a double free, and so does releasing a GPU resource
+// after CloseWindow. Whatever is still loaded at exit is a leak. Both are printed when the
+// process ends. The table has a fixed size, so loads during frames never allocate.
+enum ResourceKind { RESOURCE_TEXTURE, RESOURCE_RENDER_TARGET, RESOURCE_SOUND, RESOURCE_MUSIC, RESOURCE_KIND_COUNT };
+const char* const resourceKindNames[RESOURCE_KIND_COUNT] = {"texture", "render target", "sound", "music"};
+
+class ResourceTracker {
+public:
+    size_t count[RESOURCE_KIND_COUNT] = {};
+    size_t bytes[RESOURCE_KIND_COUNT] = {};
+    int badReleases = 0;   // double frees and GPU releases after CloseWindow
+
+    ~ResourceTracker() { Report(); }
+
+    void Add(ResourceKind kind, uintptr_t key, const char* owner, size_t size)
+    {
+        if (key == 0) return;   // failed load; raylib hands back an empty resource
+        lock_guard<mutex> lock(guard);
+        if (used == maxLive)
+        {
+            printf("Resources: table full, %s from %s is not tracked\n", resourceKindNames[kind], owner);
+            return;
+        }
+        live[used++] = Entry{key, kind, owner, size};
+        count[kind]++;
+        bytes[kind] += size;
+    }
+
+    void Remove(ResourceKind kind, uintptr_t key, const char* owner)
+    {
+        if (key == 0) return;
+        lock_guard<mutex> lock(guard);
+        if (windowClosed && (kind == RESOURCE_TEXTURE || kind == RESOURCE_RENDER_TARGET))
+        {
+            printf("Resources: %s released a %s after CloseWindow\n", owner, resourceKindNames[kind]);
+            badReleases++;
+        }
+        for (int i = 0; i < used; i++)
+        {
+            if (live[i].key != key || live[i].kind != kind) continue;
+            count[kind]--;
+            bytes[kind] -= live[i].bytes;
+            live[i] = live[--used];
+            return;
+        }
+        printf("Resources: %s released a %s that is not loaded (double free)\n", owner, resourceKindNames[kind]);
+        badReleases++;
+    }
+
+    void WindowClosed() { windowClosed = true; }
+
+    size_t GpuBytes() const { return bytes[RESOURCE_TEXTURE] + bytes[RESOURCE_RENDER_TARGET]; }
+
+    size_t Live() const
+    {
+        size_t total = 0;
+        for (size_t n : count) total += n;
+        return total;
+    }
+
+    // Silent when everything was released exactly once.
+    void Report()
+    {
+        lock_guard<mutex> lock(guard);
+        for (int i = 0; i < used; i++)
+        {
+            printf("Resources: leaked %s from %s (%.1f KB)\n", resourceKindNames[live[i].kind], live[i].owner, live[i].bytes / 1e3);
+        }
+        if (used > 0 || badReleases > 0) printf("Resources: %d leaked, %d bad releases\n", used, badReleases);
+        used = 0;
+        badReleases = 0;
+    }
+
+private:
+    struct Entry {
+        uintptr_t key;   // texture or framebuffer id, or the audio buffer pointer
+        ResourceKind kind;
+        const char* owner;
+        size_t bytes;
+    };
+    static const int maxLive = 256;
+    Entry live[maxLive];
+    int used = 0;
+    bool windowClosed = false;
+    mutex guard;
+};
+
+ResourceTracker resources;
+
+// Estimates: RGBA8 textures, and a render target also holds a 32-bit depth buffer.
+Texture2D LoadTextureTracked(Image image, const char* owner)
+{
+    Texture2D texture = LoadTextureFromImage(image);
+    resources.Add(RESOURCE_TEXTURE, texture.id, owner, (size_t)texture.width * texture.height * 4);
+    return texture;
+}
+
+void UnloadTextureTracked(Texture2D texture, const char* owner)
+{
+    resources.Remove(RESOURCE_TEXTURE, texture.id, owner);
+    UnloadTexture(texture);
+}
+
+RenderTexture2D LoadRenderTextureTracked(int width, int height, const char* owner)
+{
+    RenderTexture2D target = LoadRenderTexture(width, height);
+    resources.Add(RESOURCE_RENDER_TARGET, target.id, owner, (size_t)width * height * 8);
+    return target;
+}
+
+void UnloadRenderTextureTracked(RenderTexture2D target, const char* owner)
+{
+    resources.Remove(RESOURCE_RENDER_TARGET, target.id, owner);
+    UnloadRenderTexture(target);
+}
+
+size_t SoundBytes(const Sound& sound)
+{
+    return (size_t)sound.frameCount * sound.stream.channels * sound.stream.sampleSize / 8;
+}
+
+// Two sub-buffers of 1/30 s each, as raylib sizes a music stream.
+size_t MusicStreamBytes(const Music& music)
+{
+    const AudioStream& stream = music.stream;
+    return 2 * (stream.sampleRate / 30) * stream.channels * stream.sampleSize / 8;
+}
+
+Sound TrackSound(Sound sound, const char* owner)
+{
+    resources.Add(RESOURCE_SOUND, (uintptr_t)sound.stream.buffer, owner, SoundBytes(sound));
+    return sound;
+}
+
+void UnloadSoundTracked(Sound sound, const char* owner)
+{
+    resources.Remove(RESOURCE_SOUND, (uintptr_t)sound.stream.buffer, owner);
+    UnloadSound(sound);
+}
+
+Music LoadMusicStreamTracked(const char* path, const char* owner)
+{
+    Music music = LoadMusicStream(path);
+    resources.Add(RESOURCE_MUSIC, (uintptr_t)music.stream.buffer, owner, MusicStreamBytes(music));
+    return music;
+}
+
+void UnloadMusicStreamTracked(Music music, const char* owner)
+{
+    resources.Remove(RESOURCE_MUSIC, (uintptr_t)music.stream.buffer, owner);
+    UnloadMusicStream(music);
+}
+
+// Resident set size from /proc; 0 where that is not available.
+size_t ResidentBytes()
+{
+#ifdef __linux__
+    // open/read rather than stdio: this runs during frames, which must not allocate.
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) return 0;
+    char text[128];
+    ssize_t length = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (length <= 0) return 0;
+    text[length] = '\0';
+    unsigned long pages = 0, resident = 0;
+    if (sscanf(text, "%lu %lu", &pages, &resident) != 2) return 0;
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+// Samples resident memory and tracked GPU memory for soak runs (--resources). The first
+// sample after warmup is the baseline. Each sample is compared with the lowest reading so far.
+// Growth beyond a margin for three samples in a row is reported once, then again only after
+// memory falls back under the margin. An hourly summary line gives a long run a trail in its log.
+class MemoryWatchdog {
+public:
+    double interval = 10.0;      // seconds between samples
+    double warmup = 60.0;        // first load, audio device and caches settle in this time
+    size_t residentBytes = 0;
+    size_t gpuBytes = 0;
+    bool growing = false;
+
+    void Sample(double now)
+    {
+        if (start < 0) start = lastSummary = now;
+        if (now - lastSample < interval) return;
+        lastSample = now;
+        residentBytes = ResidentBytes();
+        gpuBytes = resources.GpuBytes();
+        if (now - start < warmup) return;
+
+        if (baselineResident == 0 || residentBytes < baselineResident) baselineResident = residentBytes;
+        if (!baselineSet || gpuBytes < baselineGpu) baselineGpu = gpuBytes;
+        baselineSet = true;
+        bool over = residentBytes > baselineResident + max(residentMargin, baselineResident / 5) || gpuBytes > baselineGpu + gpuMargin;
+        overSamples = over ? overSamples + 1 : 0;
+        if (overSamples >= 3 && !growing)
+        {
+            growing = true;
+            printf("Watchdog: memory grew over %.0f min: RSS %.1f -> %.1f MB, GPU %.1f -> %.1f MB, %zu resources\n", (now - start) / 60,
+                   baselineResident / 1e6, residentBytes / 1e6, baselineGpu / 1e6, gpuBytes / 1e6, resources.Live());
+        }
+        if (!over) growing = false;
+        if (now - lastSummary >= 3600)
+        {
+            lastSummary = now;
+            printf("Watchdog: %.1f h up, RSS %.1f MB, GPU %.1f MB, %zu resources\n", (now - start) / 3600, residentBytes / 1e6, gpuBytes / 1e6,
+                   resources.Live());
+        }
+    }
+
+private:
+    static const size_t residentMargin = 16000000;
+    static const size_t gpuMargin = 4000000;
+    double start = -1;
+    double lastSample = -1e9;
+    double lastSummary = 0;
+    size_t baselineResident = 0;
+    size_t baselineGpu = 0;
+    bool baselineSet = false;
+    int overSamples = 0;
+};
+
+const size_t MemoryWatchdog::residentMargin;
+const size_t MemoryWatchdog::gpuMargin;
+
+// Live counts and sizes in a screen corner; red while the watchdog sees growth.
+void DrawResourceOverlay(const MemoryWatchdog& watchdog, int x, int y)
+{
+    Color color = watchdog.growing ? RED : darkGreen;
+    for (int kind = 0; kind < RESOURCE_KIND_COUNT; kind++)
+    {
+        DrawText(TextFormat("%s: %zu, %.1f KB", resourceKindNames[kind], resources.count[kind], resources.bytes[kind] / 1e3), x, y, 10, color);
+        y += 12;
+    }
+    DrawText(TextFormat("RSS %.1f MB, GPU %.1f MB", watchdog.residentBytes / 1e6, watchdog.gpuBytes / 1e6), x, y, 10, color);
+}
+
+// --- Food Class ---
+const int randomPosAttempts = 64;
+
+class Food
+{
+public:
+    Vector2 position;
+    Texture2D texture;
+    MapBase* map;
+    Rng* rng;
+    const Reachability* reach = nullptr;    // set by Game; spawns skip pockets the snake cannot get into
+
+    // A headless copy (withTexture false) never draws, so it holds no texture.
+    Food(BodyView snakeBody, MapBase* map = nullptr, Rng* rng = nullptr, bool withTexture = true) : texture(), map(map), rng(rng)
+    {
+        if (withTexture)
+        {
+            Image image = LoadImage("Graphics/food.png");
+            texture = LoadTextureTracked(image, "Food");
+            UnloadImage(image);
+        }
+        position = GenerateRandomPos(snakeBody);
+    }
+
+    // The texture belongs to exactly one Food.
+    Food(const Food&) = delete;
+    Food& operator=(const Food&) = delete;
+
+    ~Food()
+    {
+        Unload();
+    }
+
+    // Also called before CloseWindow, so the texture is not released without a GL context.
+    void Unload()
+    {
+        if (texture.id == 0) return;
+        UnloadTextureTracked(texture, "Food");
+        texture = Texture2D{};
+    }
+
+    void ReplaceTexture(Image image)
+    {
+        Unload();
+        texture = LoadTextureTracked(image, "Food");
+    }
+
+    void Draw()
+    {
+        if (position.x < 0) return;
+        DrawTexture(texture, offset + position.x * cellSize, offset + position.y * cellSize, WHITE);
+    }
+
+public:
+    Vector2 GenerateRandomPos(BodyView snakeBody)
+    {
+        return GenerateRandomPosStatic(snakeBody, map, rng, reach);
+    }
+
+    // Returns {-1, -1} when no cell is free, i.e. the snake has filled the board. With a ready
+    // reach, cells neither the head nor the tail can get to are skipped unless nothing else is free.
+    static Vector2 GenerateRandomPosStatic(BodyView snakeBody, MapBase* map = nullptr, Rng* rng = nullptr, const Reachability* reach = nullptr)
+    {
+        if (reach && (!reach->Ready() || reach->size != cellCount)) reach = nullptr;
+        for (int attempt = 0; attempt < randomPosAttempts; attempt++)
+        {
+            Vector2 position = GenerateRandomCellStatic(rng);
+            if (IsFreeCell(position, snakeBody, map) && IsReachableCell(position, snakeBody, reach)) return position;
+        }
+        Vector2 position = PickFreeCell(snakeBody, map, rng, reach);
+        return position.x < 0 && reach ? PickFreeCell(snakeBody, map, rng, nullptr) : position;
+    }
+
+    static bool IsFreeCell(Vector2 position, BodyView snakeBody, MapBase* map)
+    {
+        return !snakeBody.Contains(position) && !(map && map->CheckCollision(Vector2{offset + position.x * cellSize, offset + position.y * cellSize}));
+    }
+
+    static bool IsReachableCell(Vector2 position, BodyView snakeBody, const Reachability* reach)
+    {
+        if (!reach) return true;
+        const SnakeBody& body = *snakeBody.first;
+        return reach->Reachable((int)position.y * cellCount + (int)position.x, (int)body.front().y * cellCount + (int)body.front().x,
+                                (int)body.back().y * cellCount + (int)body.back().x);
+    }
+
+private:
+    // Crowded board: pick uniformly among the cells that are still free. Counting first and then
+    // walking to the chosen one keeps this off the heap.
+    static Vector2 PickFreeCell(BodyView snakeBody, MapBase* map, Rng* rng, const Reachability* reach)
+    {
+        auto usable = [&](int x, int y) {
+            Vector2 position = {(float)x, (float)y};
+            return IsFreeCell(position, snakeBody, map) && IsReachableCell(position, snakeBody, reach);
+        };
+        int freeCount = 0;
+        for (int y = 0; y < cellCount; y++)
+        {
+            for (int x = 0; x < cellCount; x++) freeCount += usable(x, y);
+        }
+        if (freeCount == 0) return Vector2{-1, -1};
+        int chosen = rng ? rng->Range(0, freeCount - 1) : GetRandomValue(0, freeCount - 1);
+        for (int y = 0; y < cellCount; y++)
+        {
+            for (int x = 0; x < cellCount; x++)
+            {
+                if (usable(x, y) && chosen-- == 0) return Vector2{(float)x, (float)y};
+            }
+        }
+        return Vector2{-1, -1};
+    }
+
+    static Vector2 GenerateRandomCellStatic(Rng* rng)
+    {
+        float x = rng ? rng->Range(0, cellCount - 1) : GetRandomValue(0, cellCount - 1);
+        float y = rng ? rng->Range(0, cellCount - 1) : GetRandomValue(0, cellCount - 1);
+        return Vector2{x, y};
+    }
+};
+
+// --- ExplosiveFood Class ---
+class ExplosiveFood {
+public:
+    MapBase* map;
+    Rng* rng;
+    const Reachability* reach = nullptr;
+private:
+    Vector2 position;
+    int points;
+    unsigned int spawnTick;
+    bool isActive;
+
+    friend class Game;
+
+public:
+    ExplosiveFood(MapBase* map = nullptr, Rng* rng = nullptr) : map(map), rng(rng) {
+        isActive = false;
+        points = explosiveBasePoints;
+        spawnTick = 0;
+        position = {0, 0};
+    }
+
+    bool shouldSpawn(int foodEatenCount) {
+        return foodEatenCount % explosiveEvery == 0 && !isActive;
+    }
+
+    void spawn(BodyView snakeBody, unsigned int tick) {
+        position = Food::GenerateRandomPosStatic(snakeBody, map, rng, reach);
+        points = explosiveBasePoints;
+        spawnTick = tick;
+        isActive = position.x >= 0;
+    }
+
+    // Decay is counted in ticks (whole seconds at the current gameSpeed) so it replays identically.
+    void update(unsigned int tick) {
+        if (!isActive) return;
+
+        double elapsedTime = floor((tick - spawnTick) * gameSpeed + 1e-9);
+        points = explosiveBasePoints * pow(0.9, elapsedTime);
+        if (elapsedTime >= explosiveDuration) {
+            isActive = false;
+        }
+    }
+
+    void Draw() {
+        if (isActive) {
+            Rectangle rect = {offset + position.x * cellSize, offset + position.y * cellSize, (float)cellSize, (float)cellSize};
+            DrawRounded(rect, 0.5, 6, explosiveFoodColor);
+            const char* pointsText = TextFormat("%i", points);
+            int textWidth = MeasureText(pointsText, 20);
+            DrawText(pointsText, offset + position.x * cellSize + cellSize / 2 - textWidth / 2,
+                     offset + position.y * cellSize - 20, 20, WHITE);
+        }
+    }
+
+    bool isFoodActive() const {
+        return isActive;
+    }
+
+    Vector2 getPosition() const {
+        return position;
+    }
+
+    int getPoints() const {
+        return points;
+    }
+
+    void eat() {
+        isActive = false;
+    }
+};
+
+// --- Snake Class ---
+class Snake
+{
+public:
+    SnakeBody body = {Vector2{6, 9}, Vector2{5, 9}, Vector2{4, 9}};
+    Vector2 direction = {1, 0};
+    bool addSegment = false;
+    Color color = darkGreen;
+
+    void Draw()
+    {
+        for (unsigned int i = 0; i < body.size(); i++) DrawSegment(body[i].x, body[i].y, color);
+    }
+
+    // Shared with ghosts, so every snake on screen goes into the same shape batch.
+    static void DrawSegment(float x, float y, Color color)
+    {
+        Rectangle segment = Rectangle{offset + x * cellSize, offset + y * cellSize, (float)cellSize, (float)cellSize};
+        DrawRounded(segment, 0.5, 6, color);
+    }
+
+    void Update()
+    {
+        body.push_front(Vector2Add(body[0], direction));
+        if (addSegment == true)
+        {
+            addSegment = false;
+        }
+        else
+        {
+            body.pop_back();
+        }
+    }
+
+    void Reset()
+    {
+        body = {Vector2{6, 9}, Vector2{5, 9}, Vector2{4, 9}};
+        direction = {1, 0};
+    }
+};
+
+// --- SpscRing Class ---
+// Single-producer/single-consumer ring for handing data from the frame thread to a worker thread.
+template <class T, size_t Capacity>
+class SpscRing {
+private:
+    T buffer[Capacity];
+    atomic<size_t> writePos{0};
+    atomic<size_t> readPos{0};
+
+public:
+    bool Push(const T* data, size_t size)
+    {
+        size_t write = writePos.load(memory_order_relaxed);
+        if (Capacity - (write - readPos.load(memory_order_acquire)) < size) return false;
+        for (size_t i = 0; i < size; i++) buffer[(write + i) % Capacity] = data[i];
+        writePos.store(write + size, memory_order_release);
+        return true;
+    }
+
+    size_t Pop(T* out, size_t maxSize)
+    {
+        size_t read = readPos.load(memory_order_relaxed);
+        size_t size = min(maxSize, writePos.load(memory_order_acquire) - read);
+        for (size_t i = 0; i < size; i++) out[i] = buffer[(read + i) % Capacity];
+        readPos.store(read + size, memory_order_release);
+        return size;
+    }
+};
+
+// --- TripleBuffer Class ---
+// One writer and one reader hand over whole values without locks: the writer fills its back slot
+// and swaps it with the shared middle slot, the reader swaps the middle slot in only when it holds
+// something newer. Neither side ever waits and the reader always gets the newest complete value.
+template <class T>
+class TripleBuffer {
+private:
+    static const uint8_t freshBit = 4;
+    T slots[3];
+    atomic<uint8_t> middle{1};
+    uint8_t back = 0;
+    uint8_t front = 2;
+
+public:
+    T& Back() { return slots[back]; }
+
+    void Publish() { back = middle.exchange(back | freshBit, memory_order_acq_rel) & 3; }
+
+    bool Acquire()
+    {
+        if (!(middle.load(memory_order_relaxed) & freshBit)) return false;
+        front = middle.exchange(front, memory_order_acq_rel) & 3;
+        return true;
+    }
+
+    const T& Front() const { return slots[front]; }
+};
+
+// --- Analytics Compression ---
+// Small greedy LZ77: [varint literal count][literals][varint match length - 4][u16 offset], repeated;
+// a block ends after its literals when no match follows.
+void WriteVarint(vector<uint8_t>& out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+// Returns bytes used, 0 if the buffer ends mid-varint.
+size_t ReadVarint(const uint8_t* data, size_t size, uint32_t& value)
+{
+    value = 0;
+    for (size_t i = 0; i < size && i < 5; i++)
+    {
+        value |= (uint32_t)(data[i] & 0x7F) << (7 * i);
+        if (!(data[i] & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+void CompressBlock(const vector<uint8_t>& in, vector<uint8_t>& out)
+{
+    const int hashBits = 12;
+    vector<int32_t> table(1 << hashBits, -1);
+    size_t literalStart = 0, at = 0;
+    while (at + 4 <= in.size())
+    {
+        uint32_t word;
+        memcpy(&word, &in[at], 4);
+        uint32_t hash = (word * 2654435761u) >> (32 - hashBits);
+        int32_t candidate = table[hash];
+        table[hash] = (int32_t)at;
+        if (candidate < 0 || at - candidate > 0xFFFF || memcmp(&in[candidate], &in[at], 4) != 0)
+        {
+            at++;
+            continue;
+        }
+        size_t length = 4;
+        while (at + length < in.size() && in[candidate + length] == in[at + length]) length++;
+        WriteVarint(out, (uint32_t)(at - literalStart));
+        out.insert(out.end(), in.begin() + literalStart, in.begin() + at);
+        WriteVarint(out, (uint32_t)(length - 4));
+        out.push_back((uint8_t)(at - candidate));
+        out.push_back((uint8_t)((at - candidate) >> 8));
+        at += length;
+        literalStart = at;
+    }
+    WriteVarint(out, (uint32_t)(in.size() - literalStart));
+    out.insert(out.end(), in.begin() + literalStart, in.end());
+}
+
+bool DecompressBlock(const uint8_t* data, size_t size, size_t rawSize, vector<uint8_t>& out)
+{
+    size_t at = 0;
+    out.clear();
+    while (at < size)
+    {
+        uint32_t literals, length;
+        size_t used = ReadVarint(data + at, size - at, literals);
+        at += used;
+        if (!used || at + literals > size) return false;
+        out.insert(out.end(), data + at, data + at + literals);
+        at += literals;
+        if (at == size) break;
+        used = ReadVarint(data + at, size - at, length);
+        at += used;
+        if (!used || at + 2 > size) return false;
+        size_t distance = data[at] | (data[at + 1] << 8);
+        at += 2;
+        if (distance == 0 || distance > out.size()) return false;
+        for (size_t i = 0; i < length + 4; i++) out.push_back(out[out.size() - distance]);
+    }
+    return out.size() == rawSize;
+}
+
+// --- AnalyticsLog Class ---
+// Log() only copies a POD event into a lock-free ring. The writer thread varint-encodes events
+// into batches, compresses each batch into a block and appends it to analytics.0.log, rotating
+// to analytics.1.log ... when the file grows past analyticsFileBytes.
+enum AnalyticsEventType : uint8_t {
+    EVENT_SESSION_START,   // a: mode (0 easy, 1 hard, 2 versus, 3+ headless rule sets)
+    EVENT_FOOD,            // a: score, b: snake length
+    EVENT_EXPLOSIVE,       // a: decayed points, b: ticks since it spawned
+    EVENT_DEATH,           // a: DeathCause, b: score, c: snake length
+    EVENT_SESSION_END,     // a: duration ms, b: score, c: food eaten
+    EVENT_INPUT            // a: key-to-screen latency in microseconds
+};
+
+enum DeathCause { DEATH_EDGE, DEATH_WALL, DEATH_TAIL };
+
+struct AnalyticsEvent {
+    uint8_t type;
+    uint32_t timeMs;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+};
+
+const uint32_t analyticsBlockMagic = 0x4B4C4E41; // "ANLK"
+const size_t analyticsBatchBytes = 32 * 1024;
+const long analyticsFileBytes = 4 * 1024 * 1024;
+const int analyticsKeptFiles = 5;
+
+class AnalyticsLog {
+private:
+    SpscRing<AnalyticsEvent, 16384> ring;
+    atomic<bool> stopping{false};
+    atomic<uint32_t> dropped{0};
+    atomic_flag pushing = ATOMIC_FLAG_INIT;
+    double openedAt;
+    thread worker;
+
+public:
+    AnalyticsLog() : openedAt(NowSeconds()), worker(&AnalyticsLog::Run, this) {}
+
+    ~AnalyticsLog()
+    {
+        stopping = true;
+        worker.join();
+    }
+
+    void Log(uint8_t type, int32_t a = 0, int32_t b = 0, int32_t c = 0)
+    {
+        // Both the frame thread and SimThread log; the ring takes one producer at a time.
+        AnalyticsEvent event = {type, (uint32_t)((NowSeconds() - openedAt) * 1000.0), a, b, c};
+        while (pushing.test_and_set(memory_order_acquire)) {}
+        if (!ring.Push(&event, 1)) dropped++;
+        pushing.clear(memory_order_release);
+    }
+
+    static string FileName(int index) { return "analytics." + to_string(index) + ".log"; }
+
+private:
+    static uint32_t ZigZag(int32_t value) { return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); }
+
+    void Run()
+    {
+        vector<uint8_t> batch, block;
+        AnalyticsEvent events[256];
+        uint32_t lastTime = 0;
+        double lastFlush = NowSeconds();
+        while (true)
+        {
+            bool done = stopping;
+            size_t count;
+            while ((count = ring.Pop(events, 256)) > 0)
+            {
+                for (size_t i = 0; i < count; i++)
+                {
+                    batch.push_back(events[i].type);
+                    WriteVarint(batch, events[i].timeMs - lastTime);
+                    WriteVarint(batch, ZigZag(events[i].a));
+                    WriteVarint(batch, ZigZag(events[i].b));
+                    WriteVarint(batch, ZigZag(events[i].c));
+                    lastTime = events[i].timeMs;
+                }
+            }
+            if (!batch.empty() && (done || batch.size() >= analyticsBatchBytes || NowSeconds() - lastFlush > 5.0))
+            {
+                block.clear();
+                CompressBlock(batch, block);
+                WriteBlock(batch.size(), block);
+                batch.clear();
+                lastTime = 0;
+                lastFlush = NowSeconds();
+            }
+            if (done) break;
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+        if (dropped) printf("Analytics: dropped %u events\n", dropped.load());
+    }
+
+    void WriteBlock(size_t rawSize, const vector<uint8_t>& block)
+    {
+        string current = FileName(0);
+        FILE* file = fopen(current.c_str(), "ab");
+        if (file == NULL)
+        {
+            printf("Error: Could not open %s for writing\n", current.c_str());
+            return;
+        }
+        uint8_t header[12];
+        WriteU32(header, analyticsBlockMagic);
+        WriteU32(header + 4, (uint32_t)rawSize);
+        WriteU32(header + 8, (uint32_t)block.size());
+        fwrite(header, 1, sizeof(header), file);
+        fwrite(block.data(), 1, block.size(), file);
+        long size = ftell(file);
+        fclose(file);
+
+        if (size < analyticsFileBytes) return;
+        remove(FileName(analyticsKeptFiles - 1).c_str());
+        for (int i = analyticsKeptFiles - 1; i > 0; i--)
+        {
+            rename(FileName(i - 1).c_str(), FileName(i).c_str());
+        }
+    }
+};
+
+// Prints every event of a log file, one per line.
+int DumpAnalytics(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("Error: Could not open %s\n", path);
+        return 1;
+    }
+    static const char* names[] = {"session_start", "food", "explosive", "death", "session_end", "input"};
+    uint8_t header[12];
+    vector<uint8_t> block, raw;
+    while (fread(header, 1, sizeof(header), file) == sizeof(header) && ReadU32(header) == analyticsBlockMagic)
+    {
+        block.resize(ReadU32(header + 8));
+        if (fread(block.data(), 1, block.size(), file) != block.size() || !DecompressBlock(block.data(), block.size(), ReadU32(header + 4), raw))
+        {
+            printf("Error: corrupt block in %s\n", path);
+            break;
+        }
+        size_t at = 0;
+        uint32_t time = 0, delta, values[3];
+        while (at < raw.size())
+        {
+            uint8_t type = raw[at++];
+            size_t used = ReadVarint(raw.data() + at, raw.size() - at, delta);
+            for (int i = 0; i < 3 && used; i++)
+            {
+                at += used;
+                used = ReadVarint(raw.data() + at, raw.size() - at, values[i]);
+            }
+            if (!used) break;
+            at += used;
+            time += delta;
+            printf("%10u ms  %-13s", time, type < 6 ? names[type] : "?");
+            for (int i = 0; i < 3; i++) printf(" %d", (int32_t)((values[i] >> 1) ^ (0u - (values[i] & 1))));
+            printf("\n");
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+// --- AudioMixer Class ---
+// Short effects stay decoded in memory; the long menu tracks are streamed, which is what keeps
+// resident memory down (a decoded minute of music is ~20 MB in the device's float stereo format).
+// Requests made during a frame are resolved together in Update(): repeats collapse, the highest
+// priority goes first, and every category as well as the whole effect pool has a voice limit.
+// A busy tick therefore costs a handful of PlaySound calls instead of one per event.
+enum SoundId {
+    SOUND_EAT, SOUND_WALL, SOUND_SELECT, SOUND_MENU_MOVE, SOUND_GAME_START, SOUND_GAME_OVER,
+    SOUND_MENU_ENTER, SOUND_MENU_ENTER_HARD, SOUND_EXPLOSIVE_EAT, SOUND_COUNT
+};
+enum SoundCategory { CATEGORY_UI, CATEGORY_GAMEPLAY, CATEGORY_JINGLE, CATEGORY_MUSIC, CATEGORY_COUNT };
+
+struct SoundInfo {
+    const char* path;
+    SoundCategory category;
+    int priority;   // higher may cut off lower within a full category or pool
+};
+
+const SoundInfo soundTable[SOUND_COUNT] = {
+    {"Sounds/eat.mp3", CATEGORY_GAMEPLAY, 2},
+    {"Sounds/wall.mp3", CATEGORY_GAMEPLAY, 3},
+    {"Sounds/select.mp3", CATEGORY_UI, 1},
+    {"Sounds/menumove.mp3", CATEGORY_UI, 0},
+    {"Sounds/gamestart.mp3", CATEGORY_JINGLE, 1},
+    {"Sounds/gameover.mp3", CATEGORY_JINGLE, 2},
+    {"Sounds/menuenter.mp3", CATEGORY_MUSIC, 0},
+    {"Sounds/menuEnterHard.mp3", CATEGORY_MUSIC, 0},
+    {"Sounds/explosiveEat.mp3", CATEGORY_GAMEPLAY, 3},
+};
+const int categoryVoices[CATEGORY_COUNT] = {1, 2, 1, 1};
+const int effectVoices = 3;   // effects playing at once across categories; music is separate
+
+class AudioMixer {
+public:
+    size_t decodedBytes = 0;     // PCM held for effects
+    size_t streamBytes = 0;      // stream buffers of the music tracks
+    size_t undecodedBytes = 0;   // what the music tracks would take if decoded like effects
+
+    void Load()
+    {
+        for (int id = 0; id < SOUND_COUNT; id++)
+        {
+            const SoundInfo& info = soundTable[id];
+            if (info.category == CATEGORY_MUSIC)
+            {
+                music[id] = LoadMusicStreamTracked(info.path, "AudioMixer");
+                music[id].looping = false;
+                loaded[id] = music[id].ctxData != NULL;
+                if (!loaded[id]) continue;
+                streamBytes += MusicStreamBytes(music[id]);
+                undecodedBytes += (size_t)music[id].frameCount * 2 * sizeof(float);
+            }
+            else
+            {
+                sounds[id] = TrackSound(LoadSound(info.path), "AudioMixer");
+                loaded[id] = sounds[id].frameCount > 0;
+                decodedBytes += SoundBytes(sounds[id]);
+            }
+        }
+    }
+
+    void Unload()
+    {
+        for (int id = 0; id < SOUND_COUNT; id++)
+        {
+            if (!loaded[id]) continue;
+            if (soundTable[id].category == CATEGORY_MUSIC) UnloadMusicStreamTracked(music[id], "AudioMixer");
+            else UnloadSoundTracked(sounds[id], "AudioMixer");
+            loaded[id] = false;
+        }
+    }
+
+    // Safe from any thread; everything else belongs to the frame thread.
+    void Play(SoundId id) { pending.fetch_or(1u << id, memory_order_relaxed); }
+
+    void Stop(SoundId id)
+    {
+        pending.fetch_and(~(1u << id), memory_order_relaxed);
+        if (!loaded[id]) return;
+        if (soundTable[id].category == CATEGORY_MUSIC) StopMusicStream(music[id]);
+        else StopSound(sounds[id]);
+        playing[id] = false;
+    }
+
+    static int IdForPath(const string& path)
+    {
+        for (int id = 0; id < SOUND_COUNT; id++)
+        {
+            if (path == soundTable[id].path) return id;
+        }
+        return -1;
+    }
+
+    // Hot reload: the wave was decoded off the frame thread, only the device buffer is made here.
+    void Replace(SoundId id, Wave wave)
+    {
+        Stop(id);
+        if (loaded[id])
+        {
+            decodedBytes -= SoundBytes(sounds[id]);
+            UnloadSoundTracked(sounds[id], "AudioMixer");
+        }
+        sounds[id] = TrackSound(LoadSoundFromWave(wave), "AudioMixer");
+        loaded[id] = sounds[id].frameCount > 0;
+        decodedBytes += SoundBytes(sounds[id]);
+    }
+
+    // Opening a stream only reads headers (mp3 also scans frames for its length), so it stays here.
+    void Reopen(SoundId id)
+    {
+        Stop(id);
+        if (loaded[id]) UnloadMusicStreamTracked(music[id], "AudioMixer");
+        music[id] = LoadMusicStreamTracked(soundTable[id].path, "AudioMixer");
+        music[id].looping = false;
+        loaded[id] = music[id].ctxData != NULL;
+    }
+
+    // Once per frame: feeds the music streams and starts this frame's requests.
+    void Update()
+    {
+        for (int id = 0; id < SOUND_COUNT; id++)
+        {
+            if (!playing[id]) continue;
+            if (soundTable[id].category == CATEGORY_MUSIC)
+            {
+                UpdateMusicStream(music[id]);
+                playing[id] = IsMusicStreamPlaying(music[id]);
+            }
+            else
+            {
+                playing[id] = IsSoundPlaying(sounds[id]);
+            }
+        }
+        uint32_t requested = pending.exchange(0, memory_order_relaxed);
+        while (requested)
+        {
+            int best = -1;
+            for (int id = 0; id < SOUND_COUNT; id++)
+            {
+                if ((requested >> id) & 1 && (best < 0 || soundTable[id].priority > soundTable[best].priority)) best = id;
+            }
+            requested &= ~(1u << best);
+            Start((SoundId)best);
+        }
+    }
+
+private:
+    Sound sounds[SOUND_COUNT] = {};
+    Music music[SOUND_COUNT] = {};
+    bool loaded[SOUND_COUNT] = {};
+    bool playing[SOUND_COUNT] = {};
+    atomic<uint32_t> pending{0};
+
+    // Restarting a sound that is already playing reuses its voice; otherwise a full category or
+    // pool gives up its lowest-priority voice if that is not above the newcomer, or drops it.
+    void Start(SoundId id)
+    {
+        if (!loaded[id]) return;
+        SoundCategory category = soundTable[id].category;
+        if (!playing[id])
+        {
+            if (!MakeRoom(id, true)) return;
+            if (category != CATEGORY_MUSIC && !MakeRoom(id, false)) return;
+        }
+        if (category == CATEGORY_MUSIC)
+        {
+            StopMusicStream(music[id]);
+            PlayMusicStream(music[id]);
+        }
+        else
+        {
+            PlaySound(sounds[id]);
+        }
+        playing[id] = true;
+    }
+
+    bool MakeRoom(SoundId id, bool sameCategory)
+    {
+        SoundCategory category = soundTable[id].category;
+        int used = 0, weakest = -1;
+        for (int other = 0; other < SOUND_COUNT; other++)
+        {
+            if (!playing[other]) continue;
+            if (sameCategory ? soundTable[other].category != category : soundTable[other].category == CATEGORY_MUSIC) continue;
+            used++;
+            if (weakest < 0 || soundTable[other].priority < soundTable[weakest].priority) weakest = other;
+        }
+        if (used < (sameCategory ? categoryVoices[category] : effectVoices)) return true;
+        if (soundTable[weakest].priority > soundTable[id].priority) return false;
+        Stop((SoundId)weakest);
+        return true;
+    }
+};
+
+// --- GameState Snapshot ---
+// Plain memcpy-able copy of everything Game::Update touches; used for rollback. A snake never has
+// more segments than the largest board has cells, so the body is never cut short.
+const int maxSnakeCells = maxCellCount * maxCellCount;
+
+struct CellPos {
+    int16_t x;
+    int16_t y;
+};
+
+struct SnakeState {
+    CellPos body[maxSnakeCells];
+    uint16_t length;
+    int8_t dirX;
+    int8_t dirY;
+    bool addSegment;
+};
+
+struct GameState {
+    uint32_t tick;
+    uint64_t rng;
+    SnakeState snakes[2];
+    CellPos food;
+    CellPos explosivePos;
+    int32_t explosivePoints;
+    uint32_t explosiveSpawnTick;
+    bool explosiveActive;
+    int32_t scores[2];
+    int32_t foodEatenCount;
+    int32_t versusWinner;
+    bool running;
+    bool gameovermenu;
+    uint8_t mapStyle;       // MapStyle of the hard-mode map; seed only matters for procedural ones
+    uint64_t mapSeed;
+    bool wrapEdges;
+};
+
+void SaveSnakeState(const Snake& snake, SnakeState& state)
+{
+    state.length = (uint16_t)snake.body.size();
+    for (unsigned int i = 0; i < state.length; i++)
+    {
+        state.body[i] = CellPos{(int16_t)snake.body[i].x, (int16_t)snake.body[i].y};
+    }
+    state.dirX = (int8_t)snake.direction.x;
+    state.dirY = (int8_t)snake.direction.y;
+    state.addSegment = snake.addSegment;
+}
+
+void LoadSnakeState(Snake& snake, const SnakeState& state)
+{
+    snake.body.resize(state.length);
+    for (unsigned int i = 0; i < state.length; i++)
+    {
+        snake.body[i] = Vector2{(float)state.body[i].x, (float)state.body[i].y};
+    }
+    snake.direction = Vector2{(float)state.dirX, (float)state.dirY};
+    snake.addSegment = state.addSegment;
+}
+
+// --- Effect Events ---
+// What the game tells the particle system (see Particle System). Positions are board cells; a wall
+// hit can be just outside the board.
+enum EffectType : uint8_t { EFFECT_EAT, EFFECT_EXPLOSION, EFFECT_WALL, EFFECT_DEBRIS };
+
+struct EffectEvent {
+    EffectType type;
+    float x;
+    float y;
+    Color color;
+};
+
+typedef SpscRing<EffectEvent, 1024> EffectRing;
+const int maxDebrisEvents = 96;    // a long snake breaks up into at most this many pieces
+
+// --- Game Class ---
+class Game
+{
+public:
+    Snake snake = Snake();
+    Snake rival = Snake();
+    Rng rng;
+    Food food;
+    ExplosiveFood explosiveFood;
+    MapBase* hardMap = nullptr;       // &fixedMap, procedural or null; never owned
+    unsigned int mapGeneration = 0;   // bumped whenever hardMap is replaced
+    HardModeMap fixedMap = HardModeMap(cellSize);
+    unique_ptr<ProceduralMap> procedural;
+    bool running = false;
+    int score = 0;
+    int highestscore = 0;
+    int foodEatenCount = 0;
+    unsigned int tick = 0;
+    bool versus = false;
+    int rivalScore = 0;
+    int versusWinner = -1;
+    bool silent = false;
+    AnalyticsLog* analytics = nullptr;
+    bool sessionActive = false;
+    double sessionStart = 0;
+    AudioMixer audio;
+    AudioMixer* sink = nullptr;       // set on SimThread's copy: its sounds play through the frame thread's mixer
+    EffectRing* effects = nullptr;    // particle events; the frame thread's game and SimThread's copy share one ring
+    bool gameovermenu = false;
+    Reachability reach;               // single-player board regions, kept by Update; stale in versus
+    uint8_t trapMoves = 0;            // with dangerHints: directions that survive a step but lead into a dead end
+
+    Game() : rng((uint64_t)time(nullptr)), food(snake.body, nullptr, &rng), explosiveFood(nullptr, &rng)
+    {
+        InitAudioDevice();
+        audio.Load();
+        highestscore = loadhighestscore();
+        food.reach = explosiveFood.reach = &reach;
+    }
+
+    explicit Game(AudioMixer* sink) : food(snake.body, nullptr, &rng, false), explosiveFood(nullptr, &rng), sink(sink)
+    {
+        food.reach = explosiveFood.reach = &reach;
+    }
+
+    ~Game()
+    {
+        audio.Unload();
+        if (!sink) CloseAudioDevice();
+    }
+
+    // SimThread hand-over in either direction: state, map, high score and the open analytics session.
+    void TakeOver(Game& from)
+    {
+        if (!from.hardMap) DisableHardMode();
+        else if (from.hardMap == &from.fixedMap)
+        {
+            UseHardModeMap();
+            fixedMap.LoadWalls();
+        }
+        else if (hardMap != procedural.get() || procedural->style != from.procedural->style || procedural->seed != from.procedural->seed)
+        {
+            UseProceduralMap(from.procedural->style, from.procedural->seed);
+        }
+        GameState state;
+        from.SaveState(state);
+        LoadState(state);
+        highestscore = from.highestscore;
+        silent = from.silent;
+        sessionActive = from.sessionActive;
+        sessionStart = from.sessionStart;
+        from.sessionActive = false;
+    }
+
+    // With a procedural style every round gets a fresh map from the game's own rng.
+    void InitializeHardMode()
+    {
+        if (mapStyle != MAP_STYLE_FIXED) UseProceduralMap(mapStyle, rng.Next());
+        else UseHardModeMap();
+    }
+
+    void UseHardModeMap()
+    {
+        if (hardMap != &fixedMap) {
+            hardMap = &fixedMap;
+            mapGeneration++;
+        }
+        food.map = hardMap;
+        explosiveFood.map = hardMap;
+        reach.Invalidate();
+        food.position = food.GenerateRandomPos(snake.body);
+        explosiveFood.eat();
+    }
+
+    // Hot reload: same map object with the new walls; food that ends up inside one moves.
+    void ReloadHardModeWalls()
+    {
+        if (hardMap != &fixedMap) return;
+        fixedMap.LoadWalls();
+        mapGeneration++;
+        reach.Invalidate();
+        if (fixedMap.CheckCollision(Vector2{offset + food.position.x * cellSize, offset + food.position.y * cellSize})) food.position = food.GenerateRandomPos(snake.body);
+    }
+
+    void UseProceduralMap(MapStyle style, uint64_t seed)
+    {
+        if (procedural) procedural->Generate(style, seed);
+        else procedural.reset(new ProceduralMap(cellCount, style, seed, cellSize));
+        hardMap = procedural.get();
+        mapGeneration++;
+        food.map = hardMap;
+        explosiveFood.map = hardMap;
+        reach.Invalidate();
+        food.position = food.GenerateRandomPos(snake.body);
+        explosiveFood.eat();
+    }
+
+    void DisableHardMode()
+    {
+        if (hardMap) {
+            hardMap = nullptr;
+            mapGeneration++;
+        }
+        food.map = nullptr;
+        explosiveFood.map = nullptr;
+        reach.Invalidate();
+        food.position = food.GenerateRandomPos(snake.body);
+        explosiveFood.eat();
+    }
+
+    void Draw()
+    {
+        if (hardMap) hardMap->Draw();
+        food.Draw();
+        explosiveFood.Draw();
+        snake.Draw();
+        if (versus) rival.Draw();
+    }
+
+    // Sounds are muted while a rollback re-simulates ticks that were already heard.
+    void Play(SoundId sound)
+    {
+        if (!silent) (sink ? sink : &audio)->Play(sound);
+    }
+
+    // Effects follow the sounds: nothing for re-simulated ticks, and a full ring drops the event.
+    void Effect(EffectType type, Vector2 cell, Color color)
+    {
+        if (silent || !effects) return;
+        EffectEvent event = {type, cell.x, cell.y, color};
+        effects->Push(&event, 1);
+    }
+
+    void Debris(const Snake& dead)
+    {
+        int stride = max(1, (int)dead.body.size() / maxDebrisEvents);
+        for (unsigned int i = 0; i < dead.body.size(); i += stride) Effect(EFFECT_DEBRIS, dead.body[i], dead.color);
+    }
+
+    int loadhighestscore()
+    {
+        FILE* file = fopen("highestscore.txt", "r");
+        if (file != NULL)
+        {
+            fscanf(file, "%d", &highestscore);
+            fclose(file);
+        }
+        else
+        {
+            file = fopen("highestscore.txt", "w");
+            if (file != NULL)
+            {
+                fprintf(file, "%d", 0);
+                fclose(file);
+            }
+            highestscore = 0;
+        }
+        return highestscore;
+    }
+
+    void savehighestscore()
+    {
+        FILE* file = fopen("highestscore.txt", "w");
+        if (file != NULL)
+        {
+            fprintf(file, "%d", highestscore);
+            fclose(file);
+        }
+        else
+        {
+            printf("Error: Could not open highestscore.txt for writing\n");
+        }
+    }
+
+    void resetScores()
+    {
+        score = 0;
+        highestscore = 0;
+        foodEatenCount = 0;
+        savehighestscore();
+    }
+
+    void resetCurrentScore()
+    {
+        score = 0;
+        foodEatenCount = 0;
+    }
+
+    void Update()
+    {
+        if (running)
+        {
+            if (!sessionActive) BeginSession();
+            tick++;
+            int tail = CellIndex(snake.body.back());
+            bool grows = snake.addSegment;
+            snake.Update();
+            if (wrapEdges) WrapHead(snake);
+            TrackMove(grows ? -1 : tail);
+            explosiveFood.update(tick);
+            CheckCollisionWithFood();
+            CheckCollisionWithExplosiveFood();
+            CheckCollisionWithEdges();
+            CheckCollisionWithTail();
+            if (running && dangerHints) UpdateTrapMoves();
+        }
+    }
+
+    static int CellIndex(Vector2 cell) { return (int)cell.y * cellCount + (int)cell.x; }
+
+    static bool OnBoard(Vector2 cell) { return cell.x >= 0 && cell.y >= 0 && cell.x < cellCount && cell.y < cellCount; }
+
+    static Vector2 NextCell(Vector2 cell, int dir)
+    {
+        Vector2 next = Vector2Add(cell, Vector2{(float)kernelDx[dir], (float)kernelDy[dir]});
+        if (wrapEdges) next = Vector2{fmodf(next.x + cellCount, (float)cellCount), fmodf(next.y + cellCount, (float)cellCount)};
+        return next;
+    }
+
+    // The tail left freedTail (-1 while growing) and the head moved on; a head that left the board
+    // or hit something is about to end the round, so the regions are just dropped.
+    void TrackMove(int freedTail)
+    {
+        if (!reach.Ready() || reach.size != cellCount)
+        {
+            if (OnBoard(snake.body[0])) RebuildReach();
+            return;
+        }
+        if (freedTail >= 0) reach.Unblock(freedTail);
+        if (OnBoard(snake.body[0]) && reach.Free(CellIndex(snake.body[0]))) reach.Block(CellIndex(snake.body[0]));
+        else reach.Invalidate();
+    }
+
+    void RebuildReach()
+    {
+        int cells = cellCount * cellCount;
+        if (wallMaskGeneration != mapGeneration || (int)wallMask.size() != cells)
+        {
+            wallMask.assign(cells, 0);
+            for (int cell = 0; hardMap && cell < cells; cell++)
+            {
+                wallMask[cell] = hardMap->CheckCollision(Vector2{(float)(offset + cell % cellCount * cellSize), (float)(offset + cell / cellCount * cellSize)});
+            }
+            wallMaskGeneration = mapGeneration;
+        }
+        blocked = wallMask;
+        for (const Vector2& cell : snake.body)
+        {
+            if (OnBoard(cell)) blocked[CellIndex(cell)] = 1;
+        }
+        reach.Rebuild(blocked.data(), cellCount, wrapEdges);
+    }
+
+    // Whether the snake can turn to dir (0 up, 1 down, 2 left, 3 right) and still have room for k ticks.
+    bool SafeFor(int dir, int k)
+    {
+        if (!reach.Ready() || reach.size != cellCount) RebuildReach();
+        return reach.SafeFor(CellIndex(snake.body[0]), CellIndex(snake.body.back()), !snake.addSegment, dir, k);
+    }
+
+    void UpdateTrapMoves()
+    {
+        trapMoves = 0;
+        if (!reach.Ready() || reach.size != cellCount) RebuildReach();
+        int length = (int)snake.body.size();
+        for (int dir = 0; dir < 4; dir++)
+        {
+            Vector2 next = NextCell(snake.body[0], dir);
+            if (!OnBoard(next) || !reach.Free(CellIndex(next))) continue;
+            if (!SafeFor(dir, length)) trapMoves |= 1 << dir;
+        }
+    }
+
+    void WrapHead(Snake& mover)
+    {
+        mover.body[0].x = fmodf(mover.body[0].x + cellCount, (float)cellCount);
+        mover.body[0].y = fmodf(mover.body[0].y + cellCount, (float)cellCount);
+    }
+
+    void CheckCollisionWithFood()
+    {
+        if (Vector2Equals(snake.body[0], food.position))
+        {
+            Effect(EFFECT_EAT, food.position, explosiveFoodColor);
+            food.position = food.GenerateRandomPos(snake.body);
+            snake.addSegment = true;
+            score++;
+            foodEatenCount++;
+            if (analytics) analytics->Log(EVENT_FOOD, score, (int)snake.body.size());
+            Play(SOUND_EAT);
+            if (explosiveFood.shouldSpawn(foodEatenCount))
+            {
+                explosiveFood.spawn(snake.body, tick);
+            }
+        }
+    }
+
+    void CheckCollisionWithExplosiveFood()
+    {
+        if (explosiveFood.isFoodActive() && Vector2Equals(snake.body[0], explosiveFood.getPosition()))
+        {
+            if (analytics) analytics->Log(EVENT_EXPLOSIVE, explosiveFood.getPoints(), (int)(tick - explosiveFood.spawnTick));
+            score += explosiveFood.getPoints();
+            explosiveFood.eat();
+            snake.addSegment = true;
+            Play(SOUND_EXPLOSIVE_EAT);
+            Effect(EFFECT_EXPLOSION, snake.body[0], explosiveFoodColor);
+        }
+    }
+
+    void CheckCollisionWithEdges()
+    {
+        if (!isHardMode || !hardMap)
+        {
+            if (snake.body[0].x >= cellCount || snake.body[0].x < 0 ||
+                snake.body[0].y >= cellCount || snake.body[0].y < 0)
+            {
+                Play(SOUND_WALL);
+                Effect(EFFECT_WALL, snake.body[0], WHITE);
+                GameOver(DEATH_EDGE);
+            }
+        }
+        if (hardMap)
+        {
+            Rectangle snakeHead = {offset + snake.body[0].x * cellSize, offset + snake.body[0].y * cellSize, (float)cellSize, (float)cellSize};
+            bool hitWall = hardMap->CheckCollisionWithRect(snakeHead);
+            if (hitWall || snake.body[0].x >= cellCount || snake.body[0].x < 0 ||
+                snake.body[0].y >= cellCount || snake.body[0].y < 0)
+            {
+                Play(SOUND_WALL);
+                Effect(EFFECT_WALL, snake.body[0], WHITE);
+                GameOver(hitWall ? DEATH_WALL : DEATH_EDGE);
+            }
+        }
+    }
+
+    void BeginSession()
+    {
+        sessionActive = true;
+        sessionStart = NowSeconds();
+        if (analytics) analytics->Log(EVENT_SESSION_START, versus ? 2 : (isHardMode ? 1 : 0));
+    }
+
+    void EndSession()
+    {
+        if (!sessionActive) return;
+        sessionActive = false;
+        if (analytics) analytics->Log(EVENT_SESSION_END, (int)((NowSeconds() - sessionStart) * 1000.0), score, foodEatenCount);
+    }
+
+    void GameOver(DeathCause cause)
+    {
+        if (analytics) analytics->Log(EVENT_DEATH, cause, score, (int)snake.body.size());
+        EndSession();
+        if (score > highestscore)
+        {
+            highestscore = score;
+            savehighestscore();
+        }
+        Debris(snake);
+        snake.Reset();
+        reach.Invalidate();
+        trapMoves = 0;
+        food.position = food.GenerateRandomPos(snake.body);
+        explosiveFood.eat();
+        running = false;
+        gameovermenu = true;
+        Play(SOUND_GAME_OVER);
+    }
+
+    void CheckCollisionWithTail()
+    {
+        if (ElementInDeque(snake.body[0], snake.body, 1))
+        {
+            GameOver(DEATH_TAIL);
+        }
+    }
+
+    // --- Versus (two snakes on one board, driven by LockstepSession) ---
+    void StartVersus(uint64_t seed)
+    {
+        rng.Seed(seed);
+        versus = true;
+        reach.Invalidate();
+        snake.Reset();
+        rival.body = {Vector2{18, 15}, Vector2{19, 15}, Vector2{20, 15}};
+        rival.direction = {-1, 0};
+        rival.addSegment = false;
+        rival.color = (Color){0, 82, 172, 255};
+        food.position = food.GenerateRandomPos(VersusBodies());
+        explosiveFood.eat();
+        resetCurrentScore();
+        rivalScore = 0;
+        versusWinner = -1;
+        tick = 0;
+        running = true;
+        gameovermenu = false;
+    }
+
+    BodyView VersusBodies() const
+    {
+        return BodyView(snake.body, rival.body);
+    }
+
+    void UpdateVersus()
+    {
+        if (!running) return;
+
+        tick++;
+        snake.Update();
+        rival.Update();
+        explosiveFood.update(tick);
+        VersusEat(snake, score);
+        VersusEat(rival, rivalScore);
+
+        bool snakeDead = VersusCrashed(snake, rival);
+        bool rivalDead = VersusCrashed(rival, snake);
+        if (snakeDead || rivalDead)
+        {
+            versusWinner = (snakeDead && rivalDead) ? 2 : (snakeDead ? 1 : 0);
+            if (snakeDead) Debris(snake);
+            if (rivalDead) Debris(rival);
+            running = false;
+            gameovermenu = true;
+            Play(SOUND_WALL);
+            Play(SOUND_GAME_OVER);
+        }
+    }
+
+    void VersusEat(Snake& eater, int& eaterScore)
+    {
+        if (Vector2Equals(eater.body[0], food.position))
+        {
+            Effect(EFFECT_EAT, food.position, explosiveFoodColor);
+            eater.addSegment = true;
+            eaterScore++;
+            foodEatenCount++;
+            food.position = food.GenerateRandomPos(VersusBodies());
+            Play(SOUND_EAT);
+            if (explosiveFood.shouldSpawn(foodEatenCount))
+            {
+                explosiveFood.spawn(VersusBodies(), tick);
+            }
+        }
+        if (explosiveFood.isFoodActive() && Vector2Equals(eater.body[0], explosiveFood.getPosition()))
+        {
+            eaterScore += explosiveFood.getPoints();
+            explosiveFood.eat();
+            eater.addSegment = true;
+            Play(SOUND_EXPLOSIVE_EAT);
+            Effect(EFFECT_EXPLOSION, eater.body[0], explosiveFoodColor);
+        }
+    }
+
+    bool VersusCrashed(const Snake& mover, const Snake& other) const
+    {
+        Vector2 head = mover.body[0];
+        if (head.x >= cellCount || head.x < 0 || head.y >= cellCount || head.y < 0) return true;
+        if (hardMap && hardMap->CheckCollision(Vector2{offset + head.x * cellSize, offset + head.y * cellSize})) return true;
+        for (unsigned int i = 1; i < mover.body.size(); i++)
+        {
+            if (Vector2Equals(mover.body[i], head)) return true;
+        }
+        for (unsigned int i = 0; i < other.body.size(); i++)
+        {
+            if (Vector2Equals(other.body[i], head)) return true;
+        }
+        return false;
+    }
+
+    // --- Snapshots ---
+    void SaveState(GameState& state) const
+    {
+        state.tick = tick;
+        state.rng = rng.state;
+        SaveSnakeState(snake, state.snakes[0]);
+        SaveSnakeState(rival, state.snakes[1]);
+        state.food = CellPos{(int16_t)food.position.x, (int16_t)food.position.y};
+        state.explosivePos = CellPos{(int16_t)explosiveFood.position.x, (int16_t)explosiveFood.position.y};
+        state.explosivePoints = explosiveFood.points;
+        state.explosiveSpawnTick = explosiveFood.spawnTick;
+        state.explosiveActive = explosiveFood.isActive;
+        state.scores[0] = score;
+        state.scores[1] = rivalScore;
+        state.foodEatenCount = foodEatenCount;
+        state.versusWinner = versusWinner;
+        state.running = running;
+        state.gameovermenu = gameovermenu;
+        bool generated = hardMap && hardMap == procedural.get();
+        state.mapStyle = generated ? procedural->style : MAP_STYLE_FIXED;
+        state.mapSeed = generated ? procedural->seed : 0;
+        state.wrapEdges = wrapEdges;
+    }
+
+    void LoadState(const GameState& state)
+    {
+        tick = state.tick;
+        rng.state = state.rng;
+        LoadSnakeState(snake, state.snakes[0]);
+        LoadSnakeState(rival, state.snakes[1]);
+        food.position = Vector2{(float)state.food.x, (float)state.food.y};
+        explosiveFood.position = Vector2{(float)state.explosivePos.x, (float)state.explosivePos.y};
+        explosiveFood.points = state.explosivePoints;
+        explosiveFood.spawnTick = state.explosiveSpawnTick;
+        explosiveFood.isActive = state.explosiveActive;
+        score = state.scores[0];
+        rivalScore = state.scores[1];
+        foodEatenCount = state.foodEatenCount;
+        versusWinner = state.versusWinner;
+        running = state.running;
+        gameovermenu = state.gameovermenu;
+        reach.Invalidate();
+    }
+
+private:
+    vector<uint8_t> wallMask;
+    unsigned int wallMaskGeneration = 0;
+    vector<uint8_t> blocked;
+};
+
+// --- Rule Policies ---
+// Each mode is a Rules<> instantiation; SimKernel only ever sees the policies at compile time.
+struct SolidEdges {
+    static const bool wraps = false;
+    static bool Resolve(int& x, int& y, int size) { return x >= 0 && y >= 0 && x < size && y < size; }
+};
+
+struct WrapEdges {
+    static const bool wraps = true;
+    static bool Resolve(int& x, int& y, int size)
+    {
+        x = (x + size) % size;
+        y = (y + size) % size;
+        return true;
+    }
+};
+
+struct NoWalls {
+    static void Build(uint8_t* grid, int size) { (void)grid; (void)size; }
+};
+
+// Same layout as HardModeMap, rasterised once with the map's own collision test.
+struct HardModeWalls {
+    static void Build(uint8_t* grid, int size)
+    {
+        HardModeMap map(cellSize);
+        for (int y = 0; y < size; y++)
+        {
+            for (int x = 0; x < size; x++)
+            {
+                if (map.CheckCollision(Vector2{(float)(offset + x * cellSize), (float)(offset + y * cellSize)})) grid[y * size + x] = 2;
+            }
+        }
+    }
+};
+
+struct ExplosiveOn { static const bool enabled = true; };
+struct ExplosiveOff { static const bool enabled = false; };
+
+template <int Segments>
+struct Growth { static const int segments = Segments; };
+
+template <class EdgePolicy, class WallPolicy, class ExplosivePolicy, class GrowthPolicy>
+struct Rules {
+    typedef EdgePolicy Edges;
+    typedef WallPolicy Walls;
+    typedef ExplosivePolicy Explosive;
+    typedef GrowthPolicy Grow;
+};
+
+typedef Rules<SolidEdges, NoWalls, ExplosiveOn, Growth<1>> EasyRules;
+typedef Rules<SolidEdges, HardModeWalls, ExplosiveOn, Growth<1>> HardRules;
+typedef Rules<WrapEdges, NoWalls, ExplosiveOn, Growth<1>> PortalRules;
+
+// --- SimKernel Class ---
+// Headless, allocation-free step function for batch runs. Mirrors Game::Update: move (pop the
+// tail unless growing), eat food, eat explosive food, then die on edge, wall or own body.
+// --bench-rules plays the same games through both and fails on the first tick they disagree.
+enum StepResult : uint8_t { STEP_MOVED, STEP_ATE, STEP_ATE_EXPLOSIVE, STEP_DIED_EDGE, STEP_DIED_WALL, STEP_DIED_TAIL };
+enum KernelCell : uint8_t { CELL_FREE = 0, CELL_SNAKE = 1, CELL_WALL = 2 };
+
+template <class R>
+class SimKernel {
+public:
+    int size = 0;
+    vector<uint8_t> grid;
+    vector<int32_t> body;      // ring of cell indices, body[headIndex] is the head
+    int headIndex = 0;
+    int length = 0;
+    int pendingGrowth = 0;
+    int direction = 3;
+    int food = -1;
+    int explosive = -1;
+    int explosivePoints = 0;
+    uint32_t explosiveSpawnTick = 0;
+    int score = 0;
+    int foodEatenCount = 0;
+    uint32_t tick = 0;
+    bool alive = false;
+    Rng rng;
+    double secondsPerTick = 0.2;
+    bool trackReach = false;   // keep reach in step with every move; off for runs that never ask
+    Reachability reach;
+
+    void Reset(uint64_t seed, int boardSize = cellCount, double tickSeconds = 0.2)
+    {
+        size = boardSize;
+        secondsPerTick = tickSeconds;
+        grid.assign(size * size, CELL_FREE);
+        body.assign(size * size, 0);
+        R::Walls::Build(grid.data(), size);
+        decayTable.resize(explosiveDuration);
+        for (int i = 0; i < explosiveDuration; i++) decayTable[i] = (int)(explosiveBasePoints * pow(0.9, (double)i));
+        Restart(seed);
+    }
+
+    // A new game on the same board: keeps the walls (including AddWalls and PlaceOnCycle ones).
+    void Restart(uint64_t seed)
+    {
+        for (int cell = 0; cell < size * size; cell++)
+        {
+            if (grid[cell] != CELL_WALL) grid[cell] = CELL_FREE;
+        }
+        rng.Seed(seed);
+        reach.Invalidate();
+        length = 0;
+        headIndex = 0;
+        for (int x = 4; x <= 6; x++) PushHead(9 * size + x);
+        pendingGrowth = 0;
+        direction = 3;
+        explosive = -1;
+        score = 0;
+        foodEatenCount = 0;
+        tick = 0;
+        alive = true;
+        food = RandomFreeCell();
+        SyncReach();
+    }
+
+    int Head() const { return body[headIndex]; }
+    bool Filled() const { return food < 0; }
+
+    // Replaces the snake with the given cells (head first) and re-places the food if it was covered.
+    void SetBody(const int* cells, int count)
+    {
+        reach.Invalidate();
+        for (int i = 0; i < length; i++) grid[body[(headIndex - i + (int)body.size()) % (int)body.size()]] = CELL_FREE;
+        length = 0;
+        for (int i = count - 1; i >= 0; i--) PushHead(cells[i]);
+        int dx = cells[0] % size - cells[1] % size, dy = cells[0] / size - cells[1] / size;
+        direction = dy < 0 ? 0 : dy > 0 ? 1 : dx < 0 ? 2 : 3;
+        pendingGrowth = 0;
+        if (food >= 0 && grid[food] != CELL_FREE) food = RandomFreeCell();
+        SyncReach();
+    }
+    int Tail() const { return body[(headIndex - length + 1 + (int)body.size()) % (int)body.size()]; }
+
+    // Adds the walls of a size * size mask (a ProceduralMap's) and re-places food that landed on one.
+    void AddWalls(const uint8_t* mask)
+    {
+        for (int cell = 0; cell < size * size; cell++)
+        {
+            if (mask[cell] && grid[cell] == CELL_FREE) grid[cell] = CELL_WALL;
+        }
+        if (food >= 0 && grid[food] != CELL_FREE) food = RandomFreeCell();
+        SyncReach();
+    }
+
+    void SyncReach()
+    {
+        if (trackReach) reach.Rebuild(grid.data(), size, R::Edges::wraps);
+    }
+
+    // Whether turning to dir leaves room for k more ticks; needs trackReach.
+    bool SafeFor(int dir, int k)
+    {
+        if ((dir ^ 1) == direction) dir = direction;
+        return reach.SafeFor(Head(), Tail(), pendingGrowth == 0, dir, k);
+    }
+
+    StepResult Step(int dir)
+    {
+        Turn(dir);
+        int cell = NextCell();
+        uint8_t hit = cell < 0 || (cell == Tail() && pendingGrowth == 0) ? CELL_FREE : grid[cell];
+        return Advance(cell, hit);
+    }
+
+    // Takes dir unless it reverses the snake.
+    void Turn(int dir)
+    {
+        if ((dir ^ 1) != direction) direction = dir;
+    }
+
+    // The cell the head moves into on the next tick, -1 off the board.
+    int NextCell() const
+    {
+        int x = Head() % size + kernelDx[direction];
+        int y = Head() / size + kernelDy[direction];
+        return R::Edges::Resolve(x, y, size) ? y * size + x : -1;
+    }
+
+    // Moves the head into cell (from NextCell) once the caller has tested it: hit is what is there,
+    // with the tail's cell counted as free unless the snake is growing.
+    StepResult Advance(int cell, uint8_t hit)
+    {
+        tick++;
+        if (pendingGrowth > 0) pendingGrowth--;
+        else PopTail();
+        if (cell < 0)
+        {
+            alive = false;
+            return STEP_DIED_EDGE;
+        }
+        PushHead(cell);
+
+        StepResult result = STEP_MOVED;
+        if (R::Explosive::enabled && explosive >= 0) DecayExplosive();
+        if (cell == food)
+        {
+            score++;
+            foodEatenCount++;
+            food = RandomFreeCell();
+            if (R::Explosive::enabled && foodEatenCount % explosiveEvery == 0 && explosive < 0)
+            {
+                explosive = RandomFreeCell();
+                explosivePoints = decayTable[0];
+                explosiveSpawnTick = tick;
+            }
+            result = STEP_ATE;
+        }
+        if (R::Explosive::enabled && cell == explosive)
+        {
+            score += explosivePoints;
+            explosive = -1;
+            result = STEP_ATE_EXPLOSIVE;
+        }
+        // Like Snake::addSegment, one tick's pickups grow the snake once.
+        if (result != STEP_MOVED) pendingGrowth += R::Grow::segments;
+        if (hit != CELL_FREE)
+        {
+            alive = false;
+            return hit == CELL_WALL ? STEP_DIED_WALL : STEP_DIED_TAIL;
+        }
+        return result;
+    }
+
+    // True if stepping in dir does not die on this tick (the tail cell counts as free unless growing).
+    bool Safe(int dir) const
+    {
+        if ((dir ^ 1) == direction) dir = direction;
+        int x = Head() % size + kernelDx[dir];
+        int y = Head() / size + kernelDy[dir];
+        if (!R::Edges::Resolve(x, y, size)) return false;
+        int cell = y * size + x;
+        return grid[cell] == CELL_FREE || (cell == Tail() && pendingGrowth == 0 && grid[cell] == CELL_SNAKE);
+    }
+
+private:
+    vector<int> decayTable;
+
+    void PushHead(int cell)
+    {
+        headIndex = (headIndex + 1) % (int)body.size();
+        body[headIndex] = cell;
+        if (grid[cell] != CELL_WALL) grid[cell] = CELL_SNAKE;   // a head that died in a wall leaves it for Restart
+        length++;
+        if (trackReach) reach.Block(cell);
+    }
+
+    void PopTail()
+    {
+        grid[Tail()] = CELL_FREE;
+        if (trackReach) reach.Unblock(Tail());
+        length--;
+    }
+
+    void DecayExplosive()
+    {
+        int elapsed = (int)floor((tick - explosiveSpawnTick) * secondsPerTick + 1e-9);
+        if (elapsed >= (int)decayTable.size()) explosive = -1;
+        else explosivePoints = decayTable[elapsed];
+    }
+
+    // Same draws as Food::GenerateRandomPosStatic: random attempts, then a scan; -1 on a full board.
+    // Unlike the game it does not skip unreachable cells, so every strategy sees the same food.
+    int RandomFreeCell()
+    {
+        for (int attempt = 0; attempt < randomPosAttempts; attempt++)
+        {
+            int x = rng.Range(0, size - 1);
+            int y = rng.Range(0, size - 1);
+            if (grid[y * size + x] == CELL_FREE) return y * size + x;
+        }
+        int freeCount = 0;
+        for (int cell = 0; cell < size * size; cell++) freeCount += grid[cell] == CELL_FREE;
+        if (freeCount == 0) return -1;
+        int pick = rng.Range(0, freeCount - 1);
+        for (int cell = 0; cell < size * size; cell++)
+        {
+            if (grid[cell] == CELL_FREE && pick-- == 0) return cell;
+        }
+        return -1;
+    }
+};
+
+// Directions toward the food, the shortest axis first.
+template <class R>
+void GreedyOrder(const SimKernel<R>& kernel, int preferred[4])
+{
+    int hx = kernel.Head() % kernel.size, hy = kernel.Head() / kernel.size;
+    int fx = kernel.food % kernel.size, fy = kernel.food / kernel.size;
+    preferred[0] = fy < hy ? 0 : 1;
+    preferred[1] = fx < hx ? 2 : 3;
+    preferred[2] = fy < hy ? 1 : 0;
+    preferred[3] = fx < hx ? 3 : 2;
+    if (fy == hy) swap(preferred[0], preferred[1]);
+}
+
+// Heads for the food along the shortest axis, never steps into something that kills it this tick.
+template <class R>
+int GreedyMove(const SimKernel<R>& kernel)
+{
+    int preferred[4];
+    GreedyOrder(kernel, preferred);
+    for (int i = 0; i < 4; i++)
+    {
+        if (kernel.Safe(preferred[i])) return preferred[i];
+    }
+    return kernel.direction;
+}
+
+// The autopilot: GreedyMove, but it passes up moves that leave less room than its own length
+// unless it can follow its tail out; with no such move left it plays GreedyMove. Needs trackReach.
+template <class R>
+int CarefulMove(SimKernel<R>& kernel)
+{
+    int preferred[4];
+    GreedyOrder(kernel, preferred);
+    for (int i = 0; i < 4; i++)
+    {
+        if (kernel.SafeFor(preferred[i], kernel.length)) return preferred[i];
+    }
+    return GreedyMove(kernel);
+}
+
+template <class R>
+void BenchRules(const char* name, long ticks, int mode, AnalyticsLog* log)
+{
+    SimKernel<R> kernel;
+    long done = 0, games = 0, scoreSum = 0;
+    auto start = chrono::steady_clock::now();
+    while (done < ticks)
+    {
+        kernel.Reset((uint64_t)games + 1);
+        if (log) log->Log(EVENT_SESSION_START, mode);
+        while (kernel.alive && kernel.tick < 5000)
+        {
+            StepResult result = kernel.Step(GreedyMove(kernel));
+            if (!log || result == STEP_MOVED) continue;
+            if (result == STEP_ATE) log->Log(EVENT_FOOD, kernel.score, kernel.length);
+            else if (result == STEP_ATE_EXPLOSIVE) log->Log(EVENT_EXPLOSIVE, kernel.explosivePoints, (int)(kernel.tick - kernel.explosiveSpawnTick));
+            else log->Log(EVENT_DEATH, result - STEP_DIED_EDGE, kernel.score, kernel.length);
+        }
+        if (log) log->Log(EVENT_SESSION_END, 0, kernel.score, kernel.foodEatenCount);
+        done += kernel.tick;
+        scoreSum += kernel.score;
+        games++;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-8s %10.0f ticks/s  %6ld games  avg score %.1f\n", name, done / seconds, games, (double)scoreSum / games);
+}
+
+Vector2 KernelCellVector(int cell, int size)
+{
+    return cell < 0 ? Vector2{-1, -1} : Vector2{(float)(cell % size), (float)(cell / size)};
+}
+
+// What the kernel and the game disagree on after the same tick, or null.
+template <class R>
+const char* RulesMismatch(const Game& game, const SimKernel<R>& kernel)
+{
+    if (game.running != kernel.alive) return "death";
+    if (game.score != kernel.score || game.foodEatenCount != kernel.foodEatenCount) return "score";
+    if (!kernel.alive) return nullptr;
+    if ((int)game.snake.body.size() != kernel.length || game.snake.addSegment != (kernel.pendingGrowth > 0)) return "length";
+    int ring = (int)kernel.body.size();
+    for (int i = 0; i < kernel.length; i++)
+    {
+        if (!Vector2Equals(game.snake.body[i], KernelCellVector(kernel.body[(kernel.headIndex - i + ring) % ring], kernel.size))) return "body";
+    }
+    if (game.explosiveFood.isFoodActive() != (kernel.explosive >= 0)) return "explosive food";
+    if (kernel.explosive >= 0 && game.explosiveFood.getPoints() != kernel.explosivePoints) return "explosive points";
+    return nullptr;
+}
+
+// Plays BenchRules' greedy games through Game::Update as well and compares the two every tick, so
+// the kernel's copy of the rules cannot drift from the game's. Food and explosive food are placed
+// where the kernel put them, as the game also skips unreachable cells when it picks a spot.
+template <class R>
+bool CheckRulesAgainstGame(const char* name, int games, bool hard, bool wrap)
+{
+    bool savedHard = isHardMode, savedWrap = wrapEdges;
+    isHardMode = hard;
+    wrapEdges = wrap;
+    AudioMixer mixer;
+    Game game(&mixer);
+    game.silent = true;
+    game.highestscore = 1 << 30;   // so GameOver never writes highestscore.txt
+    if (hard) game.UseHardModeMap();
+    else game.DisableHardMode();
+
+    SimKernel<R> kernel;
+    unique_ptr<GameState> state(new GameState());
+    long ticks = 0;
+    const char* mismatch = nullptr;
+    int g = 0;
+    for (; g < games && !mismatch; g++)
+    {
+        kernel.Reset((uint64_t)g + 1, cellCount, gameSpeed);
+        game.snake.Reset();
+        game.snake.addSegment = false;
+        game.explosiveFood.eat();
+        game.resetCurrentScore();
+        game.reach.Invalidate();
+        game.tick = 0;
+        game.running = true;
+        game.gameovermenu = false;
+        while (kernel.alive && kernel.tick < 5000 && !mismatch)
+        {
+            game.food.position = KernelCellVector(kernel.food, kernel.size);
+            kernel.Turn(GreedyMove(kernel));
+            game.snake.direction = Vector2{(float)kernelDx[kernel.direction], (float)kernelDy[kernel.direction]};
+            kernel.Step(kernel.direction);
+            game.Update();
+            ticks++;
+            mismatch = RulesMismatch(game, kernel);
+            if (!mismatch && kernel.explosive >= 0 && kernel.explosiveSpawnTick == kernel.tick)
+            {
+                game.SaveState(*state);
+                state->explosivePos = CellPos{(int16_t)(kernel.explosive % kernel.size), (int16_t)(kernel.explosive / kernel.size)};
+                game.LoadState(*state);
+            }
+        }
+    }
+    isHardMode = savedHard;
+    wrapEdges = savedWrap;
+    if (mismatch)
+    {
+        printf("Error: %s game %d tick %u: SimKernel and Game::Update disagree on %s\n", name, g, kernel.tick, mismatch);
+        return false;
+    }
+    printf("%-8s %6d games  %8ld ticks match Game::Update\n", name, games, ticks);
+    return true;
+}
+
+// Same partition of the free cells, whatever the labels.
+bool SameRegions(const Reachability& a, const Reachability& b, vector<int>& forward, vector<int>& backward)
+{
+    int cells = a.size * a.size;
+    forward.assign(cells, -1);
+    backward.assign(cells, -1);
+    for (int cell = 0; cell < cells; cell++)
+    {
+        int la = a.Label(cell), lb = b.Label(cell);
+        if ((la < 0) != (lb < 0)) return false;
+        if (la < 0) continue;
+        if (forward[la] < 0 && backward[lb] < 0)
+        {
+            forward[la] = lb;
+            backward[lb] = la;
+        }
+        if (forward[la] != lb || backward[lb] != la || a.RegionSize(la) != b.RegionSize(lb)) return false;
+    }
+    return true;
+}
+
+// Times greedy games with and without region tracking (the same games, as tracking does not change
+// a move), then plays careful games checking the tracked regions against a rebuild after every tick.
+template <class R>
+void BenchReachRules(const char* name, int games)
+{
+    SimKernel<R> kernel;
+    Reachability fresh;
+    vector<int> forward, backward;
+    long ticks[2] = {}, scores[2] = {}, tailDeaths[2] = {}, mismatches = 0;
+    double stepSeconds[2] = {}, rebuildSeconds = 0;
+    kernel.Reset(1);
+    for (int pass = 0; pass < 3; pass++)
+    {
+        bool careful = pass == 2;
+        kernel.trackReach = pass > 0;
+        auto start = chrono::steady_clock::now();
+        for (int game = 0; game < games; game++)
+        {
+            kernel.Restart((uint64_t)game + 1);
+            StepResult result = STEP_MOVED;
+            while (kernel.alive && !kernel.Filled() && kernel.tick < 20000)
+            {
+                result = kernel.Step(careful ? CarefulMove(kernel) : GreedyMove(kernel));
+                if (!careful || !kernel.alive) continue;
+                auto rebuildStart = chrono::steady_clock::now();
+                fresh.Rebuild(kernel.grid.data(), kernel.size, R::Edges::wraps);
+                rebuildSeconds += chrono::duration<double>(chrono::steady_clock::now() - rebuildStart).count();
+                mismatches += !SameRegions(kernel.reach, fresh, forward, backward);
+            }
+            if (pass == 1) continue;
+            ticks[careful] += kernel.tick;
+            scores[careful] += kernel.score;
+            tailDeaths[careful] += result == STEP_DIED_TAIL;
+        }
+        if (pass < 2) stepSeconds[pass] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    printf("%-8s greedy avg score %.1f, %.0f%% ran into themselves | careful avg score %.1f, %.0f%% ran into themselves\n", name,
+           (double)scores[0] / games, 100.0 * tailDeaths[0] / games, (double)scores[1] / games, 100.0 * tailDeaths[1] / games);
+    printf("         tracking %.0f ns/tick on top of a %.0f ns step, full rebuild %.0f ns; %ld mismatches in %ld ticks\n",
+           (stepSeconds[1] - stepSeconds[0]) * 1e9 / ticks[0], stepSeconds[0] * 1e9 / ticks[0], rebuildSeconds * 1e9 / ticks[1],
+           mismatches, ticks[1]);
+}
+
+void BenchReach(int games)
+{
+    BenchReachRules<EasyRules>("easy", games);
+    BenchReachRules<HardRules>("hard", games);
+    BenchReachRules<PortalRules>("portal", games);
+}
+
+// --- Collision Kernels ---
+// Batched head checks for headless evaluation: one pass tests the candidate head of every board
+// in a batch against bounds, wall and body bitsets and the food cell. Boards are stored as
+// structure-of-arrays with 32-bit bitset words, and the kernel is picked once at startup from
+// what the CPU reports (AVX2: 8 lanes with gathers, SSE2: 4 lanes, scalar everywhere else).
+// KernelEnvBatch runs every VecEnv step through it.
+enum CollideFlags { COLLIDE_EDGE = 1, COLLIDE_WALL = 2, COLLIDE_BODY = 4, COLLIDE_FOOD = 8 };
+
+const int collideBatchLanes = 16;
+const int collideMaxSize = 255;   // the SSE2 kernel's 16-bit multiply needs y * size below 65536
+
+struct CollisionBatch {
+    int size = 0;             // board side; every board in a batch has the same one
+    int boards = 0;           // padded up to a multiple of collideBatchLanes
+    int words = 0;            // bitset words per board
+    vector<uint32_t> body;    // boards * words, cells a head would crash into (the body minus its head)
+    vector<uint32_t> walls;
+    vector<int32_t> headX, headY, foodX, foodY;
+
+    // False for boards wider than collideMaxSize, which the kernels cannot index.
+    bool Resize(int boardSize, int count)
+    {
+        if (boardSize > collideMaxSize) return false;
+        size = boardSize;
+        boards = (count + collideBatchLanes - 1) / collideBatchLanes * collideBatchLanes;
+        words = (size * size + 31) / 32;
+        body.assign(boards * words, 0);
+        walls.assign(boards * words, 0);
+        headX.assign(boards, 0);
+        headY.assign(boards, 0);
+        foodX.assign(boards, -1);
+        foodY.assign(boards, -1);
+        return true;
+    }
+
+    void SetBit(vector<uint32_t>& bits, int board, int x, int y)
+    {
+        int bit = y * size + x;
+        bits[board * words + bit / 32] |= 1u << (bit % 32);
+    }
+
+    void ClearBit(vector<uint32_t>& bits, int board, int x, int y)
+    {
+        int bit = y * size + x;
+        bits[board * words + bit / 32] &= ~(1u << (bit % 32));
+    }
+};
+
+// Tests boards [first, last); both are multiples of collideBatchLanes, or last is boards.
+typedef void (*CollideKernel)(const CollisionBatch& batch, int first, int last, uint32_t* flags);
+
+// Same rules as Game: outside the board is an edge hit and nothing else is tested.
+void CollideScalar(const CollisionBatch& batch, int first, int last, uint32_t* flags)
+{
+    for (int board = first; board < last; board++)
+    {
+        int x = batch.headX[board], y = batch.headY[board];
+        if ((unsigned)x >= (unsigned)batch.size || (unsigned)y >= (unsigned)batch.size)
+        {
+            flags[board] = COLLIDE_EDGE;
+            continue;
+        }
+        int bit = y * batch.size + x;
+        int word = board * batch.words + bit / 32;
+        uint32_t result = 0;
+        if ((batch.walls[word] >> (bit % 32)) & 1) result |= COLLIDE_WALL;
+        if ((batch.body[word] >> (bit % 32)) & 1) result |= COLLIDE_BODY;
+        if (x == batch.foodX[board] && y == batch.foodY[board]) result |= COLLIDE_FOOD;
+        flags[board] = result;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COLLIDE_HAVE_X86 1
+
+__attribute__((target("sse2")))
+void CollideSse2(const CollisionBatch& batch, int first, int last, uint32_t* flags)
+{
+    const __m128i size = _mm_set1_epi32(batch.size), minusOne = _mm_set1_epi32(-1), one = _mm_set1_epi32(1);
+    const __m128i low5 = _mm_set1_epi32(31), bias = _mm_set1_epi32(127);
+    const __m128i sizeLow = _mm_set1_epi32(batch.size & 0xFFFF);
+    for (int board = first; board < last; board += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)&batch.headX[board]);
+        __m128i y = _mm_loadu_si128((const __m128i*)&batch.headY[board]);
+        __m128i inside = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(x, minusOne), _mm_cmpgt_epi32(size, x)),
+                                       _mm_and_si128(_mm_cmpgt_epi32(y, minusOne), _mm_cmpgt_epi32(size, y)));
+        // y * size fits in 16 bits (size <= 255), so the 16-bit multiply is exact inside the board.
+        __m128i bit = _mm_and_si128(_mm_add_epi32(_mm_mullo_epi16(y, sizeLow), x), inside);
+
+        // No gathers before AVX2: fetch the four words by hand.
+        alignas(16) int32_t bits[4];
+        _mm_store_si128((__m128i*)bits, bit);
+        const uint32_t* body = &batch.body[board * batch.words];
+        const uint32_t* walls = &batch.walls[board * batch.words];
+        int w = batch.words;
+        __m128i bodyWord = _mm_set_epi32(body[3 * w + bits[3] / 32], body[2 * w + bits[2] / 32], body[w + bits[1] / 32], body[bits[0] / 32]);
+        __m128i wallWord = _mm_set_epi32(walls[3 * w + bits[3] / 32], walls[2 * w + bits[2] / 32], walls[w + bits[1] / 32], walls[bits[0] / 32]);
+
+        // No variable shifts either: 1 << n is built as the float 2^n (n = 31 converts to 0x80000000).
+        __m128i shift = _mm_and_si128(bit, low5);
+        __m128i mask = _mm_cvttps_epi32(_mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(shift, bias), 23)));
+        __m128i zero = _mm_setzero_si128();
+        __m128i wallHit = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(wallWord, mask), zero), _mm_set1_epi32(COLLIDE_WALL));
+        __m128i bodyHit = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(bodyWord, mask), zero), _mm_set1_epi32(COLLIDE_BODY));
+        __m128i foodHit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi32(x, _mm_loadu_si128((const __m128i*)&batch.foodX[board])),
+                                                      _mm_cmpeq_epi32(y, _mm_loadu_si128((const __m128i*)&batch.foodY[board]))),
+                                        _mm_set1_epi32(COLLIDE_FOOD));
+        __m128i hits = _mm_or_si128(_mm_or_si128(wallHit, bodyHit), foodHit);
+        __m128i result = _mm_or_si128(_mm_and_si128(inside, hits), _mm_andnot_si128(inside, one));
+        _mm_storeu_si128((__m128i*)&flags[board], result);
+    }
+}
+
+__attribute__((target("avx2")))
+void CollideAvx2(const CollisionBatch& batch, int first, int last, uint32_t* flags)
+{
+    const __m256i size = _mm256_set1_epi32(batch.size), minusOne = _mm256_set1_epi32(-1), one = _mm256_set1_epi32(1);
+    const __m256i low5 = _mm256_set1_epi32(31);
+    const __m256i laneWords = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(batch.words));
+    for (int board = first; board < last; board += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)&batch.headX[board]);
+        __m256i y = _mm256_loadu_si256((const __m256i*)&batch.headY[board]);
+        __m256i inside = _mm256_and_si256(_mm256_and_si256(_mm256_cmpgt_epi32(x, minusOne), _mm256_cmpgt_epi32(size, x)),
+                                          _mm256_and_si256(_mm256_cmpgt_epi32(y, minusOne), _mm256_cmpgt_epi32(size, y)));
+        __m256i bit = _mm256_and_si256(_mm256_add_epi32(_mm256_mullo_epi32(y, size), x), inside);
+        __m256i word = _mm256_add_epi32(laneWords, _mm256_srli_epi32(bit, 5));
+        __m256i shift = _mm256_and_si256(bit, low5);
+        const int* body = (const int*)&batch.body[board * batch.words];
+        const int* walls = (const int*)&batch.walls[board * batch.words];
+        __m256i bodyBit = _mm256_and_si256(_mm256_srlv_epi32(_mm256_i32gather_epi32(body, word, 4), shift), one);
+        __m256i wallBit = _mm256_and_si256(_mm256_srlv_epi32(_mm256_i32gather_epi32(walls, word, 4), shift), one);
+        __m256i food = _mm256_and_si256(_mm256_cmpeq_epi32(x, _mm256_loadu_si256((const __m256i*)&batch.foodX[board])),
+                                        _mm256_cmpeq_epi32(y, _mm256_loadu_si256((const __m256i*)&batch.foodY[board])));
+        __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(wallBit, 1), _mm256_slli_epi32(bodyBit, 2)),
+                                       _mm256_and_si256(food, _mm256_set1_epi32(COLLIDE_FOOD)));
+        __m256i result = _mm256_blendv_epi8(one, hits, inside);
+        _mm256_storeu_si256((__m256i*)&flags[board], result);
+    }
+}
+#endif
+
+const char* collideKernelName = "scalar";
+
+CollideKernel SelectCollideKernel()
+{
+#ifdef COLLIDE_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) { collideKernelName = "avx2"; return CollideAvx2; }
+    if (__builtin_cpu_supports("sse2")) { collideKernelName = "sse2"; return CollideSse2; }
+#endif
+    collideKernelName = "scalar";
+    return CollideScalar;
+}
+
+CollideKernel CollideBatch = SelectCollideKernel();
+
+// Differential check and throughput: random boards (easy, hard and procedural walls, random-walk
+// bodies) with heads next to or outside the board, run through every kernel this CPU has and
+// compared bit for bit with the game's own rules (ElementInDeque, MapBase::CheckCollisionWithRect,
+// the edge test from CheckCollisionWithEdges and Vector2Equals for food).
+void BenchCollide(int boardCount)
+{
+    CollisionBatch batch;
+    if (!batch.Resize(cellCount, boardCount))
+    {
+        printf("Error: boards wider than %d cells do not fit the collision kernels\n", collideMaxSize);
+        return;
+    }
+    vector<uint32_t> expected(batch.boards);
+    Rng rng(7);
+    HardModeMap hardMap(cellSize);
+    vector<unique_ptr<ProceduralMap>> procedural;
+    for (int style = MAP_STYLE_MAZE; style <= MAP_STYLE_ROOMS; style++) procedural.emplace_back(new ProceduralMap(cellCount, (MapStyle)style, style, cellSize));
+
+    for (int board = 0; board < batch.boards; board++)
+    {
+        int kind = board % 5;
+        const MapBase* map = kind == 0 ? nullptr : kind == 1 ? (const MapBase*)&hardMap : procedural[kind - 2].get();
+        SnakeBody body;
+        Vector2 at = {(float)rng.Range(0, cellCount - 1), (float)rng.Range(0, cellCount - 1)};
+        int length = rng.Range(3, 200);
+        for (int i = 0; i < length; i++)
+        {
+            body.push_back(at);
+            int dir = rng.Range(0, 3);
+            Vector2 next = {at.x + kernelDx[dir], at.y + kernelDy[dir]};
+            if (next.x >= 0 && next.y >= 0 && next.x < cellCount && next.y < cellCount) at = next;
+        }
+        int dir = rng.Range(0, 3);
+        Vector2 head = rng.Range(0, 9) == 0 ? Vector2{(float)rng.Range(-3, cellCount + 2), (float)rng.Range(-3, cellCount + 2)}
+                                            : Vector2{body[0].x + kernelDx[dir], body[0].y + kernelDy[dir]};
+        Vector2 food = rng.Range(0, 3) == 0 ? head : Vector2{(float)rng.Range(0, cellCount - 1), (float)rng.Range(0, cellCount - 1)};
+
+        for (const Vector2& segment : body) batch.SetBit(batch.body, board, (int)segment.x, (int)segment.y);
+        for (int cell = 0; cell < cellCount * cellCount && map; cell++)
+        {
+            Rectangle rect = {(float)(offset + cell % cellCount * cellSize), (float)(offset + cell / cellCount * cellSize), (float)cellSize, (float)cellSize};
+            if (map->CheckCollisionWithRect(rect)) batch.SetBit(batch.walls, board, cell % cellCount, cell / cellCount);
+        }
+        batch.headX[board] = (int)head.x;
+        batch.headY[board] = (int)head.y;
+        batch.foodX[board] = (int)food.x;
+        batch.foodY[board] = (int)food.y;
+
+        uint32_t rule = 0;
+        if (head.x >= cellCount || head.x < 0 || head.y >= cellCount || head.y < 0)
+        {
+            rule = COLLIDE_EDGE;
+        }
+        else
+        {
+            Rectangle rect = {offset + head.x * cellSize, offset + head.y * cellSize, (float)cellSize, (float)cellSize};
+            if (map && map->CheckCollisionWithRect(rect)) rule |= COLLIDE_WALL;
+            if (ElementInDeque(head, body)) rule |= COLLIDE_BODY;
+            if (Vector2Equals(head, food)) rule |= COLLIDE_FOOD;
+        }
+        expected[board] = rule;
+    }
+
+    struct { const char* name; CollideKernel kernel; bool available; } kernels[] = {
+        {"scalar", CollideScalar, true},
+#ifdef COLLIDE_HAVE_X86
+        {"sse2", CollideSse2, (bool)__builtin_cpu_supports("sse2")},
+        {"avx2", CollideAvx2, (bool)__builtin_cpu_supports("avx2")},
+#endif
+    };
+    vector<uint32_t> flags(batch.boards);
+    printf("%d boards, dispatch picks %s\n", batch.boards, collideKernelName);
+    for (auto& entry : kernels)
+    {
+        if (!entry.available)
+        {
+            printf("%-6s not supported by this CPU\n", entry.name);
+            continue;
+        }
+        entry.kernel(batch, 0, batch.boards, flags.data());
+        int mismatches = 0;
+        for (int board = 0; board < batch.boards; board++) mismatches += flags[board] != expected[board];
+
+        int rounds = max(1, 20000000 / batch.boards);
+        auto start = chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++) entry.kernel(batch, 0, batch.boards, flags.data());
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        printf("%-6s %d mismatches, %.1f M heads/s\n", entry.name, mismatches, (double)rounds * batch.boards / seconds / 1e6);
+    }
+}
+
+// --- Particle System ---
+// Bursts when food is eaten, a bigger one for explosive food, sparks on a wall hit, debris when a
+// snake dies and an optional trail behind the head (--trail). The game only pushes EffectEvents;
+// the frame thread drains them, so effects look the same whether ticks run on SimThread or in the
+// net loop. Particles live in a fixed structure-of-arrays pool: the update is one pass over flat
+// float arrays (SSE2 four at a time where the CPU has it), dead ones are swap-removed, and the pool
+// goes to rlgl as one run of quads. A full pool drops new particles instead of growing.
+const int maxParticles = 32768;
+
+struct ParticlePool {
+    int count = 0;
+    alignas(16) float x[maxParticles];
+    alignas(16) float y[maxParticles];
+    alignas(16) float vx[maxParticles];
+    alignas(16) float vy[maxParticles];
+    alignas(16) float gravity[maxParticles];
+    alignas(16) float life[maxParticles];     // seconds left
+    alignas(16) float fade[maxParticles];     // 1 / lifetime
+    alignas(16) float size[maxParticles];
+    uint32_t color[maxParticles];              // RGBA, red in the low byte
+
+    void Remove(int i)
+    {
+        int last = --count;
+        x[i] = x[last];
+        y[i] = y[last];
+        vx[i] = vx[last];
+        vy[i] = vy[last];
+        gravity[i] = gravity[last];
+        life[i] = life[last];
+        fade[i] = fade[last];
+        size[i] = size[last];
+        color[i] = color[last];
+    }
+};
+
+typedef void (*ParticleKernel)(ParticlePool& pool, int begin, float dt, float drag);
+
+void UpdateParticlesScalar(ParticlePool& pool, int begin, float dt, float drag)
+{
+    for (int i = begin; i < pool.count; i++)
+    {
+        float vx = pool.vx[i] * drag;
+        float vy = (pool.vy[i] + pool.gravity[i] * dt) * drag;
+        pool.vx[i] = vx;
+        pool.vy[i] = vy;
+        pool.x[i] += vx * dt;
+        pool.y[i] += vy * dt;
+        pool.life[i] -= dt;
+    }
+}
+
+#ifdef COLLIDE_HAVE_X86
+// Same arithmetic as the scalar loop in the same order, so both give identical pools.
+__attribute__((target("sse2")))
+void UpdateParticlesSse2(ParticlePool& pool, int begin, float dt, float drag)
+{
+    const __m128 step = _mm_set1_ps(dt), damp = _mm_set1_ps(drag);
+    int end = begin + (pool.count - begin) / 4 * 4;
+    for (int i = begin; i < end; i += 4)
+    {
+        __m128 vx = _mm_mul_ps(_mm_load_ps(&pool.vx[i]), damp);
+        __m128 vy = _mm_mul_ps(_mm_add_ps(_mm_load_ps(&pool.vy[i]), _mm_mul_ps(_mm_load_ps(&pool.gravity[i]), step)), damp);
+        _mm_store_ps(&pool.vx[i], vx);
+        _mm_store_ps(&pool.vy[i], vy);
+        _mm_store_ps(&pool.x[i], _mm_add_ps(_mm_load_ps(&pool.x[i]), _mm_mul_ps(vx, step)));
+        _mm_store_ps(&pool.y[i], _mm_add_ps(_mm_load_ps(&pool.y[i]), _mm_mul_ps(vy, step)));
+        _mm_store_ps(&pool.life[i], _mm_sub_ps(_mm_load_ps(&pool.life[i]), step));
+    }
+    UpdateParticlesScalar(pool, end, dt, drag);
+}
+#endif
+
+const char* particleKernelName = "scalar";
+
+ParticleKernel SelectParticleKernel()
+{
+#ifdef COLLIDE_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) { particleKernelName = "sse2"; return UpdateParticlesSse2; }
+#endif
+    particleKernelName = "scalar";
+    return UpdateParticlesScalar;
+}
+
+ParticleKernel UpdateParticles = SelectParticleKernel();
+
+const Color eatColors[] = {{255, 203, 0, 255}, {255, 128, 0, 255}, {255, 255, 255, 255}};
+const Color sparkColors[] = {{255, 255, 255, 255}, {255, 230, 150, 255}, {200, 200, 200, 255}};
+
+class ParticleSystem {
+public:
+    ParticlePool pool;
+    EffectRing events;
+    bool trail = false;
+
+private:
+    Rng rng;
+    unsigned int trailTick = 0;
+
+public:
+    ParticleSystem(uint64_t seed = 0x5EED) : rng(seed) {}
+
+    float Uniform(float low, float high)
+    {
+        return low + (high - low) * (float)(rng.Next() >> 40) * (1.0f / 16777216.0f);
+    }
+
+    // Spawns up to count particles from one point in random directions; fewer at lower render quality.
+    void Emit(float px, float py, int count, float speed, float lifetime, float size, float gravity, const Color* palette, int colors)
+    {
+        int shift = renderQuality >= QUALITY_LOWEST ? 2 : (renderQuality >= QUALITY_SCALED ? 1 : 0);
+        count = min(count >> shift, maxParticles - pool.count);
+        for (int k = 0; k < count; k++)
+        {
+            int i = pool.count++;
+            float angle = Uniform(0, 2 * PI), velocity = speed * Uniform(0.2f, 1);
+            float span = lifetime * Uniform(0.6f, 1);
+            Color c = palette[rng.Next() % colors];
+            pool.x[i] = px;
+            pool.y[i] = py;
+            pool.vx[i] = cosf(angle) * velocity;
+            pool.vy[i] = sinf(angle) * velocity;
+            pool.gravity[i] = gravity;
+            pool.life[i] = span;
+            pool.fade[i] = 1 / span;
+            pool.size[i] = size * Uniform(0.6f, 1.2f);
+            pool.color[i] = (uint32_t)c.r | (uint32_t)c.g << 8 | (uint32_t)c.b << 16 | (uint32_t)c.a << 24;
+        }
+    }
+
+    void Spawn(const EffectEvent& event)
+    {
+        // Wall hits and deaths can be reported for a head that already left the board.
+        float cellX = Clamp(event.x, -0.5f, cellCount - 0.5f), cellY = Clamp(event.y, -0.5f, cellCount - 0.5f);
+        float px = offset + (cellX + 0.5f) * cellSize, py = offset + (cellY + 0.5f) * cellSize;
+        Color light = {(unsigned char)(event.color.r + (255 - event.color.r) / 2), (unsigned char)(event.color.g + (255 - event.color.g) / 2),
+                       (unsigned char)(event.color.b + (255 - event.color.b) / 2), 255};
+        Color debris[3] = {event.color, light, darkGreen};
+        switch (event.type)
+        {
+            case EFFECT_EAT: Emit(px, py, 48, 260, 0.6f, 5, 500, eatColors, 3); break;
+            case EFFECT_EXPLOSION: Emit(px, py, 600, 520, 1.4f, 6, 350, titleColors, numTitleColors); break;
+            case EFFECT_WALL: Emit(px, py, 80, 380, 0.45f, 3, 900, sparkColors, 3); break;
+            case EFFECT_DEBRIS: Emit(px, py, 14, 200, 1.6f, 7, 900, debris, 3); break;
+        }
+    }
+
+    // A few slow puffs from the cell the head just left, once per tick.
+    void Trail(const Snake& snake, unsigned int tick)
+    {
+        if (!trail || tick == trailTick || snake.body.size() < 2) return;
+        trailTick = tick;
+        Color colors[2] = {snake.color, green};
+        Emit(offset + (snake.body[1].x + 0.5f) * cellSize, offset + (snake.body[1].y + 0.5f) * cellSize, 10, 40, 0.7f, 5, -30, colors, 2);
+    }
+
+    void Update(float dt)
+    {
+        EffectEvent arrived[64];
+        size_t count;
+        while ((count = events.Pop(arrived, 64)) > 0)
+        {
+            for (size_t i = 0; i < count; i++) Spawn(arrived[i]);
+        }
+        UpdateParticles(pool, 0, dt, max(0.0f, 1 - 1.5f * dt));
+        for (int i = 0; i < pool.count;)
+        {
+            if (pool.life[i] > 0) i++;
+            else pool.Remove(i);
+        }
+    }
+
+    // Colour holds for the first half of a particle's life, then fades out. Quads go out in chunks
+    // that fit rlgl's batch buffer, so a full pool costs a few flushes rather than one per particle.
+    // The white default texture is bound explicitly; otherwise the quads would sample whatever the
+    // last draw left bound, usually the font atlas.
+    void Draw() const
+    {
+        const int chunk = 1024;
+        rlSetTexture(rlGetTextureIdDefault());
+        for (int begin = 0; begin < pool.count; begin += chunk)
+        {
+            int end = min(pool.count, begin + chunk);
+            rlCheckRenderBatchLimit(4 * (end - begin));
+            rlBegin(RL_QUADS);
+            for (int i = begin; i < end; i++)
+            {
+                uint32_t c = pool.color[i];
+                float alpha = min(1.0f, 2 * pool.life[i] * pool.fade[i]);
+                rlColor4ub(c & 0xFF, (c >> 8) & 0xFF, (c >> 16) & 0xFF, (unsigned char)(alpha * (c >> 24)));
+                float half = pool.size[i] * 0.5f;
+                rlVertex2f(pool.x[i] - half, pool.y[i] - half);
+                rlVertex2f(pool.x[i] - half, pool.y[i] + half);
+                rlVertex2f(pool.x[i] + half, pool.y[i] + half);
+                rlVertex2f(pool.x[i] + half, pool.y[i] - half);
+            }
+            rlEnd();
+        }
+        rlSetTexture(0);
+    }
+};
+
+// Update cost at a steady population: explosions keep the pool near target while every kernel this
+// CPU has steps the same simulated seconds from the same seed; the pools must come out identical.
+// The first two seconds fill the pool from empty and are not counted. Drawing needs a window and
+// is not timed here.
+void BenchParticles(int target)
+{
+    target = max(1, min(target, maxParticles));
+    ParticleKernel picked = UpdateParticles;
+    struct { const char* name; ParticleKernel kernel; bool available; } kernels[] = {
+        {"scalar", UpdateParticlesScalar, true},
+#ifdef COLLIDE_HAVE_X86
+        {"sse2", UpdateParticlesSse2, (bool)__builtin_cpu_supports("sse2")},
+#endif
+    };
+    const int warmup = 120, frames = 1200;
+    printf("%d particles target, %d frames, dispatch picks %s\n", target, frames, particleKernelName);
+    double reference = 0;
+    for (auto& entry : kernels)
+    {
+        if (!entry.available)
+        {
+            printf("%-6s not supported by this CPU\n", entry.name);
+            continue;
+        }
+        UpdateParticles = entry.kernel;
+        unique_ptr<ParticleSystem> particles(new ParticleSystem(7));
+        Rng cells(11);
+        double total = 0, worst = 0;
+        long live = 0;
+        uint64_t allocations = heapAllocations;
+        for (int frame = -warmup; frame < frames; frame++)
+        {
+            if (frame == 0) allocations = heapAllocations;
+            auto start = chrono::steady_clock::now();
+            while (particles->pool.count < target && particles->pool.count < maxParticles - 600)
+            {
+                EffectEvent event = {EFFECT_EXPLOSION, (float)cells.Range(0, cellCount - 1), (float)cells.Range(0, cellCount - 1), explosiveFoodColor};
+                particles->Spawn(event);
+            }
+            particles->Update(1 / 60.0f);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (frame < 0) continue;
+            total += seconds;
+            worst = max(worst, seconds);
+            live += particles->pool.count;
+        }
+        allocations = heapAllocations - allocations;
+        double checksum = 0;
+        for (int i = 0; i < particles->pool.count; i++) checksum += particles->pool.x[i] + particles->pool.y[i] + particles->pool.life[i];
+        if (entry.kernel == UpdateParticlesScalar) reference = checksum;
+        printf("%-6s %ld live on average, %.3f ms/frame (worst %.3f), %llu allocations, %s\n", entry.name, live / frames, total / frames * 1000,
+               worst * 1000, (unsigned long long)allocations, checksum == reference ? "matches scalar" : "MISMATCH");
+    }
+    UpdateParticles = picked;
+}
+
+// --- HamiltonianCycle Class ---
+// Cycle over the free cells of a board, for the attract-mode solver. A spanning tree over fully
+// free 2x2 blocks is turned into a cycle (each block is a small loop, tree edges merge loops),
+// then leftover cells next to the cycle are spliced in two at a time (a->b becomes a->c->d->b).
+// Cells that stay outside (odd boards cannot be covered completely) are treated as blocked.
+const uint32_t cycleCacheMagic = 0x4C435948; // "HYCL"
+
+class HamiltonianCycle {
+public:
+    int size = 0;
+    vector<int32_t> next;      // next cell along the cycle, -1 for cells outside it
+    vector<int32_t> order;     // position along the cycle, -1 for cells outside it
+    vector<int32_t> cells;     // cycle cells in order
+
+    int Length() const { return (int)cells.size(); }
+    bool Contains(int cell) const { return cell >= 0 && order[cell] >= 0; }
+    int Distance(int from, int to) const { return (order[to] - order[from] + Length()) % Length(); }
+
+    // blocked: size * size, nonzero for walls. Returns false if no 2x2 block is free.
+    bool Build(int boardSize, const vector<uint8_t>& blocked)
+    {
+        size = boardSize;
+        int blocks = size / 2;
+        next.assign(size * size, -1);
+        vector<int32_t> prev(size * size, -1);
+
+        vector<uint8_t> usable(blocks * blocks, 0);
+        for (int by = 0; by < blocks; by++)
+        {
+            for (int bx = 0; bx < blocks; bx++)
+            {
+                int topLeft = 2 * by * size + 2 * bx;
+                usable[by * blocks + bx] = !blocked[topLeft] && !blocked[topLeft + 1] && !blocked[topLeft + size] && !blocked[topLeft + size + 1];
+            }
+        }
+
+        // Largest connected group of usable blocks, then a BFS spanning tree over it.
+        vector<int32_t> component(blocks * blocks, -1);
+        vector<int32_t> queue;
+        int bestRoot = -1, bestSize = 0;
+        for (int root = 0; root < blocks * blocks; root++)
+        {
+            if (!usable[root] || component[root] >= 0) continue;
+            queue.assign(1, root);
+            component[root] = root;
+            for (size_t at = 0; at < queue.size(); at++)
+            {
+                int block = queue[at];
+                for (int dir = 0; dir < 4; dir++)
+                {
+                    int neighbor = BlockNeighbor(block, dir, blocks);
+                    if (neighbor >= 0 && usable[neighbor] && component[neighbor] < 0)
+                    {
+                        component[neighbor] = root;
+                        queue.push_back(neighbor);
+                    }
+                }
+            }
+            if ((int)queue.size() > bestSize)
+            {
+                bestSize = (int)queue.size();
+                bestRoot = root;
+            }
+        }
+        if (bestRoot < 0) return false;
+
+        // Tree edges per block: bit dir set when the tree joins the neighbour in that direction.
+        vector<uint8_t> edges(blocks * blocks, 0);
+        vector<uint8_t> inTree(blocks * blocks, 0);
+        queue.assign(1, bestRoot);
+        inTree[bestRoot] = 1;
+        for (size_t at = 0; at < queue.size(); at++)
+        {
+            int block = queue[at];
+            for (int dir = 0; dir < 4; dir++)
+            {
+                int neighbor = BlockNeighbor(block, dir, blocks);
+                if (neighbor < 0 || !usable[neighbor] || inTree[neighbor]) continue;
+                inTree[neighbor] = 1;
+                edges[block] |= 1 << dir;
+                edges[neighbor] |= 1 << (dir ^ 1);
+                queue.push_back(neighbor);
+            }
+        }
+
+        // Each block runs counter-clockwise (TL down, BL right, BR up, TR left); a tree edge
+        // swaps the two facing sides of neighbouring blocks so their loops merge.
+        for (int block : queue)
+        {
+            int topLeft = 2 * (block / blocks) * size + 2 * (block % blocks);
+            int topRight = topLeft + 1, bottomLeft = topLeft + size, bottomRight = bottomLeft + 1;
+            next[topLeft] = (edges[block] & (1 << 2)) ? topLeft - 1 : bottomLeft;
+            next[bottomLeft] = (edges[block] & (1 << 1)) ? bottomLeft + size : bottomRight;
+            next[bottomRight] = (edges[block] & (1 << 3)) ? bottomRight + 1 : topRight;
+            next[topRight] = (edges[block] & (1 << 0)) ? topRight - size : topLeft;
+        }
+        for (int cell = 0; cell < size * size; cell++)
+        {
+            if (next[cell] >= 0) prev[next[cell]] = cell;
+        }
+
+        // Splice leftover free cells in pairs alongside an existing cycle edge.
+        vector<int32_t> pending;
+        for (int cell = 0; cell < size * size; cell++)
+        {
+            if (next[cell] < 0 && !blocked[cell]) pending.push_back(cell);
+        }
+        while (!pending.empty())
+        {
+            int c = pending.back();
+            pending.pop_back();
+            if (next[c] >= 0 || blocked[c]) continue;
+            for (int dir = 0; dir < 4; dir++)
+            {
+                int a = CellNeighbor(c, dir);
+                if (a < 0 || next[a] < 0) continue;
+                int d;
+                if ((d = Parallel(c, a, next[a], blocked)) >= 0)
+                {
+                    int b = next[a];
+                    next[a] = c; next[c] = d; next[d] = b;
+                    prev[c] = a; prev[d] = c; prev[b] = d;
+                }
+                else if ((d = Parallel(c, a, prev[a], blocked)) >= 0)
+                {
+                    int p = prev[a];
+                    next[p] = d; next[d] = c; next[c] = a;
+                    prev[d] = p; prev[c] = d; prev[a] = c;
+                }
+                else
+                {
+                    continue;
+                }
+                for (int around = 0; around < 4; around++)
+                {
+                    int n1 = CellNeighbor(c, around), n2 = CellNeighbor(d, around);
+                    if (n1 >= 0 && next[n1] < 0 && !blocked[n1]) pending.push_back(n1);
+                    if (n2 >= 0 && next[n2] < 0 && !blocked[n2]) pending.push_back(n2);
+                }
+                break;
+            }
+        }
+
+        Index();
+        return true;
+    }
+
+    // Cache keyed by board size and wall mask, so each map builds its cycle once.
+    static string CacheName(int boardSize, const vector<uint8_t>& blocked)
+    {
+        uint32_t hash = (2166136261u ^ (uint32_t)boardSize) * 16777619u;
+        for (uint8_t cell : blocked) hash = (hash ^ (cell != 0)) * 16777619u;
+        char name[32];
+        snprintf(name, sizeof(name), "hamilton-%08x.cycle", hash);
+        return name;
+    }
+
+    // The name is only a 32-bit hash, so a loaded cycle must also be one on this board: every cell
+    // once, each free and next to the one after it.
+    bool Load(const string& path, int boardSize, const vector<uint8_t>& blocked)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == NULL) return false;
+        uint8_t header[12];
+        bool ok = fread(header, 1, 12, file) == 12 && ReadU32(header) == cycleCacheMagic && (int)ReadU32(header + 4) == boardSize;
+        uint32_t count = ok ? ReadU32(header + 8) : 0;
+        ok = ok && count <= (uint32_t)(boardSize * boardSize);
+        if (ok)
+        {
+            cells.resize(count);
+            ok = fread(cells.data(), sizeof(int32_t), count, file) == count;
+        }
+        fclose(file);
+        if (!ok) return false;
+
+        size = boardSize;
+        next.assign(size * size, -1);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            int cell = cells[i], after = cells[(i + 1) % count];
+            if (cell < 0 || cell >= size * size || blocked[cell] || next[cell] >= 0) return false;
+            if (abs(cell % size - after % size) + abs(cell / size - after / size) != 1) return false;
+            next[cell] = after;
+        }
+        Index();
+        return Length() == (int)count;
+    }
+
+    void Save(const string& path) const
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file == NULL) return;
+        uint8_t header[12];
+        WriteU32(header, cycleCacheMagic);
+        WriteU32(header + 4, (uint32_t)size);
+        WriteU32(header + 8, (uint32_t)cells.size());
+        fwrite(header, 1, 12, file);
+        fwrite(cells.data(), sizeof(int32_t), cells.size(), file);
+        fclose(file);
+    }
+
+    bool LoadOrBuild(int boardSize, const vector<uint8_t>& blocked)
+    {
+        string path = CacheName(boardSize, blocked);
+        if (Load(path, boardSize, blocked)) return true;
+        if (!Build(boardSize, blocked)) return false;
+        Save(path);
+        return true;
+    }
+
+private:
+    int CellNeighbor(int cell, int dir) const
+    {
+        int x = cell % size + kernelDx[dir], y = cell / size + kernelDy[dir];
+        return (x < 0 || y < 0 || x >= size || y >= size) ? -1 : y * size + x;
+    }
+
+    static int BlockNeighbor(int block, int dir, int blocks)
+    {
+        int x = block % blocks + kernelDx[dir], y = block / blocks + kernelDy[dir];
+        return (x < 0 || y < 0 || x >= blocks || y >= blocks) ? -1 : y * blocks + x;
+    }
+
+    // The free, uncovered cell d next to c such that c-d runs parallel to the cycle edge a-b.
+    int Parallel(int c, int a, int b, const vector<uint8_t>& blocked) const
+    {
+        int ex = b % size - a % size, ey = b / size - a / size;
+        int sx = c % size - a % size, sy = c / size - a / size;
+        if (ex * sx + ey * sy != 0) return -1;
+        int x = c % size + ex, y = c / size + ey;
+        if (x < 0 || y < 0 || x >= size || y >= size) return -1;
+        int d = y * size + x;
+        return (next[d] < 0 && !blocked[d]) ? d : -1;
+    }
+
+    void Index()
+    {
+        order.assign(size * size, -1);
+        cells.clear();
+        int start = -1;
+        for (int cell = 0; cell < size * size && start < 0; cell++)
+        {
+            if (next[cell] >= 0) start = cell;
+        }
+        for (int cell = start; cell >= 0 && order[cell] < 0; cell = next[cell])
+        {
+            order[cell] = (int32_t)cells.size();
+            cells.push_back(cell);
+        }
+        for (int cell = 0; cell < size * size; cell++)
+        {
+            if (order[cell] < 0) next[cell] = -1;
+        }
+    }
+};
+
+// Follows the cycle, taking shortcuts toward the food while the board is at most half full. A
+// shortcut never jumps past the food or closer than a small margin to the tail, so the body always
+// stays in cycle order between tail and head and the plain cycle remains a safe fallback.
+int SolverMove(const HamiltonianCycle& cycle, int head, int tail, int food, int length, int pendingGrowth, const uint8_t* occupied)
+{
+    int follow = cycle.next[head];
+    if (food < 0 || !cycle.Contains(food) || 2 * (length + pendingGrowth) > cycle.Length()) return follow;
+
+    int toFood = cycle.Distance(head, food);
+    int toTail = cycle.Distance(head, tail);
+    int best = follow, bestJump = 1;
+    for (int dir = 0; dir < 4; dir++)
+    {
+        int x = head % cycle.size + kernelDx[dir], y = head / cycle.size + kernelDy[dir];
+        if (x < 0 || y < 0 || x >= cycle.size || y >= cycle.size) continue;
+        int cell = y * cycle.size + x;
+        if (!cycle.Contains(cell) || occupied[cell]) continue;
+        int jump = cycle.Distance(head, cell);
+        if (jump > bestJump && jump <= toFood && jump + pendingGrowth + 4 < toTail)
+        {
+            best = cell;
+            bestJump = jump;
+        }
+    }
+    return best;
+}
+
+int CellDirection(int from, int to, int boardSize)
+{
+    int dx = to % boardSize - from % boardSize, dy = to / boardSize - from / boardSize;
+    return dy < 0 ? 0 : dy > 0 ? 1 : dx < 0 ? 2 : 3;
+}
+
+// Puts a kernel on its map's cycle: cells the cycle misses become walls, the snake starts on
+// three consecutive cycle cells and food is re-rolled so it lands on the cycle.
+template <class R>
+void PlaceOnCycle(SimKernel<R>& kernel, const HamiltonianCycle& cycle)
+{
+    for (int cell = 0; cell < kernel.size * kernel.size; cell++)
+    {
+        if (!cycle.Contains(cell)) kernel.grid[cell] = CELL_WALL;
+    }
+    int start[3] = {cycle.cells[2], cycle.cells[1], cycle.cells[0]};
+    kernel.SetBody(start, 3);
+}
+
+template <class R>
+bool StartSolver(SimKernel<R>& kernel, HamiltonianCycle& cycle, uint64_t seed, bool useCache)
+{
+    kernel.Reset(seed);
+    vector<uint8_t> blocked(kernel.grid.size());
+    for (size_t cell = 0; cell < blocked.size(); cell++) blocked[cell] = kernel.grid[cell] == CELL_WALL;
+    if (!(useCache ? cycle.LoadOrBuild(kernel.size, blocked) : cycle.Build(kernel.size, blocked))) return false;
+    PlaceOnCycle(kernel, cycle);
+    return true;
+}
+
+template <class R>
+StepResult SolverStep(SimKernel<R>& kernel, const HamiltonianCycle& cycle)
+{
+    int target = SolverMove(cycle, kernel.Head(), kernel.Tail(), kernel.food, kernel.length, kernel.pendingGrowth, kernel.grid.data());
+    return kernel.Step(CellDirection(kernel.Head(), target, kernel.size));
+}
+
+// Checks the solver fills the 25x25 maps.
+template <class R>
+void BenchSolverFill(const char* name)
+{
+    SimKernel<R> kernel;
+    HamiltonianCycle cycle;
+    StartSolver(kernel, cycle, 1, false);
+    while (kernel.alive && !kernel.Filled()) SolverStep(kernel, cycle);
+    printf("%-6s cycle %d cells, %s after %u ticks, length %d\n", name, cycle.Length(),
+           kernel.Filled() ? "filled" : "died", kernel.tick, kernel.length);
+}
+
+// Times cycle construction on a large board, then runs the fill checks.
+void BenchSolver(int boardSize)
+{
+    vector<uint8_t> blocked(boardSize * boardSize, 0);
+    HardModeWalls::Build(blocked.data(), boardSize);
+    HamiltonianCycle cycle;
+    auto start = chrono::steady_clock::now();
+    cycle.Build(boardSize, blocked);
+    double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    string path = HamiltonianCycle::CacheName(boardSize, blocked);
+    cycle.Save(path);
+    HamiltonianCycle cached;
+    bool loaded = cached.Load(path, boardSize, blocked);
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    // A cache file whose cells are not a cycle on this board has to be turned down.
+    HamiltonianCycle tampered = cycle;
+    swap(tampered.cells[0], tampered.cells[2]);
+    tampered.Save(path);
+    bool rejected = !HamiltonianCycle().Load(path, boardSize, blocked);
+    cycle.Save(path);
+    printf("%dx%d: cycle of %d cells built in %.2f ms, cache round trip %.2f ms (%s), bad cache %s\n", boardSize, boardSize,
+           cycle.Length(), buildMs, loadMs, loaded && cached.cells == cycle.cells ? "ok" : "MISMATCH", rejected ? "rejected" : "ACCEPTED");
+    BenchSolverFill<EasyRules>("easy");
+    BenchSolverFill<HardRules>("hard");
+}
+
+// --- Tournament Runner ---
+// Headless sweeps over maps, strategies and seeds, sized for millions of games. Every strategy
+// plays each (seed, map) pair on the same food sequence, so strategies can be ranked head to head
+// as well as by score. Games are grouped into chunks of whole seeds. A shard (--shard i/n, one per
+// process) takes every n-th chunk, and its threads pull chunks off a shared counter. Each finished
+// chunk is appended to the shard's result file as one block, so the file is also the checkpoint:
+// a rerun skips the chunks already in it and cuts off a block torn by a kill.
+enum TournamentMap { TMAP_EASY, TMAP_HARD, TMAP_PORTAL, TMAP_MAZE, TMAP_CAVES, TMAP_ROOMS, TMAP_COUNT };
+enum TournamentStrategy { STRATEGY_GREEDY, STRATEGY_SOLVER, STRATEGY_RANDOM, STRATEGY_CAREFUL, STRATEGY_COUNT };
+enum TournamentEnd { END_EDGE, END_WALL, END_TAIL, END_FILLED, END_TIMEOUT, END_NO_CYCLE, END_COUNT };
+
+const char* tournamentMapNames[TMAP_COUNT] = {"easy", "hard", "portal", "maze", "caves", "rooms"};
+const char* strategyNames[STRATEGY_COUNT] = {"greedy", "solver", "random", "careful"};
+const char* endNames[END_COUNT] = {"edge", "wall", "tail", "filled", "timeout", "nocycle"};
+
+// File: a header (magic, version, seed, seed count, tick cap, seeds per chunk, shard, shard count,
+// map and strategy counts, then their ids), then blocks. Block: magic, chunk, game count, a raw
+// and compressed size per column, then the columns. Each column is compressed on its own, so a
+// query that needs only a few columns seeks past the rest.
+const uint32_t tournamentMagic = 0x544E5453;       // "STNT"
+const uint32_t tournamentBlockMagic = 0x4B4C4254;  // "TBLK"
+const uint32_t tournamentVersion = 1;
+const int tournamentHeaderBytes = 44;
+const uint32_t tournamentChunkGames = 1024;
+
+enum TournamentColumn { COLUMN_MAP, COLUMN_STRATEGY, COLUMN_END, COLUMN_SCORE, COLUMN_TICKS, COLUMN_LENGTH, COLUMN_COUNT };
+const int columnBytes[COLUMN_COUNT] = {1, 1, 1, 4, 4, 2};
+const int tournamentBlockHeaderBytes = 12 + 8 * COLUMN_COUNT;
+
+void AppendU32(vector<uint8_t>& out, uint32_t value)
+{
+    uint8_t bytes[4];
+    WriteU32(bytes, value);
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+struct TournamentConfig {
+    uint64_t seed = 1;
+    uint32_t seeds = 10000;
+    uint32_t tickCap = 100000;
+    uint32_t shard = 0, shards = 1;
+    vector<uint8_t> maps = {TMAP_EASY, TMAP_HARD, TMAP_PORTAL};
+    vector<uint8_t> strategies = {STRATEGY_GREEDY, STRATEGY_SOLVER, STRATEGY_RANDOM};
+
+    uint32_t SeedsPerChunk() const { return max(1u, tournamentChunkGames / (uint32_t)(maps.size() * strategies.size())); }
+    uint32_t Chunks() const { return (seeds + SeedsPerChunk() - 1) / SeedsPerChunk(); }
+
+    // Food sequence and procedural map of seed index i; the same for every strategy.
+    uint64_t GameSeed(uint32_t index) const
+    {
+        Rng rng(seed * 0x9E3779B97F4A7C15ull + index + 1);
+        return rng.Next();
+    }
+
+    bool Same(const TournamentConfig& other) const
+    {
+        return seed == other.seed && seeds == other.seeds && tickCap == other.tickCap && shard == other.shard &&
+               shards == other.shards && maps == other.maps && strategies == other.strategies;
+    }
+
+    void Write(vector<uint8_t>& out) const
+    {
+        uint32_t fields[11] = {tournamentMagic, tournamentVersion, (uint32_t)seed, (uint32_t)(seed >> 32), seeds, tickCap,
+                               SeedsPerChunk(), shard, shards, (uint32_t)maps.size(), (uint32_t)strategies.size()};
+        for (uint32_t field : fields) AppendU32(out, field);
+        out.insert(out.end(), maps.begin(), maps.end());
+        out.insert(out.end(), strategies.begin(), strategies.end());
+    }
+
+    bool Read(FILE* file)
+    {
+        uint8_t header[tournamentHeaderBytes];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header)) return false;
+        if (ReadU32(header) != tournamentMagic || ReadU32(header + 4) != tournamentVersion) return false;
+        seed = ReadU32(header + 8) | ((uint64_t)ReadU32(header + 12) << 32);
+        seeds = ReadU32(header + 16);
+        tickCap = ReadU32(header + 20);
+        shard = ReadU32(header + 28);
+        shards = ReadU32(header + 32);
+        uint32_t mapCount = ReadU32(header + 36), strategyCount = ReadU32(header + 40);
+        if (mapCount == 0 || mapCount > TMAP_COUNT || strategyCount == 0 || strategyCount > STRATEGY_COUNT) return false;
+        maps.resize(mapCount);
+        strategies.resize(strategyCount);
+        if (fread(maps.data(), 1, mapCount, file) != mapCount || fread(strategies.data(), 1, strategyCount, file) != strategyCount) return false;
+        for (uint8_t map : maps) if (map >= TMAP_COUNT) return false;
+        for (uint8_t strategy : strategies) if (strategy >= STRATEGY_COUNT) return false;
+        return ReadU32(header + 24) == SeedsPerChunk();
+    }
+};
+
+// One chunk's results, stored column by column in little-endian fixed widths.
+struct TournamentColumns {
+    vector<uint8_t> column[COLUMN_COUNT];
+    uint32_t games = 0;
+
+    void Clear()
+    {
+        for (auto& values : column) values.clear();
+        games = 0;
+    }
+
+    void Add(int map, int strategy, int end, uint32_t score, uint32_t ticks, int length)
+    {
+        uint32_t values[COLUMN_COUNT] = {(uint32_t)map, (uint32_t)strategy, (uint32_t)end, score, ticks, (uint32_t)length};
+        for (int c = 0; c < COLUMN_COUNT; c++)
+        {
+            for (int i = 0; i < columnBytes[c]; i++) column[c].push_back((uint8_t)(values[c] >> (8 * i)));
+        }
+        games++;
+    }
+
+    uint32_t Get(int c, uint32_t game) const
+    {
+        const uint8_t* bytes = &column[c][game * columnBytes[c]];
+        uint32_t value = 0;
+        for (int i = 0; i < columnBytes[c]; i++) value |= (uint32_t)bytes[i] << (8 * i);
+        return value;
+    }
+
+    void Encode(uint32_t chunk, vector<uint8_t>& out) const
+    {
+        vector<uint8_t> packed[COLUMN_COUNT];
+        AppendU32(out, tournamentBlockMagic);
+        AppendU32(out, chunk);
+        AppendU32(out, games);
+        for (int c = 0; c < COLUMN_COUNT; c++)
+        {
+            CompressBlock(column[c], packed[c]);
+            AppendU32(out, (uint32_t)column[c].size());
+            AppendU32(out, (uint32_t)packed[c].size());
+        }
+        for (int c = 0; c < COLUMN_COUNT; c++) out.insert(out.end(), packed[c].begin(), packed[c].end());
+    }
+
+    // Reads the next block, decompressing only the columns in the wanted bit mask. False at the end
+    // of the file or on a torn or corrupt block.
+    bool Read(FILE* file, uint32_t& chunk, uint32_t wanted, vector<uint8_t>& scratch)
+    {
+        uint8_t header[tournamentBlockHeaderBytes];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header) || ReadU32(header) != tournamentBlockMagic) return false;
+        chunk = ReadU32(header + 4);
+        games = ReadU32(header + 8);
+        for (int c = 0; c < COLUMN_COUNT; c++)
+        {
+            uint32_t rawSize = ReadU32(header + 12 + 8 * c), packedSize = ReadU32(header + 16 + 8 * c);
+            if (rawSize != games * columnBytes[c]) return false;
+            if (!(wanted & (1u << c)))
+            {
+                column[c].clear();
+                if (fseek(file, packedSize, SEEK_CUR) != 0) return false;
+                continue;
+            }
+            scratch.resize(packedSize);
+            if (fread(scratch.data(), 1, packedSize, file) != packedSize) return false;
+            if (!DecompressBlock(scratch.data(), packedSize, rawSize, column[c])) return false;
+        }
+        return true;
+    }
+};
+
+// Picks uniformly among the moves that survive this tick; keeps going if none do.
+template <class R>
+int RandomSafeMove(const SimKernel<R>& kernel, Rng& rng)
+{
+    int safe[4], count = 0;
+    for (int dir = 0; dir < 4; dir++)
+    {
+        if ((dir ^ 1) != kernel.direction && kernel.Safe(dir)) safe[count++] = dir;
+    }
+    return count ? safe[rng.Range(0, count - 1)] : kernel.direction;
+}
+
+class TournamentRunner {
+public:
+    TournamentRunner(const TournamentConfig& config, FILE* file) : config(config), file(file) {}
+
+    // Plays the given chunks on threadCount threads, appending each block as soon as it is done.
+    bool Run(const vector<uint32_t>& chunks, int threadCount)
+    {
+        pending = chunks;
+        vector<thread> workers;
+        for (int i = 0; i < threadCount; i++) workers.emplace_back(&TournamentRunner::Work, this);
+        double start = NowSeconds(), lastReport = start;
+        while (finishedWorkers < threadCount)
+        {
+            this_thread::sleep_for(chrono::milliseconds(200));
+            if (NowSeconds() - lastReport < 10.0) continue;
+            lastReport = NowSeconds();
+            double rate = chunksDone / (lastReport - start);
+            printf("Tournament: %u/%zu chunks, %.0f games/s, %.0f ticks/s, about %.0f min left\n", chunksDone.load(), pending.size(),
+                   gamesDone / (lastReport - start), ticksDone / (lastReport - start), rate > 0 ? (pending.size() - chunksDone) / rate / 60 : 0.0);
+            fflush(stdout);
+        }
+        for (auto& worker : workers) worker.join();
+        double seconds = NowSeconds() - start;
+        printf("Tournament: %u chunks, %llu games in %.1f s (%.0f games/s)\n", chunksDone.load(),
+               (unsigned long long)gamesDone.load(), seconds, gamesDone / max(seconds, 1e-9));
+        return !failed;
+    }
+
+private:
+    enum CycleState { CYCLE_UNBUILT, CYCLE_READY, CYCLE_FAILED };
+
+    struct Worker {
+        SimKernel<EasyRules> easy;
+        SimKernel<HardRules> hard;
+        SimKernel<PortalRules> portal;
+        ProceduralMap procedural{cellCount, MAP_STYLE_MAZE, 1, cellSize};
+        HamiltonianCycle cycles[TMAP_COUNT];
+        CycleState cycleState[TMAP_COUNT] = {};
+        vector<uint8_t> blocked;
+        Rng moves;
+        uint64_t ticks = 0;
+        TournamentColumns columns;
+        vector<uint8_t> block;
+    };
+
+    TournamentConfig config;
+    FILE* file;
+    mutex fileMutex;
+    vector<uint32_t> pending;
+    atomic<size_t> next{0};
+    atomic<uint32_t> chunksDone{0};
+    atomic<uint64_t> gamesDone{0}, ticksDone{0};
+    atomic<int> finishedWorkers{0};
+    atomic<bool> failed{false};
+
+    void Work()
+    {
+        Worker worker;
+        size_t index;
+        while (!failed && (index = next++) < pending.size())
+        {
+            uint32_t chunk = pending[index];
+            uint32_t first = chunk * config.SeedsPerChunk(), last = min(config.seeds, first + config.SeedsPerChunk());
+            worker.columns.Clear();
+            worker.ticks = 0;
+            for (uint32_t seedIndex = first; seedIndex < last; seedIndex++)
+            {
+                uint64_t seed = config.GameSeed(seedIndex);
+                for (uint8_t map : config.maps)
+                {
+                    if (map >= TMAP_MAZE)
+                    {
+                        worker.procedural.Generate((MapStyle)(MAP_STYLE_MAZE + map - TMAP_MAZE), seed);
+                        worker.cycleState[map] = CYCLE_UNBUILT;
+                    }
+                    for (uint8_t strategy : config.strategies) Play(worker, map, strategy, seed);
+                }
+            }
+            worker.block.clear();
+            worker.columns.Encode(chunk, worker.block);
+            {
+                lock_guard<mutex> lock(fileMutex);
+                if (fwrite(worker.block.data(), 1, worker.block.size(), file) != worker.block.size() || fflush(file) != 0)
+                {
+                    printf("Error: could not append chunk %u to the tournament file\n", chunk);
+                    failed = true;
+                }
+            }
+            chunksDone++;
+            gamesDone += worker.columns.games;
+            ticksDone += worker.ticks;
+        }
+        finishedWorkers++;
+    }
+
+    void Play(Worker& worker, int map, int strategy, uint64_t seed)
+    {
+        if (map == TMAP_HARD) PlayOn(worker.hard, worker, map, strategy, seed);
+        else if (map == TMAP_PORTAL) PlayOn(worker.portal, worker, map, strategy, seed);
+        else PlayOn(worker.easy, worker, map, strategy, seed);   // the procedural maps add their walls on top
+    }
+
+    template <class R>
+    void PlayOn(SimKernel<R>& kernel, Worker& worker, int map, int strategy, uint64_t seed)
+    {
+        kernel.trackReach = strategy == STRATEGY_CAREFUL;
+        kernel.Reset(seed);
+        if (map >= TMAP_MAZE) kernel.AddWalls(worker.procedural.mask.data());
+        HamiltonianCycle& cycle = worker.cycles[map];
+        if (strategy == STRATEGY_SOLVER)
+        {
+            // Fixed maps keep their cycle for the whole run, procedural ones rebuild it per map.
+            if (worker.cycleState[map] == CYCLE_UNBUILT)
+            {
+                worker.blocked.resize(kernel.grid.size());
+                for (size_t cell = 0; cell < kernel.grid.size(); cell++) worker.blocked[cell] = kernel.grid[cell] == CELL_WALL;
+                worker.cycleState[map] = cycle.Build(kernel.size, worker.blocked) ? CYCLE_READY : CYCLE_FAILED;
+            }
+            if (worker.cycleState[map] == CYCLE_FAILED)
+            {
+                worker.columns.Add(map, strategy, END_NO_CYCLE, 0, 0, kernel.length);
+                return;
+            }
+            PlaceOnCycle(kernel, cycle);
+        }
+        worker.moves.Seed(seed ^ 0xA5A5A5A5A5A5A5A5ull);
+        StepResult result = STEP_MOVED;
+        while (kernel.alive && !kernel.Filled() && kernel.tick < config.tickCap)
+        {
+            if (strategy == STRATEGY_SOLVER) result = SolverStep(kernel, cycle);
+            else if (strategy == STRATEGY_GREEDY) result = kernel.Step(GreedyMove(kernel));
+            else if (strategy == STRATEGY_CAREFUL) result = kernel.Step(CarefulMove(kernel));
+            else result = kernel.Step(RandomSafeMove(kernel, worker.moves));
+        }
+        int end = !kernel.alive ? END_EDGE + (result - STEP_DIED_EDGE) : kernel.Filled() ? END_FILLED : END_TIMEOUT;
+        worker.columns.Add(map, strategy, end, kernel.score, kernel.tick, kernel.length);
+        worker.ticks += kernel.tick;
+    }
+};
+
+// Keeps the first size bytes of a file (drops a block torn by a kill) by rewriting it.
+bool TruncateFile(const char* path, long size)
+{
+    string tempName = string(path) + ".tmp";
+    FILE* in = fopen(path, "rb");
+    FILE* out = fopen(tempName.c_str(), "wb");
+    bool copied = in != NULL && out != NULL;
+    vector<uint8_t> buffer(1 << 20);
+    for (long left = size; copied && left > 0; )
+    {
+        size_t count = (size_t)min<long>(left, (long)buffer.size());
+        copied = fread(buffer.data(), 1, count, in) == count && fwrite(buffer.data(), 1, count, out) == count;
+        left -= (long)count;
+    }
+    if (in) fclose(in);
+    if (out) copied = fclose(out) == 0 && copied;
+    if (!copied)
+    {
+        printf("Error: Could not rewrite %s\n", path);
+        remove(tempName.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    remove(path);
+#endif
+    return rename(tempName.c_str(), path) == 0;
+}
+
+bool ParseNameList(const string& list, const char* const* names, int count, vector<uint8_t>& out)
+{
+    out.clear();
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == string::npos) end = list.size();
+        string name = list.substr(start, end - start);
+        int id = 0;
+        while (id < count && name != names[id]) id++;
+        if (id == count || find(out.begin(), out.end(), id) != out.end()) return false;
+        out.push_back((uint8_t)id);
+        start = end + 1;
+    }
+    return !out.empty();
+}
+
+// game --tournament <file> [options]: creates the result file, or resumes it if it already holds
+// the same tournament.
+int RunTournament(int argc, char** argv)
+{
+    TournamentConfig config;
+    const char* path = argv[0];
+    int threads = max(1, (int)thread::hardware_concurrency());
+    for (int i = 1; i < argc; i += 2)
+    {
+        string option = argv[i];
+        if (i + 1 >= argc)
+        {
+            printf("Error: %s needs a value\n", argv[i]);
+            return 1;
+        }
+        const char* value = argv[i + 1];
+        bool valid = true;
+        if (option == "--maps") valid = ParseNameList(value, tournamentMapNames, TMAP_COUNT, config.maps);
+        else if (option == "--strategies") valid = ParseNameList(value, strategyNames, STRATEGY_COUNT, config.strategies);
+        else if (option == "--seeds") valid = (config.seeds = strtoul(value, nullptr, 10)) > 0;
+        else if (option == "--seed") config.seed = strtoull(value, nullptr, 10);
+        else if (option == "--ticks") valid = (config.tickCap = strtoul(value, nullptr, 10)) > 0;
+        else if (option == "--threads") valid = (threads = atoi(value)) > 0;
+        else if (option == "--shard") valid = sscanf(value, "%u/%u", &config.shard, &config.shards) == 2 && config.shard < config.shards;
+        else valid = false;
+        if (!valid)
+        {
+            printf("Error: bad tournament option %s %s\n", argv[i], value);
+            return 1;
+        }
+    }
+
+    vector<bool> done(config.Chunks(), false);
+    bool resumed = false;
+    FILE* file = fopen(path, "rb");
+    if (file != NULL)
+    {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        TournamentConfig existing;
+        if (size > 0 && !(existing.Read(file) && existing.Same(config)))
+        {
+            printf("Error: %s holds a different tournament; use the same options or another file\n", path);
+            fclose(file);
+            return 1;
+        }
+        long validEnd = size > 0 ? ftell(file) : 0;
+        TournamentColumns columns;
+        vector<uint8_t> scratch;
+        uint32_t chunk;
+        while (size > 0 && columns.Read(file, chunk, ~0u, scratch))
+        {
+            if (chunk < done.size()) done[chunk] = true;
+            validEnd = ftell(file);
+        }
+        fclose(file);
+        if (validEnd < size)
+        {
+            printf("Tournament: dropping %ld bytes of a torn block\n", size - validEnd);
+            if (!TruncateFile(path, validEnd)) return 1;
+        }
+        resumed = validEnd > 0;
+    }
+
+    vector<uint32_t> chunks;
+    for (uint32_t chunk = config.shard; chunk < config.Chunks(); chunk += config.shards)
+    {
+        if (!done[chunk]) chunks.push_back(chunk);
+    }
+    file = fopen(path, "ab");
+    if (file == NULL)
+    {
+        printf("Error: Could not open %s for writing\n", path);
+        return 1;
+    }
+    if (!resumed)
+    {
+        vector<uint8_t> header;
+        config.Write(header);
+        fwrite(header.data(), 1, header.size(), file);
+        fflush(file);
+    }
+    uint32_t shardChunks = (config.Chunks() - config.shard + config.shards - 1) / config.shards;
+    printf("Tournament: shard %u/%u, %zu of %u chunks to play (%u seeds per chunk, %zu maps, %zu strategies), %d threads%s\n",
+           config.shard, config.shards, chunks.size(), shardChunks, config.SeedsPerChunk(), config.maps.size(),
+           config.strategies.size(), threads, resumed ? ", resuming" : "");
+    TournamentRunner runner(config, file);
+    bool ok = runner.Run(chunks, threads);
+    fclose(file);
+    return ok ? 0 : 1;
+}
+
+struct TournamentStats {
+    uint64_t games = 0, scoreSum = 0;
+    uint64_t ends[END_COUNT] = {};
+    vector<uint64_t> histogram;   // games per score
+
+    uint32_t Percentile(double fraction) const
+    {
+        uint64_t target = (uint64_t)ceil(fraction * games), seen = 0;
+        for (size_t score = 0; score < histogram.size(); score++)
+        {
+            seen += histogram[score];
+            if (seen >= max<uint64_t>(target, 1)) return (uint32_t)score;
+        }
+        return 0;
+    }
+};
+
+// game --tournament-report <file>...: merges result files (e.g. every shard of a run) into the score
+// distribution per map and strategy, how games ended, and head-to-head wins on shared seeds. Only
+// the map, strategy, end and score columns are decompressed.
+int TournamentReport(int count, char** paths)
+{
+    static TournamentStats stats[TMAP_COUNT][STRATEGY_COUNT];
+    uint64_t wins[STRATEGY_COUNT][STRATEGY_COUNT] = {}, meetings[STRATEGY_COUNT][STRATEGY_COUNT] = {};
+    uint64_t games = 0, blocks = 0;
+    const uint32_t wanted = (1u << COLUMN_MAP) | (1u << COLUMN_STRATEGY) | (1u << COLUMN_END) | (1u << COLUMN_SCORE);
+    double start = NowSeconds();
+    TournamentColumns columns;
+    vector<uint8_t> scratch;
+    for (int f = 0; f < count; f++)
+    {
+        FILE* file = fopen(paths[f], "rb");
+        TournamentConfig config;
+        if (file == NULL || !config.Read(file))
+        {
+            printf("Error: %s is not a tournament file\n", paths[f]);
+            if (file) fclose(file);
+            return 1;
+        }
+        uint32_t group = (uint32_t)config.strategies.size(), chunk;
+        while (columns.Read(file, chunk, wanted, scratch))
+        {
+            blocks++;
+            games += columns.games;
+            for (uint32_t game = 0; game < columns.games; game++)
+            {
+                uint32_t map = columns.Get(COLUMN_MAP, game), strategy = columns.Get(COLUMN_STRATEGY, game);
+                uint32_t end = columns.Get(COLUMN_END, game), score = columns.Get(COLUMN_SCORE, game);
+                if (map >= TMAP_COUNT || strategy >= STRATEGY_COUNT || end >= END_COUNT) continue;
+                TournamentStats& entry = stats[map][strategy];
+                entry.games++;
+                entry.scoreSum += score;
+                entry.ends[end]++;
+                if (entry.histogram.size() <= score) entry.histogram.resize(score + 1);
+                entry.histogram[score]++;
+            }
+            // A block holds whole groups: every strategy on one (seed, map), in config order.
+            for (uint32_t first = 0; first + group <= columns.games; first += group)
+            {
+                for (uint32_t a = 0; a < group; a++)
+                {
+                    for (uint32_t b = 0; b < group; b++)
+                    {
+                        if (a == b) continue;
+                        uint32_t sa = columns.Get(COLUMN_STRATEGY, first + a), sb = columns.Get(COLUMN_STRATEGY, first + b);
+                        if (sa >= STRATEGY_COUNT || sb >= STRATEGY_COUNT) continue;
+                        meetings[sa][sb]++;
+                        if (columns.Get(COLUMN_SCORE, first + a) > columns.Get(COLUMN_SCORE, first + b)) wins[sa][sb]++;
+                    }
+                }
+            }
+        }
+        fclose(file);
+    }
+    double ms = (NowSeconds() - start) * 1000.0;
+
+    printf("%-7s %-8s %10s %8s %6s %6s %6s %6s", "map", "strategy", "games", "mean", "p10", "p50", "p90", "max");
+    for (int end = 0; end < END_COUNT; end++) printf(" %7s", endNames[end]);
+    printf("\n");
+    for (int map = 0; map < TMAP_COUNT; map++)
+    {
+        for (int strategy = 0; strategy < STRATEGY_COUNT; strategy++)
+        {
+            const TournamentStats& entry = stats[map][strategy];
+            if (entry.games == 0) continue;
+            printf("%-7s %-8s %10llu %8.1f %6u %6u %6u %6zu", tournamentMapNames[map], strategyNames[strategy],
+                   (unsigned long long)entry.games, (double)entry.scoreSum / entry.games, entry.Percentile(0.1),
+                   entry.Percentile(0.5), entry.Percentile(0.9), entry.histogram.size() - 1);
+            for (int end = 0; end < END_COUNT; end++) printf(" %6.1f%%", 100.0 * entry.ends[end] / entry.games);
+            printf("\n");
+        }
+    }
+    for (int a = 0; a < STRATEGY_COUNT; a++)
+    {
+        for (int b = a + 1; b < STRATEGY_COUNT; b++)
+        {
+            if (meetings[a][b] == 0) continue;
+            printf("%s vs %s: %llu games, %.1f%% / %.1f%% wins, %.1f%% ties\n", strategyNames[a], strategyNames[b],
+                   (unsigned long long)meetings[a][b], 100.0 * wins[a][b] / meetings[a][b], 100.0 * wins[b][a] / meetings[a][b],
+                   100.0 * (meetings[a][b] - wins[a][b] - wins[b][a]) / meetings[a][b]);
+        }
+    }
+    printf("%llu games in %llu blocks from %d file(s), aggregated in %.1f ms\n", (unsigned long long)games,
+           (unsigned long long)blocks, count, ms);
+    return 0;
+}
+
+// --- RL Environment ---
+// Vectorised training environment on SimKernel: Reset and Step run a batch of boards and write
+// observations, rewards, done flags and scores straight into buffers the caller owns (or a shared
+// memory segment, see RunEnvServer). Nothing is allocated or copied per step. A step rewrites only
+// the cells that tick touched, and whole planes are written only when an episode starts. Finished
+// episodes restart on the spot, gym vector-env style: the done step already returns the new
+// episode's observation, and its score slot holds the final score. Each step first tests every
+// env's next head in one CollideBatch pass, against body and wall bitsets kept next to the grids.
+enum EnvPlane { PLANE_BODY, PLANE_HEAD, PLANE_FOOD, PLANE_EXPLOSIVE, PLANE_WALL, PLANE_COUNT };
+
+const uint32_t envMaxTicks = 20000;   // episodes this long end with done and no death penalty
+const float envDeathReward = -1.0f;
+
+// Observations are envs * stride bytes. Each env has PLANE_COUNT planes of size * size cells:
+// 0/1, except the explosive plane, which holds the food's current points (capped at 255).
+struct EnvBuffers {
+    uint8_t* observations;
+    size_t stride;
+    const uint8_t* actions;   // one per env, 0 up, 1 down, 2 left, 3 right
+    float* rewards;           // score gained this step, envDeathReward on death
+    uint8_t* dones;
+    int32_t* scores;
+};
+
+size_t EnvStride(int size)
+{
+    return ((size_t)PLANE_COUNT * size * size + 63) / 64 * 64;   // whole cache lines, no sharing between threads
+}
+
+class EnvBatch {
+public:
+    virtual ~EnvBatch() = default;
+    virtual void Reset(int first, int last) = 0;
+    virtual void Step(int first, int last) = 0;
+    // Writes env's full observation to out, for checking the incremental updates.
+    virtual void Render(int env, uint8_t* out) const = 0;
+};
+
+template <class R>
+class KernelEnvBatch : public EnvBatch {
+public:
+    // batchCollisions false steps each kernel on its own grid lookups, for checking the batched path.
+    KernelEnvBatch(int count, uint64_t seed, const EnvBuffers& buffers, bool batchCollisions)
+        : kernels(count), seeds(count), buffers(buffers)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            seeds[i].Seed(seed + (uint64_t)i * 0x9E3779B97F4A7C15ull);
+            kernels[i].Reset(seeds[i].Next());
+        }
+        batched = batchCollisions && collide.Resize(kernels[0].size, count);
+        hits.assign(collide.boards, 0);
+        for (int i = 0; batched && i < count; i++)
+        {
+            for (int cell = 0; cell < kernels[i].size * kernels[i].size; cell++)
+            {
+                if (kernels[i].grid[cell] == CELL_WALL) collide.SetBit(collide.walls, i, cell % collide.size, cell / collide.size);
+            }
+            SyncBody(i);
+        }
+    }
+
+    void Reset(int first, int last) override
+    {
+        for (int i = first; i < last; i++)
+        {
+            Restart(i);
+            buffers.rewards[i] = 0;
+            buffers.dones[i] = 0;
+            buffers.scores[i] = 0;
+        }
+    }
+
+    // first is a multiple of collideBatchLanes (see VecEnv::Bound), so slices never share a run.
+    void Step(int first, int last) override
+    {
+        if (!batched)
+        {
+            for (int i = first; i < last; i++)
+            {
+                SimKernel<R>& kernel = kernels[i];
+                kernel.Turn(buffers.actions[i] & 3);
+                int cell = kernel.NextCell();
+                StepOne(i, cell, cell < 0 || (cell == kernel.Tail() && kernel.pendingGrowth == 0) ? CELL_FREE : kernel.grid[cell]);
+            }
+            return;
+        }
+        for (int i = first; i < last; i++)
+        {
+            SimKernel<R>& kernel = kernels[i];
+            kernel.Turn(buffers.actions[i] & 3);
+            int cell = kernel.NextCell();
+            collide.headX[i] = cell < 0 ? -1 : cell % kernel.size;
+            collide.headY[i] = cell < 0 ? -1 : cell / kernel.size;
+            // The tail moves on whatever happens unless the snake is growing, so its bit goes now.
+            if (kernel.pendingGrowth == 0) collide.ClearBit(collide.body, i, kernel.Tail() % kernel.size, kernel.Tail() / kernel.size);
+        }
+        CollideBatch(collide, first, last == (int)kernels.size() ? collide.boards : last, hits.data());
+        for (int i = first; i < last; i++)
+        {
+            int cell = kernels[i].NextCell();
+            uint32_t hit = hits[i];
+            StepOne(i, cell, hit & COLLIDE_WALL ? CELL_WALL : hit & COLLIDE_BODY ? CELL_SNAKE : CELL_FREE);
+        }
+    }
+
+    void Render(int env, uint8_t* out) const override
+    {
+        const SimKernel<R>& kernel = kernels[env];
+        int cells = kernel.size * kernel.size;
+        memset(out, 0, PLANE_COUNT * cells);
+        for (int cell = 0; cell < cells; cell++)
+        {
+            out[PLANE_BODY * cells + cell] = kernel.grid[cell] == CELL_SNAKE;
+            out[PLANE_WALL * cells + cell] = kernel.grid[cell] == CELL_WALL;
+        }
+        out[PLANE_HEAD * cells + kernel.Head()] = 1;
+        if (kernel.food >= 0) out[PLANE_FOOD * cells + kernel.food] = 1;
+        if (kernel.explosive >= 0) out[PLANE_EXPLOSIVE * cells + kernel.explosive] = (uint8_t)min(255, kernel.explosivePoints);
+    }
+
+private:
+    vector<SimKernel<R>> kernels;
+    vector<Rng> seeds;
+    EnvBuffers buffers;
+    bool batched = false;
+    CollisionBatch collide;   // board i is env i
+    vector<uint32_t> hits;
+
+    void Restart(int i)
+    {
+        kernels[i].Restart(seeds[i].Next());
+        if (batched) SyncBody(i);
+        Render(i, buffers.observations + i * buffers.stride);
+    }
+
+    void SyncBody(int i)
+    {
+        const SimKernel<R>& kernel = kernels[i];
+        fill(collide.body.begin() + i * collide.words, collide.body.begin() + (i + 1) * collide.words, 0u);
+        for (int n = 0; n < kernel.length; n++)
+        {
+            int cell = kernel.body[(kernel.headIndex - n + (int)kernel.body.size()) % (int)kernel.body.size()];
+            collide.SetBit(collide.body, i, cell % kernel.size, cell / kernel.size);
+        }
+    }
+
+    // Moves env i's head into cell (already turned and tested, see SimKernel::Advance).
+    void StepOne(int i, int cell, uint8_t hit)
+    {
+        SimKernel<R>& kernel = kernels[i];
+        uint8_t* obs = buffers.observations + i * buffers.stride;
+        int cells = kernel.size * kernel.size;
+        int oldHead = kernel.Head(), oldTail = kernel.Tail(), oldLength = kernel.length;
+        int oldFood = kernel.food, oldExplosive = kernel.explosive, oldScore = kernel.score;
+        kernel.Advance(cell, hit);
+        buffers.scores[i] = kernel.score;
+        if (!kernel.alive || kernel.Filled() || kernel.tick >= envMaxTicks)
+        {
+            buffers.rewards[i] = kernel.alive ? (float)(kernel.score - oldScore) : envDeathReward;
+            buffers.dones[i] = 1;
+            Restart(i);
+            return;
+        }
+        buffers.rewards[i] = (float)(kernel.score - oldScore);
+        buffers.dones[i] = 0;
+        if (batched) collide.SetBit(collide.body, i, cell % kernel.size, cell / kernel.size);
+        // The tail leaves first (the head may move into its cell), then the new head and the food.
+        if (kernel.length == oldLength) obs[PLANE_BODY * cells + oldTail] = 0;
+        obs[PLANE_HEAD * cells + oldHead] = 0;
+        obs[PLANE_HEAD * cells + kernel.Head()] = 1;
+        obs[PLANE_BODY * cells + kernel.Head()] = 1;
+        if (oldFood != kernel.food)
+        {
+            obs[PLANE_FOOD * cells + oldFood] = 0;
+            obs[PLANE_FOOD * cells + kernel.food] = 1;
+        }
+        if (oldExplosive >= 0) obs[PLANE_EXPLOSIVE * cells + oldExplosive] = 0;
+        if (kernel.explosive >= 0) obs[PLANE_EXPLOSIVE * cells + kernel.explosive] = (uint8_t)min(255, kernel.explosivePoints);
+    }
+};
+
+// Owns the batch and a fixed set of threads; each call splits the envs into one slice per thread,
+// and the calling thread runs the first slice itself.
+class VecEnv {
+public:
+    int count;
+    int size = cellCount;
+
+    VecEnv(const string& rules, int count, int threadCount, uint64_t seed, const EnvBuffers& buffers, bool batchCollisions = true)
+        : count(count)
+    {
+        if (rules == "easy") batch.reset(new KernelEnvBatch<EasyRules>(count, seed, buffers, batchCollisions));
+        else if (rules == "hard") batch.reset(new KernelEnvBatch<HardRules>(count, seed, buffers, batchCollisions));
+        else if (rules == "portal") batch.reset(new KernelEnvBatch<PortalRules>(count, seed, buffers, batchCollisions));
+        slices = max(1, min(threadCount, (count + collideBatchLanes - 1) / collideBatchLanes));
+        for (int slice = 1; batch && slice < slices; slice++) workers.emplace_back(&VecEnv::Work, this, slice);
+    }
+
+    ~VecEnv()
+    {
+        {
+            lock_guard<mutex> lock(workMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    bool Valid() const { return batch != nullptr; }
+    void Reset() { Dispatch(false); }
+    void Step() { Dispatch(true); }
+    const EnvBatch& Batch() const { return *batch; }
+
+private:
+    unique_ptr<EnvBatch> batch;
+    int slices = 1;
+    vector<thread> workers;
+    mutex workMutex;
+    condition_variable wake;
+    uint64_t generation = 0;
+    bool stepping = false;
+    bool stopping = false;
+    atomic<int> busy{0};
+
+    void Dispatch(bool step)
+    {
+        {
+            lock_guard<mutex> lock(workMutex);
+            stepping = step;
+            busy = slices - 1;
+            generation++;
+        }
+        wake.notify_all();
+        RunSlice(0, step);
+        while (busy.load(memory_order_acquire) > 0) this_thread::yield();
+    }
+
+    // Slices start on a multiple of collideBatchLanes, so each thread has its own collision lanes.
+    int Bound(int slice) const
+    {
+        return slice == slices ? count : (int)((int64_t)count * slice / slices) / collideBatchLanes * collideBatchLanes;
+    }
+
+    void RunSlice(int slice, bool step)
+    {
+        int first = Bound(slice), last = Bound(slice + 1);
+        if (step) batch->Step(first, last);
+        else batch->Reset(first, last);
+    }
+
+    void Work(int slice)
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            bool step;
+            {
+                unique_lock<mutex> lock(workMutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                step = stepping;
+            }
+            RunSlice(slice, step);
+            busy.fetch_sub(1, memory_order_release);
+        }
+    }
+};
+
+// Shared-memory protocol for a trainer in another process (numpy can map the segment directly).
+// The segment starts with EnvShared; the arrays follow at the byte offsets it lists. To run a
+// command the trainer writes the actions and command, then increments request. The server
+// answers by writing the outputs and storing response = request; the trainer waits for that.
+enum EnvCommand { ENV_RESET, ENV_STEP, ENV_CLOSE };
+
+const uint32_t envSharedMagic = 0x564E4553;   // "SENV"
+const uint32_t envSharedVersion = 1;
+
+struct EnvShared {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t envs, size, planes;
+    uint32_t stride;
+    uint32_t observations, actions, rewards, dones, scores;
+    uint32_t command;
+    atomic<uint32_t> request;
+    atomic<uint32_t> response;
+};
+
+static_assert(sizeof(atomic<uint32_t>) == 4, "EnvShared needs plain 32-bit atomics");
+
+// Byte offsets of each array in the segment, every one cache-line aligned.
+size_t EnvSharedLayout(EnvShared& layout, int envs, int size)
+{
+    auto align = [](size_t at) { return (at + 63) / 64 * 64; };
+    size_t at = align(sizeof(EnvShared));
+    layout.magic = envSharedMagic;
+    layout.version = envSharedVersion;
+    layout.envs = envs;
+    layout.size = size;
+    layout.planes = PLANE_COUNT;
+    layout.stride = (uint32_t)EnvStride(size);
+    layout.observations = (uint32_t)at;
+    at = align(at + (size_t)envs * layout.stride);
+    layout.actions = (uint32_t)at;
+    at = align(at + envs);
+    layout.rewards = (uint32_t)at;
+    at = align(at + envs * sizeof(float));
+    layout.dones = (uint32_t)at;
+    at = align(at + envs);
+    layout.scores = (uint32_t)at;
+    return align(at + envs * sizeof(int32_t));
+}
+
+EnvBuffers EnvSharedBuffers(uint8_t* base, const EnvShared& layout)
+{
+    return EnvBuffers{base + layout.observations, layout.stride, base + layout.actions, (float*)(base + layout.rewards),
+                      base + layout.dones, (int32_t*)(base + layout.scores)};
+}
+
+// Spins briefly, then yields, then sleeps, so an idle server costs almost nothing.
+bool WaitForValue(const atomic<uint32_t>& value, uint32_t old, double timeoutSeconds)
+{
+    double start = 0;
+    for (int spin = 0; value.load(memory_order_acquire) == old; spin++)
+    {
+        if (spin < 2000) continue;
+        if (spin < 4000) { this_thread::yield(); continue; }
+        if (start == 0) start = NowSeconds();
+        if (timeoutSeconds > 0 && NowSeconds() - start > timeoutSeconds) return false;
+        this_thread::sleep_for(chrono::microseconds(50));
+    }
+    return true;
+}
+
+#ifndef _WIN32
+uint8_t* MapShared(const char* name, size_t bytes, bool create)
+{
+    int fd = shm_open(name, create ? O_CREAT | O_RDWR | O_TRUNC : O_RDWR, 0600);
+    if (fd < 0) return nullptr;
+    if (create && ftruncate(fd, (off_t)bytes) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    void* base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return base == MAP_FAILED ? nullptr : (uint8_t*)base;
+}
+#endif
+
+// game --env-serve <name> <envs> [rules] [threads]: serves a VecEnv from /dev/shm/<name> until a
+// trainer sends ENV_CLOSE.
+int RunEnvServer(const char* name, int envs, const string& rules, int threads)
+{
+#ifdef _WIN32
+    (void)name; (void)envs; (void)rules; (void)threads;
+    printf("Error: --env-serve needs POSIX shared memory\n");
+    return 1;
+#else
+    EnvShared layout;
+    size_t bytes = EnvSharedLayout(layout, envs, cellCount);
+    uint8_t* base = MapShared(name, bytes, true);
+    if (base == nullptr)
+    {
+        printf("Error: could not create shared memory %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    EnvShared* shared = new (base) EnvShared();
+    EnvSharedLayout(*shared, envs, cellCount);
+    shared->magic = 0;   // published last, once the segment is ready
+    VecEnv env(rules, envs, threads, 1, EnvSharedBuffers(base, layout));
+    if (!env.Valid())
+    {
+        printf("Error: unknown rules %s (easy, hard or portal)\n", rules.c_str());
+        munmap(base, bytes);
+        shm_unlink(name);
+        return 1;
+    }
+    env.Reset();
+    atomic_thread_fence(memory_order_release);
+    shared->magic = envSharedMagic;
+    printf("Env: serving %d %s envs from %s (%zu bytes, observations at %u, stride %u), %d threads\n", envs, rules.c_str(),
+           name, bytes, layout.observations, layout.stride, threads);
+    fflush(stdout);
+
+    uint32_t handled = 0;
+    for (;;)
+    {
+        WaitForValue(shared->request, handled, 0);
+        handled = shared->request.load(memory_order_acquire);
+        uint32_t command = shared->command;
+        if (command == ENV_STEP) env.Step();
+        else if (command == ENV_RESET) env.Reset();
+        shared->response.store(handled, memory_order_release);
+        if (command == ENV_CLOSE) break;
+    }
+    munmap(base, bytes);
+    shm_unlink(name);
+    return 0;
+#endif
+}
+
+// game --env-client <name> [seconds]: drives a served env with random actions through the shared
+// segment and reports the round-trip step rate, the way a trainer would see it.
+int RunEnvClient(const char* name, double seconds)
+{
+#ifdef _WIN32
+    (void)name; (void)seconds;
+    printf("Error: --env-client needs POSIX shared memory\n");
+    return 1;
+#else
+    uint8_t* probe = MapShared(name, sizeof(EnvShared), false);
+    if (probe == nullptr || ((EnvShared*)probe)->magic != envSharedMagic || ((EnvShared*)probe)->version != envSharedVersion)
+    {
+        printf("Error: no env server on %s\n", name);
+        return 1;
+    }
+    EnvShared layout;
+    size_t bytes = EnvSharedLayout(layout, ((EnvShared*)probe)->envs, ((EnvShared*)probe)->size);
+    munmap(probe, sizeof(EnvShared));
+    uint8_t* base = MapShared(name, bytes, false);
+    if (base == nullptr) return 1;
+    EnvShared* shared = (EnvShared*)base;
+    EnvBuffers buffers = EnvSharedBuffers(base, layout);
+    uint8_t* actions = base + layout.actions;
+
+    auto send = [&](uint32_t command) {
+        shared->command = command;
+        uint32_t request = shared->request.load() + 1;
+        shared->request.store(request, memory_order_release);
+        return WaitForValue(shared->response, request - 1, 5.0);
+    };
+    Rng rng(7);
+    uint64_t steps = 0, episodes = 0, scoreSum = 0;
+    bool ok = send(ENV_RESET);
+    double start = NowSeconds();
+    while (ok && NowSeconds() - start < seconds)
+    {
+        for (uint32_t i = 0; i < layout.envs; i++) actions[i] = (uint8_t)(rng.Next() & 3);
+        ok = send(ENV_STEP);
+        for (uint32_t i = 0; i < layout.envs; i++)
+        {
+            if (!buffers.dones[i]) continue;
+            episodes++;
+            scoreSum += buffers.scores[i];
+        }
+        steps += layout.envs;
+    }
+    double elapsed = NowSeconds() - start;
+    if (ok) send(ENV_CLOSE);
+    else printf("Error: env server stopped answering\n");
+    printf("Env client: %.0f steps/s over shared memory, %llu episodes, mean score %.2f\n", steps / elapsed,
+           (unsigned long long)episodes, episodes ? (double)scoreSum / episodes : 0.0);
+    munmap(base, bytes);
+    return ok ? 0 : 1;
+#endif
+}
+
+// In-process step rate with random actions, then checks every env's incrementally updated planes
+// against a full render, and the batched collision path against per-kernel grid lookups.
+void BenchEnv(int envs, int threads, const string& rules)
+{
+    size_t stride = EnvStride(cellCount);
+    vector<uint8_t> observations(envs * stride), actions(envs), dones(envs);
+    vector<float> rewards(envs);
+    vector<int32_t> scores(envs);
+    VecEnv env(rules, envs, threads, 1, EnvBuffers{observations.data(), stride, actions.data(), rewards.data(), dones.data(), scores.data()});
+    if (!env.Valid())
+    {
+        printf("Error: unknown rules %s (easy, hard or portal)\n", rules.c_str());
+        return;
+    }
+    env.Reset();
+    Rng rng(7);
+    uint64_t steps = 0, episodes = 0;
+    double start = NowSeconds();
+    while (NowSeconds() - start < 3.0)
+    {
+        for (int batch = 0; batch < 16; batch++)
+        {
+            for (int i = 0; i < envs; i++) actions[i] = (uint8_t)(rng.Next() & 3);
+            env.Step();
+            for (int i = 0; i < envs; i++) episodes += dones[i];
+            steps += envs;
+        }
+    }
+    double seconds = NowSeconds() - start;
+    vector<uint8_t> full(stride);
+    int mismatches = 0;
+    for (int i = 0; i < envs; i++)
+    {
+        env.Batch().Render(i, full.data());
+        mismatches += memcmp(full.data(), &observations[i * stride], PLANE_COUNT * cellCount * cellCount) != 0;
+    }
+
+    vector<uint8_t> scalarObservations(envs * stride), scalarDones(envs);
+    vector<float> scalarRewards(envs);
+    vector<int32_t> scalarScores(envs);
+    VecEnv scalar(rules, envs, threads, 1, EnvBuffers{scalarObservations.data(), stride, actions.data(), scalarRewards.data(),
+                                                      scalarDones.data(), scalarScores.data()}, false);
+    VecEnv batched(rules, envs, threads, 1, EnvBuffers{observations.data(), stride, actions.data(), rewards.data(), dones.data(), scores.data()});
+    scalar.Reset();
+    batched.Reset();
+    int divergedAt = -1;
+    for (int step = 0; step < 2000 && divergedAt < 0; step++)
+    {
+        for (int i = 0; i < envs; i++) actions[i] = (uint8_t)(rng.Next() & 3);
+        scalar.Step();
+        batched.Step();
+        if (observations != scalarObservations || dones != scalarDones || rewards != scalarRewards || scores != scalarScores) divergedAt = step;
+    }
+    printf("%-6s %d envs, %d threads: %.0f steps/s, %llu episodes, planes %s\n", rules.c_str(), envs, threads, steps / seconds,
+           (unsigned long long)episodes, mismatches ? TextFormat("MISMATCH in %d envs", mismatches) : "ok");
+    printf("%-6s %s collisions %s\n", rules.c_str(), collideKernelName, divergedAt >= 0 ? TextFormat("DIVERGE at step %d", divergedAt) : "match grid lookups");
+}
+
+// --- AttractMode Class ---
+// "Perfect game" demo for the menu: the solver plays easy and hard in turn until each board is full.
+const double attractIdleSeconds = 30.0;
+const int attractTicksPerFrame = 4;
+
+class AttractMode {
+public:
+    bool hardMode = false;
+    bool active = false;
+
+    void Start()
+    {
+        seed++;
+        active = hardMode ? StartSolver(hard, hardCycle, seed, true) : StartSolver(easy, easyCycle, seed, true);
+        walls.assign(cellCount * cellCount, 0);
+        if (hardMode) HardModeWalls::Build(walls.data(), cellCount);
+        finishedAt = -1.0;
+    }
+
+    // Runs a few ticks per frame; a finished board stays on screen briefly before the other map starts.
+    void Update()
+    {
+        if (!active) return;
+        if (finishedAt >= 0.0)
+        {
+            if (NowSeconds() - finishedAt < 2.0) return;
+            hardMode = !hardMode;
+            Start();
+            return;
+        }
+        for (int i = 0; i < attractTicksPerFrame && finishedAt < 0.0; i++)
+        {
+            bool done = hardMode ? Advance(hard, hardCycle) : Advance(easy, easyCycle);
+            if (done) finishedAt = NowSeconds();
+        }
+    }
+
+    void Draw(const Texture2D& foodTexture) const
+    {
+        if (!active) return;
+        for (int cell = 0; cell < cellCount * cellCount; cell++)
+        {
+            float x = (float)(offset + cell % cellCount * cellSize), y = (float)(offset + cell / cellCount * cellSize);
+            if (walls[cell]) DrawRectangleRec(Rectangle{x, y, (float)cellSize, (float)cellSize}, SKYBLUE);
+        }
+        int food = hardMode ? hard.food : easy.food;
+        int explosive = hardMode ? hard.explosive : -1;
+        const vector<uint8_t>& grid = hardMode ? hard.grid : easy.grid;
+        if (food >= 0) DrawTexture(foodTexture, offset + food % cellCount * cellSize, offset + food / cellCount * cellSize, WHITE);
+        if (explosive >= 0)
+        {
+            Rectangle rect = {(float)(offset + explosive % cellCount * cellSize), (float)(offset + explosive / cellCount * cellSize), (float)cellSize, (float)cellSize};
+            DrawRounded(rect, 0.5, 6, explosiveFoodColor);
+        }
+        for (int cell = 0; cell < cellCount * cellCount; cell++)
+        {
+            if (grid[cell] != CELL_SNAKE) continue;
+            Rectangle segment = {(float)(offset + cell % cellCount * cellSize), (float)(offset + cell / cellCount * cellSize), (float)cellSize, (float)cellSize};
+            DrawRounded(segment, 0.5, 6, darkGreen);
+        }
+        int length = hardMode ? hard.length : easy.length;
+        const HamiltonianCycle& cycle = hardMode ? hardCycle : easyCycle;
+        DrawText(TextFormat("DEMO %s  %d / %d", hardMode ? "HARD" : "EASY", length, cycle.Length()), offset - 5, offset + cellSize * cellCount + 10, 30, darkGreen);
+    }
+
+private:
+    SimKernel<EasyRules> easy;
+    SimKernel<HardRules> hard;
+    HamiltonianCycle easyCycle, hardCycle;
+    vector<uint8_t> walls;
+    uint64_t seed = (uint64_t)time(nullptr);
+    double finishedAt = -1.0;
+
+    template <class R>
+    static bool Advance(SimKernel<R>& kernel, const HamiltonianCycle& cycle)
+    {
+        if (kernel.alive && !kernel.Filled()) SolverStep(kernel, cycle);
+        return !kernel.alive || kernel.Filled();
+    }
+};
+
+// --- Save State Format ---
+// Little-endian, version 2: magic, version, mode, flags (explosive active, growing, wrap edges),
+// map style, map seed, tick, rng, score, foodEatenCount, food, explosive (x, y, points, spawn tick),
+// snake length, head, direction, then the body as a chain of 2-bit steps from each segment to the
+// next, and an FNV checksum of everything before it. Version 1 files are rejected.
+const uint32_t saveMagic = 0x56535352; // "RSSV"
+const uint16_t saveVersion = 2;
+const int maxSaveBytes = 57 + maxSnakeCells / 4;
+const char* saveFileName = "savestate.bin";
+
+class ByteWriter {
+public:
+    uint8_t* data;
+    int size = 0;
+
+    ByteWriter(uint8_t* data) : data(data) {}
+
+    void U8(uint32_t value) { data[size++] = (uint8_t)value; }
+    void U16(uint32_t value) { U8(value); U8(value >> 8); }
+    void U32(uint32_t value) { U16(value); U16(value >> 16); }
+    void U64(uint64_t value) { U32((uint32_t)value); U32((uint32_t)(value >> 32)); }
+};
+
+class ByteReader {
+public:
+    const uint8_t* data;
+    int size;
+    int at = 0;
+
+    ByteReader(const uint8_t* data, int size) : data(data), size(size) {}
+
+    bool Has(int count) const { return at + count <= size; }
+    uint32_t U8() { return data[at++]; }
+    uint32_t U16() { uint32_t low = U8(); return low | (U8() << 8); }
+    uint32_t U32() { uint32_t low = U16(); return low | (U16() << 16); }
+    uint64_t U64() { uint64_t low = U32(); return low | ((uint64_t)U32() << 32); }
+};
+
+uint32_t SaveChecksum(const uint8_t* data, int size)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < size; i++) hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+int StepCode(int dx, int dy)
+{
+    if (dx == cellCount - 1 || dx == 1 - cellCount) dx = dx > 0 ? -1 : 1;   // wrapped across an edge
+    if (dy == cellCount - 1 || dy == 1 - cellCount) dy = dy > 0 ? -1 : 1;
+    if (dy == -1 && dx == 0) return 0;
+    if (dy == 1 && dx == 0) return 1;
+    if (dx == -1 && dy == 0) return 2;
+    if (dx == 1 && dy == 0) return 3;
+    return -1;
+}
+
+// Encodes the single-player part of a GameState; returns the byte count, 0 if it cannot be encoded.
+int EncodeSave(const GameState& state, bool hardMode, uint8_t* out)
+{
+    const SnakeState& snake = state.snakes[0];
+    int dirCode = StepCode(snake.dirX, snake.dirY);
+    if (snake.length == 0 || dirCode < 0) return 0;
+
+    ByteWriter writer(out);
+    writer.U32(saveMagic);
+    writer.U16(saveVersion);
+    writer.U8(hardMode ? 1 : 0);
+    writer.U8((state.explosiveActive ? 1 : 0) | (snake.addSegment ? 2 : 0) | (state.wrapEdges ? 4 : 0));
+    writer.U8(state.mapStyle);
+    writer.U64(state.mapSeed);
+    writer.U32(state.tick);
+    writer.U64(state.rng);
+    writer.U32((uint32_t)state.scores[0]);
+    writer.U32((uint32_t)state.foodEatenCount);
+    writer.U8(state.food.x);
+    writer.U8(state.food.y);
+    writer.U8(state.explosivePos.x);
+    writer.U8(state.explosivePos.y);
+    writer.U8(state.explosivePoints);
+    writer.U32(state.explosiveSpawnTick);
+    writer.U16(snake.length);
+    writer.U8(snake.body[0].x);
+    writer.U8(snake.body[0].y);
+    writer.U8(dirCode);
+
+    uint8_t packed = 0;
+    for (int i = 1; i < snake.length; i++)
+    {
+        int code = StepCode(snake.body[i].x - snake.body[i - 1].x, snake.body[i].y - snake.body[i - 1].y);
+        if (code < 0) return 0;
+        packed |= code << (2 * ((i - 1) & 3));
+        if (((i - 1) & 3) == 3 || i == snake.length - 1)
+        {
+            writer.U8(packed);
+            packed = 0;
+        }
+    }
+    writer.U32(SaveChecksum(out, writer.size));
+    return writer.size;
+}
+
+// Fills the single-player fields of state; everything else is left as the caller set it.
+bool DecodeSave(const uint8_t* data, int size, GameState& state, bool& hardMode)
+{
+    if (size < 8 || SaveChecksum(data, size - 4) != ByteReader(data + size - 4, 4).U32()) return false;
+    ByteReader reader(data, size - 4);
+    if (!reader.Has(51) || reader.U32() != saveMagic || reader.U16() != saveVersion) return false;
+
+    hardMode = reader.U8() == 1;
+    uint32_t flags = reader.U8();
+    state.mapStyle = reader.U8();
+    state.mapSeed = reader.U64();
+    if (state.mapStyle > MAP_STYLE_ROOMS) return false;
+    state.tick = reader.U32();
+    state.rng = reader.U64();
+    state.scores[0] = (int32_t)reader.U32();
+    state.foodEatenCount = (int32_t)reader.U32();
+    state.food.x = (int8_t)reader.U8();
+    state.food.y = (int8_t)reader.U8();
+    state.explosivePos.x = (int8_t)reader.U8();
+    state.explosivePos.y = (int8_t)reader.U8();
+    state.explosivePoints = reader.U8();
+    state.explosiveSpawnTick = reader.U32();
+    state.explosiveActive = flags & 1;
+    state.wrapEdges = (flags & 4) != 0;
+
+    SnakeState& snake = state.snakes[0];
+    snake.addSegment = (flags & 2) != 0;
+    snake.length = reader.U16();
+    if (snake.length == 0 || snake.length > maxSnakeCells || !reader.Has(3 + (snake.length + 2) / 4)) return false;
+    snake.body[0].x = reader.U8();
+    snake.body[0].y = reader.U8();
+    int dirCode = reader.U8() & 3;
+    snake.dirX = (int8_t)kernelDx[dirCode];
+    snake.dirY = (int8_t)kernelDy[dirCode];
+
+    uint32_t packed = 0;
+    for (int i = 1; i < snake.length; i++)
+    {
+        if (((i - 1) & 3) == 0) packed = reader.U8();
+        int code = (packed >> (2 * ((i - 1) & 3))) & 3;
+        snake.body[i].x = snake.body[i - 1].x + kernelDx[code];
+        snake.body[i].y = snake.body[i - 1].y + kernelDy[code];
+        if (state.wrapEdges)
+        {
+            snake.body[i].x = (snake.body[i].x + cellCount) % cellCount;
+            snake.body[i].y = (snake.body[i].y + cellCount) % cellCount;
+        }
+    }
+    for (int i = 0; i < snake.length; i++)
+    {
+        if (snake.body[i].x < 0 || snake.body[i].y < 0 || snake.body[i].x >= cellCount || snake.body[i].y >= cellCount) return false;
+    }
+    state.running = true;
+    state.gameovermenu = false;
+    return true;
+}
+
+// --- SaveRing Class ---
+// The last few hundred per-tick saves, newest last; popping them is the rewind.
+class SaveRing {
+private:
+    static const int capacity = 600;
+    uint8_t slots[capacity][maxSaveBytes];
+    int sizes[capacity];
+    int newest = -1;
+    int count = 0;
+
+public:
+    void Push(const uint8_t* data, int size)
+    {
+        newest = (newest + 1) % capacity;
+        memcpy(slots[newest], data, size);
+        sizes[newest] = size;
+        count = min(count + 1, capacity);
+    }
+
+    // Drops the newest save and returns the one before it.
+    bool Rewind(const uint8_t*& data, int& size)
+    {
+        if (count < 2) return false;
+        newest = (newest - 1 + capacity) % capacity;
+        count--;
+        data = slots[newest];
+        size = sizes[newest];
+        return true;
+    }
+
+    void Clear() { count = 0; }
+};
+
+const int SaveRing::capacity;   // min() takes it by reference
+
+// --- SaveWriter Class ---
+// Writes the latest requested save on a background thread: temp file, then rename, so a power cut
+// leaves either the old save or the new one.
+class SaveWriter {
+private:
+    mutex lock;
+    condition_variable wake;
+    uint8_t pending[maxSaveBytes];
+    int pendingSize = 0;
+    bool hasPending = false;
+    bool clearPending = false;
+    bool stopping = false;
+    thread worker;
+
+public:
+    SaveWriter() : worker(&SaveWriter::Run, this) {}
+
+    ~SaveWriter()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    void Request(const uint8_t* data, int size)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            memcpy(pending, data, size);
+            pendingSize = size;
+            hasPending = true;
+            clearPending = false;
+        }
+        wake.notify_one();
+    }
+
+    void Clear()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            hasPending = false;
+            clearPending = true;
+        }
+        wake.notify_one();
+    }
+
+    static int Load(uint8_t* data)
+    {
+        FILE* file = fopen(saveFileName, "rb");
+        if (file == NULL) return 0;
+        int size = (int)fread(data, 1, maxSaveBytes, file);
+        fclose(file);
+        return size;
+    }
+
+private:
+    void Run()
+    {
+        uint8_t data[maxSaveBytes];
+        unique_lock<mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [this] { return hasPending || clearPending || stopping; });
+            if (clearPending)
+            {
+                clearPending = false;
+                guard.unlock();
+                remove(saveFileName);
+                guard.lock();
+            }
+            if (hasPending)
+            {
+                int size = pendingSize;
+                memcpy(data, pending, size);
+                hasPending = false;
+                guard.unlock();
+                WriteFile(data, size);
+                guard.lock();
+            }
+            if (stopping && !hasPending && !clearPending) return;
+        }
+    }
+
+    static void WriteFile(const uint8_t* data, int size)
+    {
+        string tempName = string(saveFileName) + ".tmp";
+        FILE* file = fopen(tempName.c_str(), "wb");
+        if (file == NULL)
+        {
+            printf("Error: Could not open %s for writing\n", tempName.c_str());
+            return;
+        }
+        bool written = (int)fwrite(data, 1, size, file) == size;
+        written = fflush(file) == 0 && written;
+#ifndef _WIN32
+        fsync(fileno(file));
+#endif
+        fclose(file);
+        if (!written) return;
+#ifdef _WIN32
+        remove(saveFileName);
+#endif
+        rename(tempName.c_str(), saveFileName);
+    }
+};
+
+// Restores a single-player save into game, switching mode first if needed.
+bool LoadSave(Game& game, const uint8_t* data, int size)
+{
+    GameState state;
+    game.SaveState(state);
+    bool hardMode;
+    if (!DecodeSave(data, size, state, hardMode)) return false;
+
+    const ProceduralMap* procedural = dynamic_cast<const ProceduralMap*>(game.hardMap);
+    if (hardMode && state.mapStyle != MAP_STYLE_FIXED)
+    {
+        if (!procedural || procedural->style != state.mapStyle || procedural->seed != state.mapSeed) game.UseProceduralMap((MapStyle)state.mapStyle, state.mapSeed);
+    }
+    else if (hardMode != (game.hardMap != nullptr) || procedural)
+    {
+        if (hardMode) game.UseHardModeMap();
+        else game.DisableHardMode();
+    }
+    isHardMode = hardMode;
+    wrapEdges = state.wrapEdges;
+    gameSpeed = hardMode ? hardSpeed : easySpeed;
+    game.LoadState(state);
+    return true;
+}
+
+int EncodeGame(const Game& game, uint8_t* out)
+{
+    GameState state;
+    game.SaveState(state);
+    return EncodeSave(state, isHardMode, out);
+}
+
+// --- Position Dataset ---
+// Every tick of every game, kept for offline analysis and training. A position is the board the
+// player saw: the snake as its head plus a 2-bit step to each next segment, food, explosive food,
+// score and tick (not the RNG, so a position cannot be resumed). Positions are bit-packed. A
+// keyframe holds a whole position; the following ticks of the same game are deltas of one byte
+// (head direction, grew, and which other fields changed) plus the fields that did change. Each
+// chunk starts with a keyframe and is compressed on its own, so a reader reaches any position by
+// decompressing one chunk and replaying at most one chunk of deltas.
+//
+// File: a header (magic, version, board size), the chunks, then an index entry (first position,
+// offset) per chunk and a tail (magic, chunk count, position count, index offset). Chunk: magic,
+// first position, position count, raw and packed size, payload; the payload is stored raw when
+// compressing would not shrink it. A file whose writer was killed has no tail: readers rebuild
+// the index by walking the chunks and ignore a torn last one, and a writer appends after them.
+const uint32_t datasetMagic = 0x53445053;        // "SPDS"
+const uint32_t datasetChunkMagic = 0x4B435053;   // "SPCK"
+const uint32_t datasetTailMagic = 0x58445053;    // "SPDX"
+const uint32_t datasetVersion = 1;
+const int datasetHeaderBytes = 12;
+const int datasetChunkHeaderBytes = 24;
+const int datasetTailBytes = 24;
+const uint32_t datasetChunkPositions = 512;
+
+// LSB-first bit stream of values up to 32 bits wide.
+class BitWriter {
+public:
+    vector<uint8_t> bytes;
+
+    void Write(uint32_t value, int bits)
+    {
+        pending |= (uint64_t)(value & (bits == 32 ? ~0u : (1u << bits) - 1)) << pendingBits;
+        pendingBits += bits;
+        while (pendingBits >= 8)
+        {
+            bytes.push_back((uint8_t)pending);
+            pending >>= 8;
+            pendingBits -= 8;
+        }
+    }
+
+    void Flush()
+    {
+        if (pendingBits > 0) bytes.push_back((uint8_t)pending);
+        pending = 0;
+        pendingBits = 0;
+    }
+
+    void Clear()
+    {
+        bytes.clear();
+        pending = 0;
+        pendingBits = 0;
+    }
+
+private:
+    uint64_t pending = 0;
+    int pendingBits = 0;
+};
+
+// Reading past the end yields zero bits and sets overrun.
+class BitReader {
+public:
+    bool overrun = false;
+
+    BitReader(const uint8_t* data = nullptr, size_t size = 0) : data(data), size(size) {}
+
+    uint32_t Read(int bits)
+    {
+        while (availableBits < bits)
+        {
+            if (at < size) buffered |= (uint64_t)data[at] << availableBits;
+            else overrun = true;
+            at++;
+            availableBits += 8;
+        }
+        uint32_t value = (uint32_t)(buffered & ((1ull << bits) - 1));
+        buffered >>= bits;
+        availableBits -= bits;
+        return value;
+    }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t at = 0;
+    uint64_t buffered = 0;
+    int availableBits = 0;
+};
+
+struct DatasetChunk {
+    uint64_t first;
+    uint64_t offset;
+};
+
+int DatasetCoordBits(int size)
+{
+    int bits = 1;
+    while ((1 << bits) < size) bits++;
+    return bits;
+}
+
+class DatasetReader {
+public:
+    ~DatasetReader() { Close(); }
+
+    bool Open(const char* path)
+    {
+        Close();
+        file = fopen(path, "rb");
+        if (file == NULL) return false;
+        uint8_t header[datasetHeaderBytes];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header) || ReadU32(header) != datasetMagic ||
+            ReadU32(header + 4) != datasetVersion) return false;
+        size = (int)ReadU32(header + 8);
+        if (size < 2 || size > 256) return false;
+        coordBits = DatasetCoordBits(size);
+
+        fseek(file, 0, SEEK_END);
+        long fileSize = ftell(file);
+        uint8_t tail[datasetTailBytes];
+        if (fileSize >= datasetHeaderBytes + datasetTailBytes && fseek(file, fileSize - datasetTailBytes, SEEK_SET) == 0 &&
+            fread(tail, 1, sizeof(tail), file) == sizeof(tail) && ReadU32(tail) == datasetTailMagic && ReadIndex(tail, fileSize))
+        {
+            return true;
+        }
+        return ScanChunks(fileSize);
+    }
+
+    void Close()
+    {
+        if (file) fclose(file);
+        file = NULL;
+        index.clear();
+        count = 0;
+        loaded = -1;
+    }
+
+    uint64_t Count() const { return count; }
+    int BoardSize() const { return size; }
+    const vector<DatasetChunk>& Chunks() const { return index; }
+    long DataEnd() const { return dataEnd; }
+
+    // Fills the single-player fields of state with the given position; everything else is left
+    // as the caller set it. Reading forward from the last position only decodes the new deltas.
+    bool Read(uint64_t position, GameState& state, bool& hardMode, uint32_t& game)
+    {
+        if (position >= count) return false;
+        long chunk = (long)(upper_bound(index.begin(), index.end(), position,
+                                        [](uint64_t value, const DatasetChunk& entry) { return value < entry.first; }) - index.begin()) - 1;
+        if (chunk != loaded && !LoadChunk(chunk)) return false;
+        if (position + 1 < next) Rewind();
+        while (next <= position)
+        {
+            if (!DecodeNext()) return false;
+        }
+
+        SnakeState& snake = state.snakes[0];
+        snake.length = (uint16_t)length;
+        for (int i = 0; i < length; i++) snake.body[i] = ring[(head - i) & ringMask];
+        snake.dirX = (int8_t)kernelDx[direction];
+        snake.dirY = (int8_t)kernelDy[direction];
+        snake.addSegment = addSegment;
+        state.tick = tick;
+        state.scores[0] = score;
+        state.food = food;
+        state.explosiveActive = explosiveActive;
+        state.explosivePos = explosivePos;
+        state.explosivePoints = explosivePoints;
+        state.mapStyle = mapStyle;
+        state.mapSeed = mapSeed;
+        state.wrapEdges = wrap;
+        state.running = true;
+        state.gameovermenu = false;
+        hardMode = this->hardMode;
+        game = this->game;
+        return true;
+    }
+
+private:
+    static const int ringSize = 8192;
+    static const int ringMask = ringSize - 1;
+    static_assert(ringSize >= maxSnakeCells && (ringSize & ringMask) == 0, "the body ring is a power of two that fits any snake");
+
+    FILE* file = NULL;
+    int size = 0;
+    int coordBits = 1;
+    vector<DatasetChunk> index;
+    uint64_t count = 0;
+    long dataEnd = 0;
+
+    long loaded = -1;
+    uint64_t chunkFirst = 0;
+    uint64_t next = 0;          // position DecodeNext produces; the cursor holds next - 1
+    vector<uint8_t> raw;
+    vector<uint8_t> scratch;
+    BitReader bits;
+
+    uint32_t game = 0;
+    uint32_t tick = 0;
+    int32_t score = 0;
+    bool hardMode = false;
+    bool wrap = false;
+    uint8_t mapStyle = MAP_STYLE_FIXED;
+    uint64_t mapSeed = 0;
+    CellPos ring[ringSize];             // ring[head] is the head, ring[head - i] segment i
+    int head = 0;
+    int length = 0;
+    int direction = 3;
+    bool addSegment = false;
+    CellPos food = {0, 0};
+    bool explosiveActive = false;
+    CellPos explosivePos = {0, 0};
+    int32_t explosivePoints = 0;
+
+    bool ReadIndex(const uint8_t* tail, long fileSize)
+    {
+        uint32_t chunks = ReadU32(tail + 4);
+        uint64_t positions = ReadU32(tail + 8) | ((uint64_t)ReadU32(tail + 12) << 32);
+        uint64_t indexOffset = ReadU32(tail + 16) | ((uint64_t)ReadU32(tail + 20) << 32);
+        if (indexOffset + 16ull * chunks + datasetTailBytes != (uint64_t)fileSize || fseek(file, (long)indexOffset, SEEK_SET) != 0) return false;
+        vector<uint8_t> entries(16ull * chunks);
+        if (fread(entries.data(), 1, entries.size(), file) != entries.size()) return false;
+        index.resize(chunks);
+        for (uint32_t i = 0; i < chunks; i++)
+        {
+            const uint8_t* entry = &entries[16 * i];
+            index[i].first = ReadU32(entry) | ((uint64_t)ReadU32(entry + 4) << 32);
+            index[i].offset = ReadU32(entry + 8) | ((uint64_t)ReadU32(entry + 12) << 32);
+        }
+        count = positions;
+        dataEnd = (long)indexOffset;
+        return true;
+    }
+
+    bool ScanChunks(long fileSize)
+    {
+        index.clear();
+        count = 0;
+        long at = datasetHeaderBytes;
+        uint8_t header[datasetChunkHeaderBytes];
+        while (fseek(file, at, SEEK_SET) == 0 && fread(header, 1, sizeof(header), file) == sizeof(header))
+        {
+            uint64_t first = ReadU32(header + 4) | ((uint64_t)ReadU32(header + 8) << 32);
+            uint32_t positions = ReadU32(header + 12), packedSize = ReadU32(header + 20);
+            long end = at + datasetChunkHeaderBytes + (long)packedSize;
+            if (ReadU32(header) != datasetChunkMagic || first != count || positions == 0 || end > fileSize) break;
+            index.push_back(DatasetChunk{first, (uint64_t)at});
+            count += positions;
+            at = end;
+        }
+        dataEnd = at;
+        return true;
+    }
+
+    bool LoadChunk(long chunk)
+    {
+        loaded = -1;
+        uint8_t header[datasetChunkHeaderBytes];
+        if (fseek(file, (long)index[chunk].offset, SEEK_SET) != 0 || fread(header, 1, sizeof(header), file) != sizeof(header) ||
+            ReadU32(header) != datasetChunkMagic) return false;
+        uint32_t rawSize = ReadU32(header + 16), packedSize = ReadU32(header + 20);
+        vector<uint8_t>& payload = packedSize == rawSize ? raw : scratch;
+        payload.resize(packedSize);
+        if (fread(payload.data(), 1, packedSize, file) != packedSize) return false;
+        if (packedSize != rawSize && !DecompressBlock(scratch.data(), packedSize, rawSize, raw)) return false;
+        loaded = chunk;
+        chunkFirst = index[chunk].first;
+        Rewind();
+        return true;
+    }
+
+    void Rewind()
+    {
+        bits = BitReader(raw.data(), raw.size());
+        next = chunkFirst;
+    }
+
+    CellPos ReadCell()
+    {
+        CellPos cell;
+        cell.x = (int16_t)bits.Read(coordBits);
+        cell.y = (int16_t)bits.Read(coordBits);
+        return cell;
+    }
+
+    bool InBoard(CellPos cell) const { return cell.x < size && cell.y < size; }
+
+    CellPos Step(CellPos from, int code) const
+    {
+        return CellPos{(int16_t)((from.x + kernelDx[code] + size) % size), (int16_t)((from.y + kernelDy[code] + size) % size)};
+    }
+
+    void ReadExplosive()
+    {
+        explosiveActive = bits.Read(1) != 0;
+        if (!explosiveActive) return;
+        explosivePos = ReadCell();
+        explosivePoints = (int32_t)bits.Read(32);
+    }
+
+    bool DecodeNext()
+    {
+        bool keyframe = bits.Read(1) != 0;
+        if (keyframe)
+        {
+            game = bits.Read(32);
+            tick = bits.Read(32);
+            score = (int32_t)bits.Read(32);
+            hardMode = bits.Read(1) != 0;
+            wrap = bits.Read(1) != 0;
+            mapStyle = (uint8_t)bits.Read(2);
+            mapSeed = 0;
+            if (mapStyle != MAP_STYLE_FIXED) mapSeed = bits.Read(32) | ((uint64_t)bits.Read(32) << 32);
+            CellPos cell = ReadCell();
+            direction = (int)bits.Read(2);
+            addSegment = bits.Read(1) != 0;
+            length = (int)bits.Read(16);
+            if (length == 0 || length > maxSnakeCells || !InBoard(cell)) return false;
+            head = length - 1;
+            ring[head] = cell;
+            for (int i = 1; i < length; i++) ring[head - i] = cell = Step(cell, (int)bits.Read(2));
+            food = ReadCell();
+            ReadExplosive();
+        }
+        else
+        {
+            if (next == chunkFirst) return false;   // a chunk always opens with a keyframe
+            direction = (int)bits.Read(2);
+            bool grew = bits.Read(1) != 0;
+            addSegment = bits.Read(1) != 0;
+            if (grew && ++length > maxSnakeCells) return false;
+            CellPos cell = Step(ring[head], direction);
+            head = (head + 1) & ringMask;
+            ring[head] = cell;
+            if (bits.Read(1)) food = ReadCell();
+            if (bits.Read(1)) ReadExplosive();
+            if (bits.Read(1)) score = bits.Read(1) ? score + 1 : (int32_t)bits.Read(32);
+            tick++;
+        }
+        if (bits.overrun || !InBoard(food) || (explosiveActive && !InBoard(explosivePos))) return false;
+        next++;
+        return true;
+    }
+};
+
+class DatasetWriter {
+public:
+    ~DatasetWriter() { Close(); }
+
+    // Creates the file, or appends to the dataset already in it; game ids then continue after its last.
+    bool Open(const char* path)
+    {
+        this->path = path;
+        FILE* probe = fopen(path, "rb");
+        long existingSize = 0;
+        if (probe != NULL)
+        {
+            fseek(probe, 0, SEEK_END);
+            existingSize = ftell(probe);
+            fclose(probe);
+        }
+        if (existingSize > 0)
+        {
+            DatasetReader existing;
+            GameState last;
+            bool hardMode;
+            if (!existing.Open(path) || existing.BoardSize() != cellCount)
+            {
+                printf("Error: %s is not a dataset of a %dx%d board\n", path, cellCount, cellCount);
+                return false;
+            }
+            index = existing.Chunks();
+            count = existing.Count();
+            if (count > 0 && existing.Read(count - 1, last, hardMode, nextGame)) nextGame++;
+            offset = existing.DataEnd();
+            existing.Close();
+            if (offset < existingSize && !TruncateFile(path, offset)) return false;
+            file = fopen(path, "ab");
+        }
+        else
+        {
+            file = fopen(path, "wb");
+            uint8_t header[datasetHeaderBytes];
+            WriteU32(header, datasetMagic);
+            WriteU32(header + 4, datasetVersion);
+            WriteU32(header + 8, (uint32_t)cellCount);
+            if (file != NULL) fwrite(header, 1, sizeof(header), file);
+            offset = datasetHeaderBytes;
+        }
+        if (file == NULL)
+        {
+            printf("Error: Could not open %s for writing\n", path);
+            return false;
+        }
+        coordBits = DatasetCoordBits(cellCount);
+        return true;
+    }
+
+    uint64_t Count() const { return count; }
+    uint32_t NextGame() const { return nextGame; }
+
+    // Appends the single-player part of state; false if it is not a valid position or the write failed.
+    bool Add(const GameState& state, bool hardMode, uint32_t game)
+    {
+        const SnakeState& snake = state.snakes[0];
+        int direction = StepCode(snake.dirX, snake.dirY);
+        if (file == NULL || snake.length == 0 || direction < 0 || state.mapStyle > MAP_STYLE_ROOMS || !InBoard(snake.body[0]) ||
+            !InBoard(state.food) || (state.explosiveActive && !InBoard(state.explosivePos))) return false;
+        if (chunkPositions == datasetChunkPositions && !FlushChunk()) return false;
+
+        bool sameGame = chunkPositions > 0 && game == previousGame && hardMode == previousHardMode && state.tick == previous.tick + 1 &&
+                        state.wrapEdges == previous.wrapEdges && state.mapStyle == previous.mapStyle && state.mapSeed == previous.mapSeed;
+        if (sameGame && Follows(state, direction)) WriteDelta(state, direction);
+        else if (!WriteKeyframe(state, hardMode, game, direction)) return false;
+
+        Remember(state, hardMode, game);
+        count++;
+        chunkPositions++;
+        nextGame = max(nextGame, game + 1);
+        return true;
+    }
+
+    bool Close()
+    {
+        if (file == NULL) return true;
+        bool ok = chunkPositions == 0 || FlushChunk();
+        vector<uint8_t> footer;
+        for (const DatasetChunk& entry : index)
+        {
+            AppendU32(footer, (uint32_t)entry.first);
+            AppendU32(footer, (uint32_t)(entry.first >> 32));
+            AppendU32(footer, (uint32_t)entry.offset);
+            AppendU32(footer, (uint32_t)(entry.offset >> 32));
+        }
+        uint32_t tail[6] = {datasetTailMagic, (uint32_t)index.size(), (uint32_t)count, (uint32_t)(count >> 32),
+                            (uint32_t)offset, (uint32_t)((uint64_t)offset >> 32)};
+        for (uint32_t field : tail) AppendU32(footer, field);
+        ok = fwrite(footer.data(), 1, footer.size(), file) == footer.size() && ok;
+        ok = fclose(file) == 0 && ok;
+        file = NULL;
+        if (!ok) printf("Error: Could not write %s\n", path.c_str());
+        return ok;
+    }
+
+private:
+    FILE* file = NULL;
+    string path;
+    int coordBits = 1;
+    vector<DatasetChunk> index;
+    uint64_t count = 0;
+    long offset = 0;
+    uint32_t nextGame = 0;
+    BitWriter bits;
+    vector<uint8_t> packed;
+    uint32_t chunkPositions = 0;
+
+    GameState previous;         // only the fields Remember copies are kept
+    bool previousHardMode = false;
+    uint32_t previousGame = 0;
+
+    bool InBoard(CellPos cell) const { return cell.x >= 0 && cell.y >= 0 && cell.x < cellCount && cell.y < cellCount; }
+
+    void WriteCell(CellPos cell)
+    {
+        bits.Write((uint32_t)cell.x, coordBits);
+        bits.Write((uint32_t)cell.y, coordBits);
+    }
+
+    void WriteExplosive(const GameState& state)
+    {
+        bits.Write(state.explosiveActive, 1);
+        if (!state.explosiveActive) return;
+        WriteCell(state.explosivePos);
+        bits.Write((uint32_t)state.explosivePoints, 32);
+    }
+
+    // True if state is the previous position one step later: a new head in direction, then the
+    // old body with or without its tail.
+    bool Follows(const GameState& state, int direction) const
+    {
+        const SnakeState& snake = state.snakes[0];
+        const SnakeState& last = previous.snakes[0];
+        if (snake.length != last.length && snake.length != last.length + 1) return false;
+        if (StepCode(snake.body[0].x - last.body[0].x, snake.body[0].y - last.body[0].y) != direction) return false;
+        return memcmp(snake.body + 1, last.body, (snake.length - 1) * sizeof(CellPos)) == 0;
+    }
+
+    bool WriteKeyframe(const GameState& state, bool hardMode, uint32_t game, int direction)
+    {
+        const SnakeState& snake = state.snakes[0];
+        for (int i = 1; i < snake.length; i++)
+        {
+            if (StepCode(snake.body[i].x - snake.body[i - 1].x, snake.body[i].y - snake.body[i - 1].y) < 0) return false;
+        }
+        bits.Write(1, 1);
+        bits.Write(game, 32);
+        bits.Write(state.tick, 32);
+        bits.Write((uint32_t)state.scores[0], 32);
+        bits.Write(hardMode, 1);
+        bits.Write(state.wrapEdges, 1);
+        bits.Write(state.mapStyle, 2);
+        if (state.mapStyle != MAP_STYLE_FIXED)
+        {
+            bits.Write((uint32_t)state.mapSeed, 32);
+            bits.Write((uint32_t)(state.mapSeed >> 32), 32);
+        }
+        WriteCell(snake.body[0]);
+        bits.Write((uint32_t)direction, 2);
+        bits.Write(snake.addSegment, 1);
+        bits.Write(snake.length, 16);
+        for (int i = 1; i < snake.length; i++)
+        {
+            bits.Write((uint32_t)StepCode(snake.body[i].x - snake.body[i - 1].x, snake.body[i].y - snake.body[i - 1].y), 2);
+        }
+        WriteCell(state.food);
+        WriteExplosive(state);
+        return true;
+    }
+
+    // Exactly 8 bits when only the snake moved.
+    void WriteDelta(const GameState& state, int direction)
+    {
+        const SnakeState& snake = state.snakes[0];
+        bits.Write(0, 1);
+        bits.Write((uint32_t)direction, 2);
+        bits.Write(snake.length > previous.snakes[0].length, 1);
+        bits.Write(snake.addSegment, 1);
+        bool foodMoved = state.food.x != previous.food.x || state.food.y != previous.food.y;
+        bits.Write(foodMoved, 1);
+        if (foodMoved) WriteCell(state.food);
+        bool explosiveChanged = state.explosiveActive != previous.explosiveActive ||
+                                (state.explosiveActive && (state.explosivePos.x != previous.explosivePos.x ||
+                                                           state.explosivePos.y != previous.explosivePos.y ||
+                                                           state.explosivePoints != previous.explosivePoints));
+        bits.Write(explosiveChanged, 1);
+        if (explosiveChanged) WriteExplosive(state);
+        bool scored = state.scores[0] != previous.scores[0];
+        bits.Write(scored, 1);
+        if (!scored) return;
+        bits.Write(state.scores[0] == previous.scores[0] + 1, 1);
+        if (state.scores[0] != previous.scores[0] + 1) bits.Write((uint32_t)state.scores[0], 32);
+    }
+
+    void Remember(const GameState& state, bool hardMode, uint32_t game)
+    {
+        const SnakeState& snake = state.snakes[0];
+        memcpy(previous.snakes[0].body, snake.body, snake.length * sizeof(CellPos));
+        previous.snakes[0].length = snake.length;
+        previous.tick = state.tick;
+        previous.scores[0] = state.scores[0];
+        previous.food = state.food;
+        previous.explosiveActive = state.explosiveActive;
+        previous.explosivePos = state.explosivePos;
+        previous.explosivePoints = state.explosivePoints;
+        previous.wrapEdges = state.wrapEdges;
+        previous.mapStyle = state.mapStyle;
+        previous.mapSeed = state.mapSeed;
+        previousHardMode = hardMode;
+        previousGame = game;
+    }
+
+    bool FlushChunk()
+    {
+        bits.Flush();
+        CompressBlock(bits.bytes, packed);
+        const vector<uint8_t>& payload = packed.size() < bits.bytes.size() ? packed : bits.bytes;
+        uint64_t first = count - chunkPositions;
+        uint8_t header[datasetChunkHeaderBytes];
+        WriteU32(header, datasetChunkMagic);
+        WriteU32(header + 4, (uint32_t)first);
+        WriteU32(header + 8, (uint32_t)(first >> 32));
+        WriteU32(header + 12, chunkPositions);
+        WriteU32(header + 16, (uint32_t)bits.bytes.size());
+        WriteU32(header + 20, (uint32_t)payload.size());
+        bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                  fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+        index.push_back(DatasetChunk{first, (uint64_t)offset});
+        offset += datasetChunkHeaderBytes + (long)payload.size();
+        bits.Clear();
+        chunkPositions = 0;
+        return ok;
+    }
+};
+
+// Turns the simulation thread's per-tick save bytes into dataset positions on a thread of its
+// own; a tick costs one copy into a lock-free ring. A tick that goes backwards (a new round, or a
+// rewind branching off) starts a new game id.
+class DatasetRecorder {
+private:
+    SpscRing<uint8_t, (1 << 18)> ring;
+    uint8_t staging[2 + maxSaveBytes];
+    atomic<bool> stopping{false};
+    atomic<uint32_t> dropped{0};
+    DatasetWriter writer;
+    thread worker;
+
+public:
+    ~DatasetRecorder()
+    {
+        stopping = true;
+        if (worker.joinable()) worker.join();
+    }
+
+    bool Start(const char* path)
+    {
+        if (!writer.Open(path)) return false;
+        worker = thread(&DatasetRecorder::Run, this);
+        return true;
+    }
+
+    // Simulation thread. A whole record goes in with one Push, so the worker never sees half of one.
+    void Push(const uint8_t* save, int size)
+    {
+        staging[0] = (uint8_t)size;
+        staging[1] = (uint8_t)(size >> 8);
+        memcpy(staging + 2, save, size);
+        if (!ring.Push(staging, 2 + size)) dropped.fetch_add(1, memory_order_relaxed);
+    }
+
+private:
+    void Run()
+    {
+        uint8_t save[maxSaveBytes];
+        unique_ptr<GameState> state(new GameState());
+        uint32_t game = writer.NextGame();
+        uint32_t lastTick = 0;
+        bool started = false;
+        while (true)
+        {
+            uint8_t header[2];
+            if (ring.Pop(header, 2) == 0)
+            {
+                if (stopping) break;
+                this_thread::sleep_for(chrono::milliseconds(5));
+                continue;
+            }
+            int size = header[0] | (header[1] << 8);
+            ring.Pop(save, size);
+            bool hardMode;
+            if (!DecodeSave(save, size, *state, hardMode)) continue;
+            if (started && state->tick <= lastTick) game++;
+            started = true;
+            lastTick = state->tick;
+            writer.Add(*state, hardMode, game);
+        }
+        uint64_t positions = writer.Count();
+        if (writer.Close()) printf("Dataset: %llu positions\n", (unsigned long long)positions);
+        if (dropped > 0) printf("Dataset: %u ticks dropped while the writer was behind\n", dropped.load());
+    }
+};
+
+template <class R>
+void KernelPosition(const SimKernel<R>& kernel, GameState& state)
+{
+    SnakeState& snake = state.snakes[0];
+    int ring = (int)kernel.body.size();
+    snake.length = (uint16_t)min(kernel.length, maxSnakeCells);
+    for (int i = 0; i < snake.length; i++)
+    {
+        int cell = kernel.body[(kernel.headIndex - i + ring) % ring];
+        snake.body[i] = CellPos{(int16_t)(cell % kernel.size), (int16_t)(cell / kernel.size)};
+    }
+    snake.dirX = (int8_t)kernelDx[kernel.direction];
+    snake.dirY = (int8_t)kernelDy[kernel.direction];
+    snake.addSegment = kernel.pendingGrowth > 0;
+    state.tick = kernel.tick;
+    state.scores[0] = kernel.score;
+    state.food = CellPos{(int16_t)(kernel.food % kernel.size), (int16_t)(kernel.food / kernel.size)};
+    state.explosiveActive = kernel.explosive >= 0;
+    state.explosivePos = state.explosiveActive ? CellPos{(int16_t)(kernel.explosive % kernel.size), (int16_t)(kernel.explosive / kernel.size)} : CellPos{0, 0};
+    state.explosivePoints = state.explosiveActive ? kernel.explosivePoints : 0;
+    state.mapStyle = MAP_STYLE_FIXED;
+    state.mapSeed = 0;
+    state.wrapEdges = R::Edges::wraps;
+}
+
+// FNV over the fields a dataset keeps.
+uint32_t PositionChecksum(const GameState& state, bool hardMode, uint32_t game)
+{
+    const SnakeState& snake = state.snakes[0];
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](uint32_t value) { hash = (hash ^ value) * 16777619u; };
+    uint32_t fields[] = {game, state.tick, (uint32_t)state.scores[0], (uint32_t)hardMode, (uint32_t)state.wrapEdges, state.mapStyle,
+                         (uint32_t)state.mapSeed, snake.length, (uint32_t)(snake.dirX + 2 * snake.dirY), snake.addSegment,
+                         (uint32_t)state.food.x, (uint32_t)state.food.y, state.explosiveActive};
+    for (uint32_t field : fields) mix(field);
+    if (state.explosiveActive)
+    {
+        mix((uint32_t)state.explosivePos.x);
+        mix((uint32_t)state.explosivePos.y);
+        mix((uint32_t)state.explosivePoints);
+    }
+    for (int i = 0; i < snake.length; i++) mix((uint32_t)snake.body[i].x << 16 | (uint16_t)snake.body[i].y);
+    return hash;
+}
+
+// Plays greedy games on seeds 1..games, calling visit(state, game) for every live tick.
+template <class R, class Visit>
+void PlayDatasetGames(int games, Visit visit)
+{
+    SimKernel<R> kernel;
+    unique_ptr<GameState> state(new GameState());
+    kernel.Reset(1);
+    for (int game = 0; game < games; game++)
+    {
+        kernel.Restart((uint64_t)game + 1);
+        while (kernel.alive && !kernel.Filled() && kernel.tick < 20000)
+        {
+            KernelPosition(kernel, *state);
+            visit(*state, (uint32_t)game);
+            kernel.Step(GreedyMove(kernel));
+        }
+    }
+}
+
+// game --dataset-build <file> [games] [rules]: records greedy games, then checks that every
+// position reads back exactly, in order and at random, and reports size and seek time.
+template <class R>
+int BuildDataset(const char* path, int games, bool hardMode)
+{
+    remove(path);
+    DatasetWriter writer;
+    if (!writer.Open(path)) return 1;
+    uint64_t segments = 0;
+    bool added = true;
+    auto start = chrono::steady_clock::now();
+    PlayDatasetGames<R>(games, [&](const GameState& state, uint32_t game) {
+        added = writer.Add(state, hardMode, game) && added;
+        segments += state.snakes[0].length;
+    });
+    if (!writer.Close() || !added)
+    {
+        printf("Error: could not record every position\n");
+        return 1;
+    }
+    double writeSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    DatasetReader reader;
+    if (!reader.Open(path))
+    {
+        printf("Error: Could not open %s\n", path);
+        return 1;
+    }
+    vector<uint32_t> expected;
+    expected.reserve(reader.Count());
+    PlayDatasetGames<R>(games, [&](const GameState& state, uint32_t game) { expected.push_back(PositionChecksum(state, hardMode, game)); });
+
+    unique_ptr<GameState> state(new GameState());
+    bool stateHard;
+    uint32_t game;
+    uint64_t mismatches = expected.size() != reader.Count() ? 1 : 0;
+    start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < reader.Count() && i < expected.size(); i++)
+    {
+        if (!reader.Read(i, *state, stateHard, game) || PositionChecksum(*state, stateHard, game) != expected[i]) mismatches++;
+    }
+    double sequentialSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const int seeks = 100000;
+    Rng rng(12345);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < seeks && !expected.empty(); i++)
+    {
+        uint64_t position = rng.Next() % expected.size();
+        if (!reader.Read(position, *state, stateHard, game) || PositionChecksum(*state, stateHard, game) != expected[position]) mismatches++;
+    }
+    double seekSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    FILE* file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    double bytes = (double)ftell(file);
+    fclose(file);
+    double positions = (double)reader.Count();
+    printf("Dataset: %d games, %.0f positions, %llu segments, %.2f MB in %zu chunks\n", games, positions,
+           (unsigned long long)segments, bytes / 1e6, reader.Chunks().size());
+    printf("  %.2f bytes/position; a deque<Vector2> per position would be %.1f MB (%.0fx larger)\n", bytes / positions,
+           8.0 * segments / 1e6, 8.0 * segments / bytes);
+    printf("  record %.0f positions/s, sequential read %.0f positions/s, random read %.2f us\n", positions / writeSeconds,
+           positions / sequentialSeconds, seekSeconds * 1e6 / seeks);
+    if (mismatches > 0)
+    {
+        printf("Check: %llu positions did not read back\n", (unsigned long long)mismatches);
+        return 1;
+    }
+    printf("Check: every position reads back exactly\n");
+    return 0;
+}
+
+// game --dataset-show <file> <position>: prints one position as text.
+int ShowDatasetPosition(const char* path, uint64_t position)
+{
+    DatasetReader reader;
+    if (!reader.Open(path))
+    {
+        printf("Error: Could not open %s\n", path);
+        return 1;
+    }
+    unique_ptr<GameState> state(new GameState());
+    bool hardMode;
+    uint32_t game;
+    if (!reader.Read(position, *state, hardMode, game))
+    {
+        printf("Error: %s has no position %llu (%llu positions)\n", path, (unsigned long long)position, (unsigned long long)reader.Count());
+        return 1;
+    }
+    const SnakeState& snake = state->snakes[0];
+    int size = reader.BoardSize();
+    printf("Position %llu of %llu: game %u, tick %u, score %d, length %d%s%s\n", (unsigned long long)position,
+           (unsigned long long)reader.Count(), game, state->tick, state->scores[0], snake.length, hardMode ? ", hard" : "",
+           state->wrapEdges ? ", wrap" : "");
+    vector<char> board(size * size, '.');
+    for (int i = snake.length - 1; i >= 0; i--) board[snake.body[i].y * size + snake.body[i].x] = i == 0 ? '@' : 'o';
+    board[state->food.y * size + state->food.x] = '*';
+    if (state->explosiveActive) board[state->explosivePos.y * size + state->explosivePos.x] = 'X';
+    for (int y = 0; y < size; y++) printf("%.*s\n", size, &board[y * size]);
+    return 0;
+}
+
+// --- UdpSocket Class ---
+// Non-blocking UDP endpoint. POSIX only: pulling winsock into this file clashes with raylib's names.
+class UdpSocket {
+private:
+    int fd = -1;
+#ifndef _WIN32
+    sockaddr_in remote;
+    bool hasRemote = false;
+#endif
+
+public:
+    ~UdpSocket() { Close(); }
+
+    bool Open(int localPort)
+    {
+#ifndef _WIN32
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) return false;
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons((uint16_t)localPort);
+        if (bind(fd, (sockaddr*)&local, sizeof(local)) < 0)
+        {
+            Close();
+            return false;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        return true;
+#else
+        (void)localPort;
+        printf("Error: networked play is only supported on POSIX builds\n");
+        return false;
+#endif
+    }
+
+    bool SetRemote(const char* host, int port)
+    {
+#ifndef _WIN32
+        memset(&remote, 0, sizeof(remote));
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons((uint16_t)port);
+        hasRemote = inet_pton(AF_INET, host, &remote.sin_addr) == 1;
+        return hasRemote;
+#else
+        (void)host; (void)port;
+        return false;
+#endif
+    }
+
+    void Send(const uint8_t* data, int size)
+    {
+#ifndef _WIN32
+        if (fd >= 0 && hasRemote) sendto(fd, data, size, 0, (sockaddr*)&remote, sizeof(remote));
+#else
+        (void)data; (void)size;
+#endif
+    }
+
+#ifndef _WIN32
+    void SendTo(const sockaddr_in& to, const uint8_t* data, int size)
+    {
+        if (fd >= 0) sendto(fd, data, size, 0, (const sockaddr*)&to, sizeof(to));
+    }
+
+    int Receive(uint8_t* data, int capacity, sockaddr_in* from = nullptr)
+    {
+        if (fd < 0) return -1;
+        sockaddr_in source;
+        socklen_t sourceSize = sizeof(source);
+        int size = (int)recvfrom(fd, data, capacity, 0, (sockaddr*)&source, &sourceSize);
+        if (size > 0 && from) *from = source;
+        return size;
+    }
+#else
+    int Receive(uint8_t* data, int capacity) { (void)data; (void)capacity; return -1; }
+#endif
+
+    void Close()
+    {
+#ifndef _WIN32
+        if (fd >= 0) close(fd);
+#endif
+        fd = -1;
+    }
+};
+
+// --- LockstepSession Class ---
+// Peer-to-peer lockstep over UDP: only per-tick direction inputs are exchanged. Remote inputs that
+// have not arrived yet are predicted as "no turn"; when a real turn arrives late the game is rolled
+// back to the snapshot taken before that tick and re-simulated silently.
+enum NetDirection : uint8_t { NET_NONE = 0, NET_UP, NET_DOWN, NET_LEFT, NET_RIGHT };
+
+const uint32_t netMagic = 0x4B4E5352; // "RSNK"
+const int netInputDelay = 1;
+const int maxRollbackTicks = 8;
+const int netInputHistory = 32;
+const int netInputRing = 64;
+const int netSnapshotRing = 16;
+const double netResendInterval = 0.05;
+
+Vector2 NetDirectionToVector(uint8_t dir)
+{
+    switch (dir) {
+        case NET_UP: return Vector2{0, -1};
+        case NET_DOWN: return Vector2{0, 1};
+        case NET_LEFT: return Vector2{-1, 0};
+        case NET_RIGHT: return Vector2{1, 0};
+        default: return Vector2{0, 0};
+    }
+}
+
+class LockstepSession {
+private:
+    Game& game;
+    UdpSocket socket;
+    int localPlayer;
+    bool connected = false;
+    int32_t tick = 0;               // next tick to simulate
+    int32_t remoteConfirmed = -1;   // every remote input up to here is known
+    int32_t peerAck = -1;           // the peer has every local input up to here
+    uint8_t pendingInput = NET_NONE;
+    uint8_t localInputs[netInputRing];
+    uint8_t remoteInputs[netInputRing];
+    GameState snapshots[netSnapshotRing];
+    double lastSendTime = 0;
+
+public:
+    int rollbacks = 0;
+    double lastRollbackMs = 0;
+    double maxRollbackMs = 0;
+
+    LockstepSession(Game& game, int localPlayer) : game(game), localPlayer(localPlayer)
+    {
+        memset(localInputs, 0, sizeof(localInputs));
+        memset(remoteInputs, 0, sizeof(remoteInputs));
+    }
+
+    ~LockstepSession()
+    {
+        cout << "Lockstep session closed: " << rollbacks << " rollbacks, worst " << maxRollbackMs << " ms" << endl;
+    }
+
+    bool Open(int localPort, const char* host, int remotePort)
+    {
+        return socket.Open(localPort) && socket.SetRemote(host, remotePort);
+    }
+
+    bool IsConnected() const { return connected; }
+
+    int LocalPlayer() const { return localPlayer; }
+
+    // A finished match only counts once the peer's inputs up to that tick are confirmed.
+    bool IsMatchOver() const { return !game.running && (int32_t)game.tick <= remoteConfirmed + 1; }
+
+    bool CanTick() const { return connected && tick - remoteConfirmed <= maxRollbackTicks; }
+
+    void SetLocalInput(uint8_t dir) { pendingInput = dir; }
+
+    // The local snake's direction once every input already in the ring has been applied. A new
+    // input lands netInputDelay ticks from now, so it has to be checked against this one.
+    Vector2 QueuedDirection() const
+    {
+        Vector2 direction = (localPlayer == 0 ? game.snake : game.rival).direction;
+        for (int32_t t = tick; t < tick + netInputDelay; t++) direction = Turn(direction, localInputs[t % netInputRing]);
+        return direction;
+    }
+
+    void Tick()
+    {
+        if (!CanTick()) return;
+
+        localInputs[(tick + netInputDelay) % netInputRing] = pendingInput;
+        pendingInput = NET_NONE;
+        Simulate(tick);
+        tick++;
+        SendInputs();
+    }
+
+    void Poll()
+    {
+        uint8_t packet[16 + netInputHistory];
+        int32_t rollbackFrom = tick;
+        int size;
+        while ((size = socket.Receive(packet, sizeof(packet))) > 0)
+        {
+            if (size < 14 || ReadU32(packet) != netMagic) continue;
+            connected = true;
+            int32_t lastTick = (int32_t)ReadU32(packet + 4);
+            int32_t ackTick = (int32_t)ReadU32(packet + 8);
+            int count = min((int)packet[12], size - 14);
+            peerAck = max(peerAck, ackTick);
+
+            for (int i = 0; i < count; i++)
+            {
+                int32_t inputTick = lastTick - count + 1 + i;
+                if (inputTick != remoteConfirmed + 1) continue;
+                uint8_t input = packet[14 + i];
+                remoteInputs[inputTick % netInputRing] = input;
+                remoteConfirmed = inputTick;
+                if (inputTick < tick && input != NET_NONE) rollbackFrom = min(rollbackFrom, inputTick);
+            }
+        }
+
+        if (rollbackFrom < tick) Rollback(rollbackFrom);
+
+        if (NowSeconds() - lastSendTime >= netResendInterval) SendInputs();
+    }
+
+private:
+    uint8_t InputFor(int player, int32_t inputTick) const
+    {
+        if (player == localPlayer) return localInputs[inputTick % netInputRing];
+        return inputTick <= remoteConfirmed ? remoteInputs[inputTick % netInputRing] : NET_NONE;
+    }
+
+    static Vector2 Turn(Vector2 direction, uint8_t input)
+    {
+        Vector2 dir = NetDirectionToVector(input);
+        if (input == NET_NONE || Vector2Equals(Vector2Add(dir, direction), Vector2{0, 0})) return direction;
+        return dir;
+    }
+
+    static void ApplyInput(Snake& snake, uint8_t input)
+    {
+        snake.direction = Turn(snake.direction, input);
+    }
+
+    void Simulate(int32_t simTick)
+    {
+        game.SaveState(snapshots[simTick % netSnapshotRing]);
+        ApplyInput(game.snake, InputFor(0, simTick));
+        ApplyInput(game.rival, InputFor(1, simTick));
+        game.UpdateVersus();
+    }
+
+    void Rollback(int32_t fromTick)
+    {
+        double start = NowSeconds();
+        game.LoadState(snapshots[fromTick % netSnapshotRing]);
+        game.silent = true;
+        for (int32_t t = fromTick; t < tick; t++)
+        {
+            Simulate(t);
+        }
+        game.silent = false;
+        rollbacks++;
+        lastRollbackMs = (NowSeconds() - start) * 1000.0;
+        maxRollbackMs = max(maxRollbackMs, lastRollbackMs);
+    }
+
+    // Packet: magic, last input tick, ack of the peer's inputs, count, player, inputs[count].
+    void SendInputs()
+    {
+        uint8_t packet[14 + netInputHistory];
+        int32_t lastTick = tick - 1 + netInputDelay;
+        int32_t firstTick = max(max(peerAck + 1, lastTick - netInputHistory + 1), (int32_t)0);
+        int count = max(0, lastTick - firstTick + 1);
+        WriteU32(packet, netMagic);
+        WriteU32(packet + 4, (uint32_t)lastTick);
+        WriteU32(packet + 8, (uint32_t)remoteConfirmed);
+        packet[12] = (uint8_t)count;
+        packet[13] = (uint8_t)localPlayer;
+        for (int i = 0; i < count; i++)
+        {
+            packet[14 + i] = localInputs[(firstTick + i) % netInputRing];
+        }
+        socket.Send(packet, 14 + count);
+        lastSendTime = NowSeconds();
+    }
+};
+
+// --- Relay (loss/latency injection for local testing) ---
+// Forwards datagrams between the first two peers that talk to it, dropping lossPercent of them
+// and delaying the rest by latencyMs plus up to 50% jitter.
+int RunRelay(int port, int lossPercent, int latencyMs)
+{
+#ifndef _WIN32
+    struct Delayed {
+        double deliverAt;
+        int to;
+        int size;
+        uint8_t data[64];
+    };
+
+    UdpSocket relay;
+    if (!relay.Open(port))
+    {
+        printf("Error: relay could not bind port %d\n", port);
+        return 1;
+    }
+    cout << "Relay on port " << port << ", loss " << lossPercent << "%, latency " << latencyMs << " ms" << endl;
+
+    sockaddr_in peers[2];
+    int peerCount = 0;
+    deque<Delayed> queue;
+    Rng rng((uint64_t)time(nullptr));
+    uint8_t buffer[64];
+
+    while (true)
+    {
+        sockaddr_in from;
+        int size;
+        while ((size = relay.Receive(buffer, sizeof(buffer), &from)) > 0)
+        {
+            int source = -1;
+            for (int i = 0; i < peerCount; i++)
+            {
+                if (peers[i].sin_addr.s_addr == from.sin_addr.s_addr && peers[i].sin_port == from.sin_port) source = i;
+            }
+            if (source < 0 && peerCount < 2)
+            {
+                peers[peerCount] = from;
+                source = peerCount++;
+            }
+            if (source < 0 || peerCount < 2 || rng.Range(0, 99) < lossPercent) continue;
+
+            Delayed packet;
+            packet.deliverAt = NowSeconds() + (latencyMs + rng.Range(0, latencyMs / 2)) / 1000.0;
+            packet.to = 1 - source;
+            packet.size = size;
+            memcpy(packet.data, buffer, size);
+            queue.push_back(packet);
+        }
+
+        double now = NowSeconds();
+        for (auto it = queue.begin(); it != queue.end();)
+        {
+            if (it->deliverAt <= now)
+            {
+                relay.SendTo(peers[it->to], it->data, it->size);
+                it = queue.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+#else
+    (void)port; (void)lossPercent; (void)latencyMs;
+    printf("Error: the relay is only supported on POSIX builds\n");
+    return 1;
+#endif
+}
+
+// --- Telemetry Stream ---
+// Per-tick board deltas for spectators. Ops (one byte unless noted):
+//   0x00-0x0F move: bits 0-1 direction, bit 2 grew (no tail pop), bit 3 snake index
+//   0x10 food x y | 0x11 explosive x y points | 0x12 explosive gone | 0x13 score idx varint
+//   0x14 explosive points | 0x20 snake idx varint(len) len*(x y) | 0x21 clear count | 0x22 checksum u32
+enum TelemetryOp : uint8_t {
+    TEL_MOVE = 0x00,
+    TEL_FOOD = 0x10,
+    TEL_EXPLOSIVE = 0x11,
+    TEL_EXPLOSIVE_GONE = 0x12,
+    TEL_SCORE = 0x13,
+    TEL_EXPLOSIVE_POINTS = 0x14,
+    TEL_SNAKE = 0x20,
+    TEL_CLEAR = 0x21,
+    TEL_CHECKSUM = 0x22
+};
+
+const int telemetryChecksumInterval = 32;
+const CellPos telemetryDirections[4] = {{0, -1}, {0, 1}, {-1, 0}, {1, 0}};
+
+uint32_t FnvMix(uint32_t hash, int32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        hash = (hash ^ (uint8_t)(value >> (8 * i))) * 16777619u;
+    }
+    return hash;
+}
+
+// Board as seen by a spectator; also mirrored by the recorder and the server for keyframes.
+class TelemetryBoard {
+public:
+    deque<CellPos> bodies[2];
+    int snakeCount = 0;
+    CellPos food = {0, 0};
+    bool explosiveActive = false;
+    CellPos explosive = {0, 0};
+    int explosivePoints = 0;
+    int32_t scores[2] = {0, 0};
+    uint32_t moves = 0;
+    uint32_t checksumFailures = 0;
+
+    uint32_t Checksum() const
+    {
+        uint32_t hash = 2166136261u;
+        for (int i = 0; i < snakeCount; i++)
+        {
+            hash = FnvMix(hash, (int32_t)bodies[i].size());
+            for (const CellPos& cell : bodies[i]) hash = FnvMix(hash, (cell.x << 16) | (uint16_t)cell.y);
+            hash = FnvMix(hash, scores[i]);
+        }
+        hash = FnvMix(hash, (food.x << 16) | (uint16_t)food.y);
+        return hash;
+    }
+
+    // Applies one op from the front of data; returns bytes consumed, 0 if the op is incomplete.
+    size_t Apply(const uint8_t* data, size_t size)
+    {
+        if (size == 0) return 0;
+        uint8_t op = data[0];
+        if (op < TEL_FOOD)
+        {
+            int index = (op >> 3) & 1;
+            if (index >= snakeCount || bodies[index].empty()) return 1;
+            CellPos dir = telemetryDirections[op & 3];
+            CellPos head = bodies[index].front();
+            bodies[index].push_front(CellPos{(int16_t)(head.x + dir.x), (int16_t)(head.y + dir.y)});
+            if (!(op & 4)) bodies[index].pop_back();
+            moves++;
+            return 1;
+        }
+        switch (op) {
+            case TEL_FOOD:
+                if (size < 3) return 0;
+                food = CellPos{(int8_t)data[1], (int8_t)data[2]};
+                return 3;
+            case TEL_EXPLOSIVE:
+                if (size < 4) return 0;
+                explosive = CellPos{(int8_t)data[1], (int8_t)data[2]};
+                explosivePoints = data[3];
+                explosiveActive = true;
+                return 4;
+            case TEL_EXPLOSIVE_GONE:
+                explosiveActive = false;
+                return 1;
+            case TEL_EXPLOSIVE_POINTS:
+                if (size < 2) return 0;
+                explosivePoints = data[1];
+                return 2;
+            case TEL_SCORE: {
+                if (size < 3) return 0;
+                uint32_t value;
+                size_t used = ReadVarint(data + 2, size - 2, value);
+                if (!used) return 0;
+                scores[data[1] & 1] = (int32_t)value;
+                return 2 + used;
+            }
+            case TEL_SNAKE: {
+                if (size < 3) return 0;
+                uint32_t length;
+                size_t used = ReadVarint(data + 2, size - 2, length);
+                if (!used || size < 2 + used + 2 * (size_t)length) return 0;
+                deque<CellPos>& body = bodies[data[1] & 1];
+                body.clear();
+                for (uint32_t i = 0; i < length; i++)
+                {
+                    body.push_back(CellPos{(int8_t)data[2 + used + 2 * i], (int8_t)data[3 + used + 2 * i]});
+                }
+                return 2 + used + 2 * length;
+            }
+            case TEL_CLEAR:
+                if (size < 2) return 0;
+                snakeCount = min((int)data[1], 2);
+                for (int i = 0; i < 2; i++) bodies[i].clear();
+                return 2;
+            case TEL_CHECKSUM:
+                if (size < 5) return 0;
+                if (ReadU32(data + 1) != Checksum()) checksumFailures++;
+                return 5;
+            default:
+                return 1;
+        }
+    }
+
+    void EncodeKeyframe(vector<uint8_t>& out) const
+    {
+        out.push_back(TEL_CLEAR);
+        out.push_back((uint8_t)snakeCount);
+        for (int i = 0; i < snakeCount; i++)
+        {
+            out.push_back(TEL_SNAKE);
+            out.push_back((uint8_t)i);
+            WriteVarint(out, (uint32_t)bodies[i].size());
+            for (const CellPos& cell : bodies[i])
+            {
+                out.push_back((uint8_t)cell.x);
+                out.push_back((uint8_t)cell.y);
+            }
+            out.push_back(TEL_SCORE);
+            out.push_back((uint8_t)i);
+            WriteVarint(out, (uint32_t)scores[i]);
+        }
+        uint8_t foodOp[3] = {TEL_FOOD, (uint8_t)food.x, (uint8_t)food.y};
+        out.insert(out.end(), foodOp, foodOp + 3);
+        if (explosiveActive)
+        {
+            uint8_t explosiveOp[4] = {TEL_EXPLOSIVE, (uint8_t)explosive.x, (uint8_t)explosive.y, (uint8_t)explosivePoints};
+            out.insert(out.end(), explosiveOp, explosiveOp + 4);
+        }
+        else
+        {
+            out.push_back(TEL_EXPLOSIVE_GONE);
+        }
+    }
+
+    void ApplyAll(const uint8_t* data, size_t size)
+    {
+        size_t at = 0, used;
+        while (at < size && (used = Apply(data + at, size - at)) > 0) at += used;
+    }
+
+    void Apply(const vector<uint8_t>& ops) { ApplyAll(ops.data(), ops.size()); }
+};
+
+// --- TelemetryServer Class ---
+// Record() runs on the frame thread and only diffs Game against a mirror and pushes bytes into the
+// ring. The server thread owns the sockets, keeps its own mirror for late-joiner keyframes and fans
+// the byte stream out to every subscriber.
+class TelemetryServer {
+private:
+    SpscRing<uint8_t, 1 << 16> ring;
+    TelemetryBoard recorded;
+    vector<uint8_t> pending;
+    bool needKeyframe = true;
+    uint32_t lastChecksumMove = 0;
+    atomic<bool> stopping{false};
+    thread worker;
+    int listenFd = -1;
+
+public:
+    atomic<int> subscriberCount{0};
+
+    ~TelemetryServer()
+    {
+        stopping = true;
+        if (worker.joinable()) worker.join();
+#ifndef _WIN32
+        if (listenFd >= 0) close(listenFd);
+#endif
+    }
+
+    bool Start(int port)
+    {
+#ifndef _WIN32
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0) return false;
+        int yes = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons((uint16_t)port);
+        if (bind(listenFd, (sockaddr*)&local, sizeof(local)) < 0 || listen(listenFd, 16) < 0) return false;
+        fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL, 0) | O_NONBLOCK);
+        worker = thread(&TelemetryServer::Serve, this);
+        return true;
+#else
+        (void)port;
+        printf("Error: the telemetry server is only supported on POSIX builds\n");
+        return false;
+#endif
+    }
+
+    // Same hash as TelemetryBoard::Checksum, but taken from the real game rather than the mirror.
+    static uint32_t GameChecksum(const Snake* const* snakes, const int* scores, int snakeCount, Vector2 food)
+    {
+        uint32_t hash = 2166136261u;
+        for (int i = 0; i < snakeCount; i++)
+        {
+            hash = FnvMix(hash, (int32_t)snakes[i]->body.size());
+            for (const Vector2& cell : snakes[i]->body) hash = FnvMix(hash, ((int)cell.x << 16) | (uint16_t)(int16_t)cell.y);
+            hash = FnvMix(hash, scores[i]);
+        }
+        return FnvMix(hash, ((int)food.x << 16) | (uint16_t)(int16_t)food.y);
+    }
+
+    void Record(const Game& game)
+    {
+        pending.clear();
+        int snakeCount = game.versus ? 2 : 1;
+        const Snake* snakes[2] = {&game.snake, &game.rival};
+        const int scores[2] = {game.score, game.rivalScore};
+
+        if (!needKeyframe && snakeCount != recorded.snakeCount) needKeyframe = true;
+        for (int i = 0; i < snakeCount && !needKeyframe; i++)
+        {
+            const SnakeBody& body = snakes[i]->body;
+            const deque<CellPos>& mirror = recorded.bodies[i];
+            if (body.empty() || mirror.empty()) { needKeyframe = true; break; }
+            int dx = (int)body[0].x - mirror.front().x;
+            int dy = (int)body[0].y - mirror.front().y;
+            if (dx == 0 && dy == 0 && body.size() == mirror.size())
+            {
+                if (mirror.back().x != (int)body.back().x || mirror.back().y != (int)body.back().y) needKeyframe = true;
+                continue;
+            }
+
+            int dir = dy < 0 ? 0 : dy > 0 ? 1 : dx < 0 ? 2 : 3;
+            bool grew = body.size() == mirror.size() + 1;
+            bool adjacent = abs(dx) + abs(dy) == 1 && (grew || body.size() == mirror.size());
+            if (!adjacent) { needKeyframe = true; break; }
+
+            uint8_t op = (uint8_t)(TEL_MOVE | dir | (grew ? 4 : 0) | (i << 3));
+            recorded.Apply(&op, 1);
+            const CellPos& tail = recorded.bodies[i].back();
+            if (tail.x != (int)body.back().x || tail.y != (int)body.back().y) { needKeyframe = true; break; }
+            pending.push_back(op);
+        }
+
+        if (needKeyframe)
+        {
+            pending.clear();
+            recorded.snakeCount = snakeCount;
+            for (int i = 0; i < snakeCount; i++)
+            {
+                recorded.bodies[i].clear();
+                for (const Vector2& cell : snakes[i]->body) recorded.bodies[i].push_back(CellPos{(int16_t)cell.x, (int16_t)cell.y});
+                recorded.scores[i] = scores[i];
+            }
+            recorded.food = CellPos{(int16_t)game.food.position.x, (int16_t)game.food.position.y};
+            recorded.explosiveActive = game.explosiveFood.isFoodActive();
+            recorded.explosive = CellPos{(int16_t)game.explosiveFood.getPosition().x, (int16_t)game.explosiveFood.getPosition().y};
+            recorded.explosivePoints = game.explosiveFood.getPoints();
+            recorded.EncodeKeyframe(pending);
+        }
+        else
+        {
+            CellPos food = {(int16_t)game.food.position.x, (int16_t)game.food.position.y};
+            if (food.x != recorded.food.x || food.y != recorded.food.y)
+            {
+                uint8_t op[3] = {TEL_FOOD, (uint8_t)food.x, (uint8_t)food.y};
+                pending.insert(pending.end(), op, op + 3);
+            }
+            Vector2 explosive = game.explosiveFood.getPosition();
+            int points = game.explosiveFood.getPoints();
+            if (game.explosiveFood.isFoodActive() && (!recorded.explosiveActive || explosive.x != recorded.explosive.x || explosive.y != recorded.explosive.y))
+            {
+                uint8_t op[4] = {TEL_EXPLOSIVE, (uint8_t)explosive.x, (uint8_t)explosive.y, (uint8_t)points};
+                pending.insert(pending.end(), op, op + 4);
+            }
+            else if (game.explosiveFood.isFoodActive() && points != recorded.explosivePoints)
+            {
+                pending.push_back(TEL_EXPLOSIVE_POINTS);
+                pending.push_back((uint8_t)points);
+            }
+            else if (!game.explosiveFood.isFoodActive() && recorded.explosiveActive)
+            {
+                pending.push_back(TEL_EXPLOSIVE_GONE);
+            }
+            for (int i = 0; i < snakeCount; i++)
+            {
+                if (scores[i] == recorded.scores[i]) continue;
+                pending.push_back(TEL_SCORE);
+                pending.push_back((uint8_t)i);
+                WriteVarint(pending, (uint32_t)scores[i]);
+            }
+            // Only the ops after the moves still need applying to the mirror.
+            size_t moveOps = 0;
+            while (moveOps < pending.size() && pending[moveOps] < TEL_FOOD) moveOps++;
+            recorded.ApplyAll(pending.data() + moveOps, pending.size() - moveOps);
+        }
+
+        if (recorded.moves - lastChecksumMove >= (uint32_t)telemetryChecksumInterval)
+        {
+            lastChecksumMove = recorded.moves;
+            pending.push_back(TEL_CHECKSUM);
+            uint8_t checksum[4];
+            WriteU32(checksum, GameChecksum(snakes, scores, snakeCount, game.food.position));
+            pending.insert(pending.end(), checksum, checksum + 4);
+        }
+
+        if (pending.empty()) return;
+        // A full ring drops this tick; the next one re-syncs everyone with a keyframe.
+        needKeyframe = !ring.Push(pending.data(), pending.size());
+    }
+
+private:
+#ifndef _WIN32
+    struct Subscriber {
+        int fd;
+        vector<uint8_t> outgoing;
+    };
+
+    void Serve()
+    {
+        TelemetryBoard mirror;
+        vector<Subscriber> subscribers;
+        vector<uint8_t> fresh;
+        vector<uint8_t> keyframe;
+        uint8_t chunk[4096];
+
+        while (!stopping)
+        {
+            int fd;
+            while ((fd = accept(listenFd, nullptr, nullptr)) >= 0)
+            {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                keyframe.clear();
+                mirror.EncodeKeyframe(keyframe);
+                subscribers.push_back(Subscriber{fd, keyframe});
+            }
+
+            // Draining until empty always stops on a Push boundary, so fresh holds whole ops only.
+            size_t size;
+            fresh.clear();
+            while ((size = ring.Pop(chunk, sizeof(chunk))) > 0)
+            {
+                fresh.insert(fresh.end(), chunk, chunk + size);
+            }
+            bool idle = fresh.empty();
+            if (!idle)
+            {
+                mirror.Apply(fresh);
+                for (Subscriber& subscriber : subscribers)
+                {
+                    subscriber.outgoing.insert(subscriber.outgoing.end(), fresh.begin(), fresh.end());
+                }
+            }
+
+            for (size_t i = 0; i < subscribers.size();)
+            {
+                Subscriber& subscriber = subscribers[i];
+                ssize_t sent = subscriber.outgoing.empty() ? 0 : send(subscriber.fd, subscriber.outgoing.data(), subscriber.outgoing.size(), MSG_NOSIGNAL);
+                if (sent > 0) subscriber.outgoing.erase(subscriber.outgoing.begin(), subscriber.outgoing.begin() + sent);
+                bool dead = sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+                if (dead || subscriber.outgoing.size() > (1 << 20))
+                {
+                    close(subscriber.fd);
+                    subscribers.erase(subscribers.begin() + i);
+                    continue;
+                }
+                i++;
+            }
+            subscriberCount = (int)subscribers.size();
+
+            if (idle) this_thread::sleep_for(chrono::milliseconds(2));
+        }
+
+        for (Subscriber& subscriber : subscribers) close(subscriber.fd);
+    }
+#else
+    void Serve() {}
+#endif
+};
+
+// Headless test client: rebuilds the board from the stream and checks it against the checksums.
+// With recordPath it also keeps the raw stream, which --export-video plays back.
+int RunSpectator(const char* host, int port, const char* recordPath)
+{
+#ifndef _WIN32
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.sin_family = AF_INET;
+    remote.sin_port = htons((uint16_t)port);
+    if (fd < 0 || inet_pton(AF_INET, host, &remote.sin_addr) != 1 || connect(fd, (sockaddr*)&remote, sizeof(remote)) < 0)
+    {
+        printf("Error: could not connect to %s:%d\n", host, port);
+        return 1;
+    }
+    FILE* record = recordPath ? fopen(recordPath, "wb") : NULL;
+    if (recordPath && record == NULL)
+    {
+        printf("Error: Could not open %s for writing\n", recordPath);
+        close(fd);
+        return 1;
+    }
+
+    TelemetryBoard board;
+    vector<uint8_t> stream;
+    uint8_t chunk[4096];
+    size_t totalBytes = 0;
+    ssize_t size;
+    while ((size = recv(fd, chunk, sizeof(chunk), 0)) > 0)
+    {
+        totalBytes += size;
+        if (record) fwrite(chunk, 1, size, record);
+        stream.insert(stream.end(), chunk, chunk + size);
+        size_t at = 0, used;
+        while (at < stream.size() && (used = board.Apply(stream.data() + at, stream.size() - at)) > 0)
+        {
+            if (stream[at] == TEL_CHECKSUM)
+            {
+                printf("moves %u  length %zu  score %d  %.2f bytes/move  checksum failures %u\n", board.moves,
+                       board.bodies[0].size(), board.scores[0], board.moves ? (double)totalBytes / board.moves : 0.0, board.checksumFailures);
+            }
+            at += used;
+        }
+        stream.erase(stream.begin(), stream.begin() + at);
+    }
+    close(fd);
+    if (record) fclose(record);
+    return board.checksumFailures ? 1 : 0;
+#else
+    (void)host; (void)port; (void)recordPath;
+    printf("Error: the spectator client is only supported on POSIX builds\n");
+    return 1;
+#endif
+}
+
+// --- InputQueue Class ---
+// Turns are read in press order every frame, stamped, and queued (up to inputQueueSize) so two
+// quick presses inside one tick both land on consecutive ticks. Each queued turn is validated
+// against the one before it, and again against Snake::direction when it is applied.
+const int inputQueueSize = 3;
+
+class InputQueue {
+private:
+    int codes[inputQueueSize];
+    double stamps[inputQueueSize];
+    int count = 0;
+    double appliedStamp = -1;
+
+public:
+    double lastLatencyMs = 0;
+    double averageLatencyMs = 0;
+
+    static int KeyToCode(int key)
+    {
+        switch (key) {
+            case KEY_UP: return 0;
+            case KEY_DOWN: return 1;
+            case KEY_LEFT: return 2;
+            case KEY_RIGHT: return 3;
+            default: return -1;
+        }
+    }
+
+    static int DirectionToCode(Vector2 direction)
+    {
+        return direction.y < 0 ? 0 : direction.y > 0 ? 1 : direction.x < 0 ? 2 : 3;
+    }
+
+    void Poll(Vector2 currentDirection)
+    {
+        double now = GetTime();
+        int key;
+        while ((key = GetKeyPressed()) != 0) Push(KeyToCode(key), now, currentDirection);
+    }
+
+    void Push(int code, double stamp, Vector2 currentDirection)
+    {
+        int last = count > 0 ? codes[count - 1] : DirectionToCode(currentDirection);
+        if (code < 0 || code == last || code == (last ^ 1) || count == inputQueueSize) return;
+        codes[count] = code;
+        stamps[count] = stamp;
+        count++;
+    }
+
+    // Pops the next turn that is still legal for direction; returns its code or -1.
+    int Pop(Vector2 direction)
+    {
+        int current = DirectionToCode(direction);
+        while (count > 0)
+        {
+            int code = codes[0];
+            double stamp = stamps[0];
+            count--;
+            for (int i = 0; i < count; i++)
+            {
+                codes[i] = codes[i + 1];
+                stamps[i] = stamps[i + 1];
+            }
+            if (code != current && code != (current ^ 1))
+            {
+                appliedStamp = stamp;
+                return code;
+            }
+        }
+        return -1;
+    }
+
+    bool Apply(Snake& snake)
+    {
+        int code = Pop(snake.direction);
+        if (code < 0) return false;
+        snake.direction = Vector2{(float)kernelDx[code], (float)kernelDy[code]};
+        return true;
+    }
+
+    double AppliedStamp() const { return appliedStamp; }
+
+    // With SimThread the turn is applied on the other thread; this marks it for FramePresented.
+    void TurnShown(double stamp) { appliedStamp = stamp; }
+
+    // Call after EndDrawing: the first frame that shows an applied turn closes its latency sample.
+    void FramePresented(AnalyticsLog* analytics)
+    {
+        if (appliedStamp < 0) return;
+        lastLatencyMs = (GetTime() - appliedStamp) * 1000.0;
+        averageLatencyMs = averageLatencyMs == 0 ? lastLatencyMs : averageLatencyMs * 0.9 + lastLatencyMs * 0.1;
+        if (analytics) analytics->Log(EVENT_INPUT, (int)(lastLatencyMs * 1000.0));
+        appliedStamp = -1;
+    }
+
+    void Clear()
+    {
+        count = 0;
+        appliedStamp = -1;
+    }
+};
+
+// --- QualityGovernor Class ---
+// Keeps slow cabinets at frame rate (on by default for PLATFORM_RPI, --quality auto elsewhere).
+// When frames keep running over budget, it lowers renderQuality one step at a time:
+// - fewer rounded-corner segments and single-colour titles
+// - the board drawn into a 3/4 size render texture and stretched back up
+// - a 1/2 size texture with square cells
+// It steps back up once the work between BeginDrawing and EndDrawing leaves clear headroom. Frame pacing and the
+// GPU's share are hidden inside EndDrawing, so stepping down uses the whole frame interval.
+// A step up that is undone within a few seconds doubles the wait before the next try.
+// Ticks run on SimThread against the clock, so quality changes never change game speed.
+class QualityGovernor {
+public:
+    bool enabled = false;
+    double budget = 1.0 / 60.0;
+
+    static const char* Name(int quality)
+    {
+        static const char* names[] = {"full", "lean", "scaled", "lowest"};
+        return names[quality];
+    }
+
+    // Fraction of the window size the board render texture uses at this quality.
+    static float BoardScale(int quality)
+    {
+        return quality >= QUALITY_LOWEST ? 0.5f : (quality >= QUALITY_SCALED ? 0.75f : 1.0f);
+    }
+
+    // frameSeconds is the time since the last frame; workSeconds the time from BeginDrawing to EndDrawing.
+    // Returns true when renderQuality changed.
+    bool Update(double frameSeconds, double workSeconds)
+    {
+        if (!enabled) return false;
+        // A single long frame (loading, hot reload) should not drag quality down on its own.
+        frameAverage += (min(frameSeconds, 4 * budget) - frameAverage) * 0.1;
+        workAverage += (min(workSeconds, 4 * budget) - workAverage) * 0.1;
+        sinceChange += frameSeconds;
+        sinceStepUp += frameSeconds;
+
+        if (sinceChange >= 1.0 && frameAverage > budget * 1.2 && renderQuality < QUALITY_LOWEST)
+        {
+            if (sinceStepUp < 5.0) upWait = min(upWait * 2, 60.0);
+            return Set(renderQuality + 1);
+        }
+        if (sinceChange >= upWait && frameAverage < budget * 1.05 && workAverage < budget * 0.4 && renderQuality > QUALITY_FULL)
+        {
+            sinceStepUp = 0;
+            return Set(renderQuality - 1);
+        }
+        if (sinceStepUp > 30.0) upWait = 3.0;
+        return false;
+    }
+
+    // Fixed quality from the command line; the governor stays off.
+    void Force(int quality)
+    {
+        enabled = false;
+        Set(max((int)QUALITY_FULL, min((int)QUALITY_LOWEST, quality)));
+    }
+
+private:
+    double frameAverage = 1.0 / 60.0;
+    double workAverage = 0.0;
+    double sinceChange = 0.0;
+    double sinceStepUp = 1e9;
+    double upWait = 3.0;
+
+    bool Set(int quality)
+    {
+        if (quality == renderQuality) return false;
+        renderQuality = quality;
+        sinceChange = 0;
+        frameAverage = budget;
+        workAverage = 0;
+        printf("Quality: %s (board at %d%%)\n", Name(quality), (int)(BoardScale(quality) * 100 + 0.5f));
+        return true;
+    }
+};
+
+// --- BoardRenderer Class ---
+// Keeps the single-player GAME screen in a render target. A tick only changes the head, the tail
+// and the food, so only those cells are repainted; the score strip is repainted when a score
+// changes. Anything that is not a one-step move (reset, rewind, new map) repaints everything.
+// The explosive food counts down every frame, so it is drawn on top as an overlay instead.
+enum CellContent : uint8_t { CONTENT_EMPTY, CONTENT_WALL, CONTENT_SNAKE, CONTENT_FOOD };
+
+class BoardRenderer {
+public:
+    int cellsRepainted = 0;   // last frame
+
+    void Load(int screenWidth, int screenHeight, float boardScale = 1.0f)
+    {
+        width = screenWidth;
+        height = screenHeight;
+        scale = boardScale;
+        target = LoadRenderTextureTracked((int)ceilf(width * scale), (int)ceilf(height * scale), "BoardRenderer");
+        if (scale < 1.0f) SetTextureFilter(target.texture, TEXTURE_FILTER_BILINEAR);
+        valid = false;
+    }
+
+    // Redraws at a new quality; the target is reallocated only when its size changes.
+    void SetQuality(int quality)
+    {
+        float boardScale = QualityGovernor::BoardScale(quality);
+        if (boardScale != scale)
+        {
+            Unload();
+            Load(width, height, boardScale);
+        }
+        valid = false;
+    }
+
+    void Unload() { UnloadRenderTextureTracked(target, "BoardRenderer"); }
+
+    void Invalidate() { valid = false; }
+
+    // drawChrome paints the border and title once; drawScores paints the strip below the board.
+    template <class Chrome, class Scores>
+    void Draw(Game& game, Chrome drawChrome, Scores drawScores)
+    {
+        const SnakeBody& body = game.snake.body;
+        int head = CellOf(body.front()), tail = CellOf(body.back()), food = CellOf(game.food.position);
+        bool scoresChanged = game.score != lastScore || game.highestscore != lastHighest;
+        bool stepped = valid && game.running && game.tick == lastTick + 1 && game.mapGeneration == lastMapGeneration && body.size() >= 2 &&
+                       CellOf(body[1]) == lastHead && (body.size() == lastLength || (body.size() == lastLength + 1 && tail == lastTail));
+        cellsRepainted = 0;
+
+        if (!valid || (!stepped && (game.tick != lastTick || head != lastHead || food != lastFood || game.mapGeneration != lastMapGeneration)))
+        {
+            BeginBoard();
+            ClearBackground(green);
+            drawChrome();
+            drawScores();
+            for (int cell = 0; cell < cellCount * cellCount; cell++)
+            {
+                bool wall = game.hardMap && game.hardMap->CheckCollision(CellCorner(cell));
+                Paint(game, cell, wall ? CONTENT_WALL : (cell == food ? CONTENT_FOOD : CONTENT_EMPTY));
+            }
+            for (const Vector2& segment : body)
+            {
+                int cell = CellOf(segment);
+                if (cell >= 0) Paint(game, cell, CONTENT_SNAKE);
+            }
+            EndBoard();
+            valid = true;
+        }
+        else if (stepped || scoresChanged)
+        {
+            BeginBoard();
+            if (stepped)
+            {
+                int dirty[4] = {head, lastTail, lastFood, food};
+                for (int cell : dirty)
+                {
+                    if (cell < 0) continue;
+                    if (cell == head || cell == tail) Paint(game, cell, CONTENT_SNAKE);
+                    else if (cell == food) Paint(game, cell, CONTENT_FOOD);
+                    else Paint(game, cell, game.hardMap && game.hardMap->CheckCollision(CellCorner(cell)) ? CONTENT_WALL : CONTENT_EMPTY);
+                }
+            }
+            if (scoresChanged)
+            {
+                float stripTop = (float)(offset + cellSize * cellCount + 6);
+                DrawRectangleRec(Rectangle{0, stripTop, (float)width, height - stripTop}, green);
+                drawScores();
+            }
+            EndBoard();
+        }
+
+        lastTick = game.tick;
+        lastHead = head;
+        lastTail = tail;
+        lastLength = body.size();
+        lastFood = food;
+        lastScore = game.score;
+        lastHighest = game.highestscore;
+        lastMapGeneration = game.mapGeneration;
+
+        Rectangle source = {0, 0, (float)target.texture.width, -(float)target.texture.height};
+        DrawTexturePro(target.texture, source, Rectangle{0, 0, target.texture.width / scale, target.texture.height / scale}, Vector2{0, 0}, 0, WHITE);
+        game.explosiveFood.Draw();
+        if (dangerHints) DrawTrapHints(game);
+    }
+
+private:
+    RenderTexture2D target;
+    int width = 0, height = 0;
+    float scale = 1.0f;
+    bool valid = false;
+    unsigned int lastTick = 0;
+    unsigned int lastMapGeneration = 0;
+    int lastHead = -1, lastTail = -1, lastFood = -1;
+    size_t lastLength = 0;
+    int lastScore = -1, lastHighest = -1;
+
+    // Board drawing keeps window coordinates; a smaller target is zoomed out to match.
+    void BeginBoard()
+    {
+        BeginTextureMode(target);
+        if (scale != 1.0f) BeginMode2D(Camera2D{Vector2{0, 0}, Vector2{0, 0}, 0, scale});
+    }
+
+    void EndBoard()
+    {
+        if (scale != 1.0f) EndMode2D();
+        EndTextureMode();
+    }
+
+    static int CellOf(Vector2 position)
+    {
+        if (position.x < 0 || position.y < 0 || position.x >= cellCount || position.y >= cellCount) return -1;
+        return (int)position.y * cellCount + (int)position.x;
+    }
+
+    static Vector2 CellCorner(int cell)
+    {
+        return Vector2{(float)(offset + cell % cellCount * cellSize), (float)(offset + cell / cellCount * cellSize)};
+    }
+
+    // Outlines the free cells next to the head that lead into a dead end.
+    static void DrawTrapHints(const Game& game)
+    {
+        for (int dir = 0; dir < 4; dir++)
+        {
+            if (!(game.trapMoves & (1 << dir))) continue;
+            Vector2 next = Game::NextCell(game.snake.body[0], dir);
+            Rectangle rect = {offset + next.x * cellSize, offset + next.y * cellSize, (float)cellSize, (float)cellSize};
+            DrawRectangleLinesEx(rect, 3, RED);
+        }
+    }
+
+    void Paint(const Game& game, int cell, CellContent content)
+    {
+        Vector2 corner = CellCorner(cell);
+        Rectangle rect = {corner.x, corner.y, (float)cellSize, (float)cellSize};
+        DrawRectangleRec(rect, content == CONTENT_WALL ? SKYBLUE : green);
+        if (content == CONTENT_SNAKE) DrawRounded(rect, 0.5, 6, game.snake.color);
+        else if (content == CONTENT_FOOD) DrawTexture(game.food.texture, (int)corner.x, (int)corner.y, WHITE);
+        cellsRepainted++;
+    }
+};
+
+// --- Hot Reload ---
+// snake.cfg holds "key = value" tuning lines and Maps/hard.map one "x y width height" wall per line,
+// in cells. Both are read once at startup. With --watch a background thread also watches them and
+// Graphics/ and Sounds/ (inotify on Linux, mtime polling elsewhere). It parses or decodes whatever
+// changed into a back buffer, and the frame thread swaps buffers between ticks with a try_lock, so
+// it never waits on the disk or a decoder. Only texture upload and sound buffer creation run there.
+const char* tuningFileName = "snake.cfg";
+const char* hardMapFileName = "Maps/hard.map";
+const char* foodImageFileName = "Graphics/food.png";
+
+struct Tuning {
+    int cellSize, cellCount, offset;
+    double easySpeed, hardSpeed;
+    int explosiveDuration, explosiveBasePoints, explosiveEvery;
+};
+
+Tuning CurrentTuning()
+{
+    return Tuning{cellSize, cellCount, offset, easySpeed, hardSpeed, explosiveDuration, explosiveBasePoints, explosiveEvery};
+}
+
+bool ReadTextFile(const char* path, string& text)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+    text.clear();
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) text.append(buffer, count);
+    fclose(file);
+    return true;
+}
+
+// Calls visit(line, lineNumber) for every line with its '#' comment stripped; blank lines skipped.
+template <class Visit>
+void ForEachConfigLine(const string& text, Visit visit)
+{
+    size_t start = 0;
+    for (int lineNumber = 1; start < text.size(); lineNumber++)
+    {
+        size_t end = text.find('\n', start);
+        if (end == string::npos) end = text.size();
+        string line = text.substr(start, end - start);
+        start = end + 1;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") != string::npos) visit(line, lineNumber);
+    }
+}
+
+// Keys missing from the file keep the value tuning already has; bad lines are reported and skipped.
+bool ParseTuning(const string& text, Tuning& tuning)
+{
+    bool ok = true;
+    ForEachConfigLine(text, [&](const string& line, int lineNumber) {
+        char name[64];
+        double value;
+        if (sscanf(line.c_str(), " %63[A-Za-z] = %lf", name, &value) != 2)
+        {
+            printf("Error: %s:%d: expected key = value\n", tuningFileName, lineNumber);
+            ok = false;
+            return;
+        }
+        string key = name;
+        auto is = [&](const char* candidate, double minimum, double maximum) { return key == candidate && value >= minimum && value <= maximum; };
+        if (is("cellSize", 4, 100)) tuning.cellSize = (int)value;
+        else if (is("cellCount", 10, maxCellCount)) tuning.cellCount = (int)value;
+        else if (is("offset", 0, 400)) tuning.offset = (int)value;
+        else if (is("easySpeed", 0.01, 2)) tuning.easySpeed = value;
+        else if (is("hardSpeed", 0.01, 2)) tuning.hardSpeed = value;
+        else if (is("explosiveDuration", 1, 60)) tuning.explosiveDuration = (int)value;
+        else if (is("explosiveBasePoints", 1, 255)) tuning.explosiveBasePoints = (int)value;   // saves and telemetry keep points in a byte
+        else if (is("explosiveEvery", 1, 1000)) tuning.explosiveEvery = (int)value;
+        else
+        {
+            printf("Error: %s:%d: unknown key or value out of range: %s\n", tuningFileName, lineNumber, name);
+            ok = false;
+        }
+    });
+    return ok;
+}
+
+bool ParseWalls(const string& text, vector<Rectangle>& walls)
+{
+    bool ok = true;
+    walls.clear();
+    ForEachConfigLine(text, [&](const string& line, int lineNumber) {
+        Rectangle wall;
+        if (sscanf(line.c_str(), " %f %f %f %f", &wall.x, &wall.y, &wall.width, &wall.height) != 4 || wall.width <= 0 || wall.height <= 0)
+        {
+            printf("Error: %s:%d: expected x y width height\n", hardMapFileName, lineNumber);
+            ok = false;
+            return;
+        }
+        walls.push_back(wall);
+    });
+    return ok;
+}
+
+void ApplyTuning(const Tuning& tuning)
+{
+    easySpeed = tuning.easySpeed;
+    hardSpeed = tuning.hardSpeed;
+    explosiveDuration = tuning.explosiveDuration;
+    explosiveBasePoints = tuning.explosiveBasePoints;
+    explosiveEvery = tuning.explosiveEvery;
+    gameSpeed = isHardMode ? hardSpeed : easySpeed;
+}
+
+// Startup: the board geometry can only change here, before the window is sized from it.
+void LoadConfigFiles(const Tuning& defaults)
+{
+    string text;
+    Tuning tuning = defaults;
+    if (ReadTextFile(tuningFileName, text) && ParseTuning(text, tuning))
+    {
+        cellSize = tuning.cellSize;
+        cellCount = tuning.cellCount;
+        offset = tuning.offset;
+        ApplyTuning(tuning);
+    }
+    vector<Rectangle> walls;
+    if (ReadTextFile(hardMapFileName, text) && ParseWalls(text, walls)) hardModeWalls = walls;
+}
+
+// One swap's worth of changes. Images and waves are already decoded.
+struct ReloadBatch {
+    bool hasTuning = false;
+    Tuning tuning;
+    bool hasWalls = false;
+    vector<Rectangle> walls;
+    bool hasFoodImage = false;
+    Image foodImage;
+    Wave waves[SOUND_COUNT];
+    uint32_t waveMask = 0;      // SoundId bits with a decoded wave
+    uint32_t reopenMask = 0;    // music SoundId bits to reopen
+
+    bool Empty() const { return !hasTuning && !hasWalls && !hasFoodImage && !waveMask && !reopenMask; }
+
+    // Newer changes replace older ones that were not swapped in yet.
+    void Merge(ReloadBatch& newer)
+    {
+        if (newer.hasTuning) { tuning = newer.tuning; hasTuning = true; }
+        if (newer.hasWalls) { walls.swap(newer.walls); hasWalls = true; }
+        if (newer.hasFoodImage)
+        {
+            if (hasFoodImage) UnloadImage(foodImage);
+            foodImage = newer.foodImage;
+            hasFoodImage = true;
+            newer.hasFoodImage = false;
+        }
+        for (int id = 0; id < SOUND_COUNT; id++)
+        {
+            if (!((newer.waveMask >> id) & 1)) continue;
+            if ((waveMask >> id) & 1) UnloadWave(waves[id]);
+            waves[id] = newer.waves[id];
+            waveMask |= 1u << id;
+        }
+        newer.waveMask = 0;
+        reopenMask |= newer.reopenMask;
+    }
+
+    void Clear()
+    {
+        if (hasFoodImage) UnloadImage(foodImage);
+        for (int id = 0; id < SOUND_COUNT; id++)
+        {
+            if ((waveMask >> id) & 1) UnloadWave(waves[id]);
+        }
+        *this = ReloadBatch();
+    }
+};
+
+class HotReloader {
+private:
+    Tuning defaults;
+    mutex lock;
+    ReloadBatch back;       // written by the watcher under lock
+    ReloadBatch front;      // frame thread only
+    atomic<bool> ready{false};
+    atomic<bool> stopping{false};
+    thread worker;
+
+public:
+    int reloads = 0;
+
+    explicit HotReloader(const Tuning& defaults) : defaults(defaults) {}
+
+    ~HotReloader()
+    {
+        stopping = true;
+        if (worker.joinable()) worker.join();
+        back.Clear();
+        front.Clear();
+    }
+
+    void Start() { worker = thread(&HotReloader::Run, this); }
+
+    bool Ready() const { return ready.load(memory_order_acquire); }
+
+    // Frame thread, between ticks. If the watcher is publishing right now the swap waits a frame.
+    void Apply(Game& game, BoardRenderer& renderer, bool lockstep)
+    {
+        if (!ready.load(memory_order_acquire) || !lock.try_lock()) return;
+        swap(front, back);
+        ready = false;
+        lock.unlock();
+
+        if ((front.hasTuning || front.hasWalls) && lockstep)
+        {
+            printf("Hot reload: tuning and map changes are ignored during a network game\n");
+            front.hasTuning = front.hasWalls = false;
+        }
+        if (front.hasTuning)
+        {
+            if (front.tuning.cellSize != cellSize || front.tuning.cellCount != cellCount || front.tuning.offset != offset)
+            {
+                printf("Hot reload: cellSize, cellCount and offset take effect after a restart\n");
+            }
+            ApplyTuning(front.tuning);
+        }
+        if (front.hasWalls)
+        {
+            hardModeWalls = front.walls;
+            game.ReloadHardModeWalls();
+        }
+        if (front.hasFoodImage)
+        {
+            game.food.ReplaceTexture(front.foodImage);
+            renderer.Invalidate();
+        }
+        for (int id = 0; id < SOUND_COUNT; id++)
+        {
+            if ((front.waveMask >> id) & 1) game.audio.Replace((SoundId)id, front.waves[id]);
+            if ((front.reopenMask >> id) & 1) game.audio.Reopen((SoundId)id);
+        }
+        front.Clear();
+        reloads++;
+    }
+
+private:
+    static bool Watched(const string& path)
+    {
+        return path == tuningFileName || path == hardMapFileName || path == foodImageFileName || AudioMixer::IdForPath(path) >= 0;
+    }
+
+    // Watcher thread: reads, parses and decodes one changed file, then publishes it.
+    void Load(const string& path)
+    {
+        ReloadBatch batch;
+        string text;
+        if (path == tuningFileName)
+        {
+            batch.tuning = defaults;
+            batch.hasTuning = ReadTextFile(tuningFileName, text) && ParseTuning(text, batch.tuning);
+        }
+        else if (path == hardMapFileName)
+        {
+            batch.hasWalls = ReadTextFile(hardMapFileName, text) && ParseWalls(text, batch.walls);
+        }
+        else if (path == foodImageFileName)
+        {
+            batch.foodImage = LoadImage(foodImageFileName);
+            batch.hasFoodImage = batch.foodImage.data != NULL;
+        }
+        else
+        {
+            int id = AudioMixer::IdForPath(path);
+            if (soundTable[id].category == CATEGORY_MUSIC) batch.reopenMask = 1u << id;
+            else
+            {
+                batch.waves[id] = LoadWave(path.c_str());
+                if (batch.waves[id].data != NULL) batch.waveMask = 1u << id;
+            }
+        }
+        if (batch.Empty()) return;
+        printf("Hot reload: %s\n", path.c_str());
+        lock_guard<mutex> guard(lock);
+        back.Merge(batch);
+        ready.store(true, memory_order_release);
+    }
+
+#ifdef __linux__
+    // Editors often write a file in several steps, so changes are collected until 50 ms pass quietly.
+    void Run()
+    {
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+        {
+            printf("Error: inotify is unavailable, hot reload is off\n");
+            return;
+        }
+        const char* directories[] = {".", "Maps", "Graphics", "Sounds"};
+        vector<string> watchDirectories;
+        for (const char* directory : directories)
+        {
+            int watch = inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (watch < 0) continue;
+            if ((int)watchDirectories.size() <= watch) watchDirectories.resize(watch + 1);
+            watchDirectories[watch] = strcmp(directory, ".") == 0 ? "" : string(directory) + "/";
+        }
+        alignas(inotify_event) char buffer[4096];
+        vector<string> changed;
+        while (!stopping)
+        {
+            pollfd entry = {fd, POLLIN, 0};
+            int timeout = changed.empty() ? 200 : 50;
+            if (poll(&entry, 1, timeout) > 0)
+            {
+                ssize_t size;
+                while ((size = read(fd, buffer, sizeof(buffer))) > 0)
+                {
+                    for (char* at = buffer; at < buffer + size; at += sizeof(inotify_event) + ((inotify_event*)at)->len)
+                    {
+                        inotify_event* event = (inotify_event*)at;
+                        if (event->len == 0 || event->wd < 0 || event->wd >= (int)watchDirectories.size()) continue;
+                        string path = watchDirectories[event->wd] + event->name;
+                        if (Watched(path) && find(changed.begin(), changed.end(), path) == changed.end()) changed.push_back(path);
+                    }
+                }
+                continue;
+            }
+            for (const string& path : changed) Load(path);
+            changed.clear();
+        }
+        close(fd);
+    }
+#else
+    void Run()
+    {
+        vector<string> paths = {tuningFileName, hardMapFileName, foodImageFileName};
+        for (int id = 0; id < SOUND_COUNT; id++) paths.push_back(soundTable[id].path);
+        vector<time_t> modified(paths.size(), 0);
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            struct stat info;
+            if (stat(paths[i].c_str(), &info) == 0) modified[i] = info.st_mtime;
+        }
+        while (!stopping)
+        {
+            this_thread::sleep_for(chrono::milliseconds(250));
+            for (size_t i = 0; i < paths.size(); i++)
+            {
+                struct stat info;
+                if (stat(paths[i].c_str(), &info) != 0 || info.st_mtime == modified[i]) continue;
+                modified[i] = info.st_mtime;
+                Load(paths[i]);
+            }
+        }
+    }
+#endif
+};
+
+// --- Replay Export ---
+// Offline video for recorded telemetry streams (game --spectate <host> <port> <file>). The frames
+// are rebuilt from the stream and drawn by a small software rasterizer to look like the game
+// screen: border and title, HardModeMap walls, snakes, food, explosive food and the score strip.
+// No window or GPU is needed. A frame only depends on its own tick, so frames are rendered in
+// batches on every core and written out in order. Output is raw RGB24 (a file, a FIFO or stdout
+// for a video encoder) or a numbered PPM sequence.
+const char softFontChars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ:.-/";
+
+// 5x7 glyphs in softFontChars order, one row per byte with bit 4 the leftmost pixel.
+const uint8_t softFont[][7] = {
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+    {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+    {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+    {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, {0x01, 0x01, 0x02, 0x04, 0x08, 0x10, 0x10},
+};
+
+// RGB24 canvas with the handful of primitives the game screen uses. Text follows raylib's default
+// font metrics (glyphs on a 10 px grid scaled to the font size); lowercase is drawn in capitals.
+class SoftCanvas {
+public:
+    int width = 0, height = 0;
+    vector<uint8_t> pixels;
+
+    void Resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        pixels.assign((size_t)w * h * 3, 0);
+    }
+
+    void FillRect(int x, int y, int w, int h, Color color)
+    {
+        int x0 = max(0, x), y0 = max(0, y), x1 = min(width, x + w), y1 = min(height, y + h);
+        for (int py = y0; py < y1; py++) FillSpan(x0, x1, py, color);
+    }
+
+    // Same shape as DrawRectangleRounded: corner radius is roundness * half the shorter side.
+    void FillRounded(float x, float y, float w, float h, float roundness, Color color)
+    {
+        float radius = roundness * min(w, h) / 2;
+        int y0 = max(0, (int)ceilf(y - 0.5f)), y1 = min(height, (int)ceilf(y + h - 0.5f));
+        for (int py = y0; py < y1; py++)
+        {
+            float center = py + 0.5f, inset = 0;
+            float dy = center < y + radius ? y + radius - center : center > y + h - radius ? center - (y + h - radius) : 0;
+            if (dy > 0) inset = radius - sqrtf(max(0.0f, radius * radius - dy * dy));
+            int x0 = max(0, (int)ceilf(x + inset - 0.5f)), x1 = min(width, (int)ceilf(x + w - inset - 0.5f));
+            FillSpan(x0, x1, py, color);
+        }
+    }
+
+    void RectLines(int x, int y, int w, int h, int thickness, Color color)
+    {
+        FillRect(x, y, w, thickness, color);
+        FillRect(x, y + h - thickness, w, thickness, color);
+        FillRect(x, y + thickness, thickness, h - 2 * thickness, color);
+        FillRect(x + w - thickness, y + thickness, thickness, h - 2 * thickness, color);
+    }
+
+    static int MeasureText(const char* text, int fontSize)
+    {
+        int scale = max(1, fontSize / 10);
+        return (int)strlen(text) * 6 * scale - scale;
+    }
+
+    void Text(const char* text, int x, int y, int fontSize, Color color)
+    {
+        int scale = max(1, fontSize / 10);
+        for (; *text; text++, x += 6 * scale)
+        {
+            const char* found = strchr(softFontChars, toupper((unsigned char)*text));
+            if (*text == ' ' || found == NULL) continue;
+            const uint8_t* glyph = softFont[found - softFontChars];
+            for (int row = 0; row < 7; row++)
+            {
+                for (int column = 0; column < 5; column++)
+                {
+                    if (glyph[row] & (0x10 >> column)) FillRect(x + column * scale, y + (row + 1) * scale, scale, scale, color);
+                }
+            }
+        }
+    }
+
+    // Alpha-blends an R8G8B8A8 image at its own size, like DrawTexture with WHITE.
+    void Blit(const Image& image, int x, int y)
+    {
+        const uint8_t* source = (const uint8_t*)image.data;
+        for (int row = 0; row < image.height; row++)
+        {
+            if (y + row < 0 || y + row >= height) continue;
+            for (int column = 0; column < image.width; column++)
+            {
+                if (x + column < 0 || x + column >= width) continue;
+                const uint8_t* texel = source + ((size_t)row * image.width + column) * 4;
+                uint8_t* pixel = &pixels[((size_t)(y + row) * width + x + column) * 3];
+                for (int c = 0; c < 3; c++) pixel[c] = (uint8_t)((texel[c] * texel[3] + pixel[c] * (255 - texel[3]) + 127) / 255);
+            }
+        }
+    }
+
+private:
+    void FillSpan(int x0, int x1, int y, Color color)
+    {
+        uint8_t* pixel = &pixels[((size_t)y * width + x0) * 3];
+        if (color.a == 255)
+        {
+            for (int x = x0; x < x1; x++, pixel += 3)
+            {
+                pixel[0] = color.r;
+                pixel[1] = color.g;
+                pixel[2] = color.b;
+            }
+            return;
+        }
+        for (int x = x0; x < x1; x++, pixel += 3)
+        {
+            pixel[0] = (uint8_t)((color.r * color.a + pixel[0] * (255 - color.a) + 127) / 255);
+            pixel[1] = (uint8_t)((color.g * color.a + pixel[1] * (255 - color.a) + 127) / 255);
+            pixel[2] = (uint8_t)((color.b * color.a + pixel[2] * (255 - color.a) + 127) / 255);
+        }
     }
+};
 
-    void eat() {
-        isActive = false;
+// Board state at one tick, copied out of the decoder so the frame can be rendered on any thread.
+struct ReplayFrame {
+    vector<CellPos> bodies[2];
+    int snakeCount = 0;
+    CellPos food = {0, 0};
+    bool explosiveActive = false;
+    CellPos explosive = {0, 0};
+    int explosivePoints = 0;
+    int32_t scores[2] = {0, 0};
+    int32_t highest = 0;      // best score so far in the replay, shown as "Highest Score"
+
+    void Capture(const TelemetryBoard& board, int32_t highestScore)
+    {
+        snakeCount = board.snakeCount;
+        for (int i = 0; i < 2; i++)
+        {
+            bodies[i].assign(board.bodies[i].begin(), board.bodies[i].end());
+            scores[i] = board.scores[i];
+        }
+        food = board.food;
+        explosiveActive = board.explosiveActive;
+        explosive = board.explosive;
+        explosivePoints = board.explosivePoints;
+        highest = highestScore;
     }
 };
 
-// --- Snake Class ---
-class Snake
-{
+class ReplayExporter {
 public:
-    deque<Vector2> body = {Vector2{6, 9}, Vector2{5, 9}, Vector2{4, 9}};
-    Vector2 direction = {1, 0};
-    bool addSegment = false;
+    int width, height;
 
-    void Draw()
+    ReplayExporter(bool hardMap)
     {
-        for (unsigned int i = 0; i < body.size(); i++)
+        width = height = 2 * offset + cellSize * cellCount;
+        background.Resize(width, height);
+        background.FillRect(0, 0, width, height, green);
+        background.RectLines(offset - 5, offset - 5, cellSize * cellCount + 10, cellSize * cellCount + 10, 5, darkGreen);
+        const char* title = "RETRO SNAKE";
+        for (int i = 0, x = offset - 5; title[i]; i++)
+        {
+            char letter[2] = {title[i], '\0'};
+            background.Text(letter, x, 20, 40, titleColors[i % numTitleColors]);
+            x += SoftCanvas::MeasureText(letter, 40);
+        }
+        for (const Rectangle& wall : hardMap ? hardModeWalls : vector<Rectangle>())
         {
-            float x = body[i].x;
-            float y = body[i].y;
-            Rectangle segment = Rectangle{offset + x * cellSize, offset + y * cellSize, (float)cellSize, (float)cellSize};
-            DrawRectangleRounded(segment, 0.5, 6, darkGreen);
+            background.FillRect(offset + (int)wall.x * cellSize, offset + (int)wall.y * cellSize, (int)wall.width * cellSize, (int)wall.height * cellSize, SKYBLUE);
         }
+        food = LoadImage(foodImageFileName);
+        if (food.data != NULL) ImageFormat(&food, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
     }
 
-    void Update()
+    ~ReplayExporter() { UnloadImage(food); }
+
+    void Render(const ReplayFrame& frame, SoftCanvas& canvas) const
     {
-        body.push_front(Vector2Add(body[0], direction));
-        if (addSegment == true)
+        canvas = background;
+        char text[64];   // TextFormat's buffers are shared, and frames render on several threads
+        int bottom = offset + cellSize * cellCount;
+        if (frame.snakeCount > 1)
         {
-            addSegment = false;
+            snprintf(text, sizeof(text), "P1: %i   P2: %i", frame.scores[0], frame.scores[1]);
+            canvas.Text(text, offset - 5, bottom + 10, 40, darkGreen);
         }
         else
         {
-            body.pop_back();
+            snprintf(text, sizeof(text), "Score: %i", frame.scores[0]);
+            canvas.Text(text, offset - 5, bottom + 10, 40, darkGreen);
+            snprintf(text, sizeof(text), "Highest Score: %i", frame.highest);
+            canvas.Text(text, width - SoftCanvas::MeasureText(text, 40) - 10, bottom + 30, 40, darkGreen);
+        }
+        if (food.data != NULL) canvas.Blit(food, offset + frame.food.x * cellSize, offset + frame.food.y * cellSize);
+        else canvas.FillRect(offset + frame.food.x * cellSize, offset + frame.food.y * cellSize, cellSize, cellSize, explosiveFoodColor);
+        Color colors[2] = {darkGreen, (Color){0, 82, 172, 255}};
+        for (int i = 0; i < frame.snakeCount; i++)
+        {
+            for (const CellPos& cell : frame.bodies[i])
+            {
+                canvas.FillRounded((float)(offset + cell.x * cellSize), (float)(offset + cell.y * cellSize), (float)cellSize, (float)cellSize, 0.5f, colors[i]);
+            }
+        }
+        if (frame.explosiveActive)
+        {
+            int x = offset + frame.explosive.x * cellSize, y = offset + frame.explosive.y * cellSize;
+            canvas.FillRounded((float)x, (float)y, (float)cellSize, (float)cellSize, 0.5f, explosiveFoodColor);
+            snprintf(text, sizeof(text), "%i", frame.explosivePoints);
+            canvas.Text(text, x + cellSize / 2 - SoftCanvas::MeasureText(text, 20) / 2, y - 20, 20, WHITE);
         }
     }
 
-    void Reset()
+private:
+    SoftCanvas background;
+    Image food;
+};
+
+// game --export-video <replay> <out> [--hard] [--fps n] [--speed seconds] [--threads n]
+// out is "-" for raw RGB24 on stdout, a name containing % for a PPM sequence (frames/%06d.ppm),
+// or any other path for raw RGB24. Progress goes to stderr so stdout can carry the video.
+int ExportReplay(int argc, char** argv)
+{
+    const char* replayPath = argv[0];
+    const char* outPath = argv[1];
+    bool hardMap = false;
+    double fps = 30, speed = easySpeed;
+    int threads = max(1, (int)thread::hardware_concurrency());
+    for (int i = 2; i < argc; i++)
     {
-        body = {Vector2{6, 9}, Vector2{5, 9}, Vector2{4, 9}};
-        direction = {1, 0};
+        string option = argv[i];
+        if (option == "--hard") hardMap = true;
+        else if (option == "--fps" && i + 1 < argc) fps = atof(argv[++i]);
+        else if (option == "--speed" && i + 1 < argc) speed = atof(argv[++i]);
+        else if (option == "--threads" && i + 1 < argc) threads = max(1, atoi(argv[++i]));
+        else
+        {
+            fprintf(stderr, "Error: bad export option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    string stream;
+    if (!ReadTextFile(replayPath, stream))
+    {
+        fprintf(stderr, "Error: Could not open %s\n", replayPath);
+        return 1;
+    }
+    bool sequence = strchr(outPath, '%') != NULL;
+    FILE* out = strcmp(outPath, "-") == 0 ? stdout : sequence ? NULL : fopen(outPath, "wb");
+    if (!sequence && out == NULL)
+    {
+        fprintf(stderr, "Error: Could not open %s for writing\n", outPath);
+        return 1;
+    }
+
+    ReplayExporter exporter(hardMap);
+    int repeat = max(1, (int)lround(fps * speed));     // frames per tick at the requested frame rate
+    const int batchSize = threads * 4;
+    vector<ReplayFrame> frames(batchSize);
+    vector<SoftCanvas> canvases(batchSize);
+    TelemetryBoard board;
+    int32_t highest = 0;
+    int pending = 0;
+    long written = 0, ticks = 0;
+    bool movedSinceFrame = false, ok = true;
+    double start = NowSeconds();
+
+    auto flush = [&]() {
+        atomic<int> next{0};
+        auto work = [&]() {
+            int index;
+            while ((index = next++) < pending) exporter.Render(frames[index], canvases[index]);
+        };
+        vector<thread> workers;
+        for (int i = 1; i < min(threads, pending); i++) workers.emplace_back(work);
+        work();
+        for (auto& worker : workers) worker.join();
+        for (int i = 0; i < pending && ok; i++)
+        {
+            for (int copy = 0; copy < repeat && ok; copy++)
+            {
+                FILE* file = out;
+                if (sequence)
+                {
+                    char name[512];
+                    snprintf(name, sizeof(name), outPath, (int)written);
+                    file = fopen(name, "wb");
+                    if (file == NULL)
+                    {
+                        fprintf(stderr, "Error: Could not open %s for writing\n", name);
+                        ok = false;
+                        break;
+                    }
+                    fprintf(file, "P6\n%d %d\n255\n", exporter.width, exporter.height);
+                }
+                ok = fwrite(canvases[i].pixels.data(), 1, canvases[i].pixels.size(), file) == canvases[i].pixels.size();
+                if (sequence) ok = fclose(file) == 0 && ok;
+                written++;
+            }
+        }
+        pending = 0;
+    };
+
+    // A frame is taken before each tick's first move, so it shows the whole tick before it.
+    size_t at = 0, used;
+    while (ok && at < stream.size())
+    {
+        uint8_t op = (uint8_t)stream[at];
+        if (op < TEL_FOOD && ((op >> 3) & 1) == 0 && movedSinceFrame)
+        {
+            frames[pending++].Capture(board, highest);
+            movedSinceFrame = false;
+            ticks++;
+            if (pending == batchSize) flush();
+        }
+        if ((used = board.Apply((const uint8_t*)stream.data() + at, stream.size() - at)) == 0) break;
+        at += used;
+        if (op < TEL_FOOD) movedSinceFrame = true;
+        for (int i = 0; i < board.snakeCount; i++) highest = max(highest, board.scores[i]);
+    }
+    if (ok && board.snakeCount > 0)
+    {
+        frames[pending++].Capture(board, highest);
+        ticks++;
+        flush();
+    }
+    if (out != NULL && out != stdout) ok = fclose(out) == 0 && ok;
+    else if (out == stdout) fflush(stdout);
+    double seconds = NowSeconds() - start;
+    fprintf(stderr, "Export: %ld ticks, %ld frames of %dx%d in %.2f s (%.0f frames/s, %.0fx real time at %.0f fps)%s\n", ticks, written,
+            exporter.width, exporter.height, seconds, written / max(seconds, 1e-9), written / fps / max(seconds, 1e-9), fps,
+            ok ? "" : ", write failed");
+    return ok ? 0 : 1;
+}
+
+// --- AllocationCheck ---
+// --alloc-check counts frame-thread heap allocations in every gameplay tick (step, save encode,
+// rewind ring) and every gameplay frame, prints the totals on exit and fails if any were seen.
+struct AllocationCheck {
+    bool enabled = false;
+    long ticks = 0, frames = 0;
+    long allocatingTicks = 0, allocatingFrames = 0;
+    uint64_t tickStart = 0, frameStart = 0;
+    bool gameplayFrame = false;
+
+    void BeginFrame(bool gameplay)
+    {
+        gameplayFrame = gameplay;
+        frameStart = heapAllocations;
+    }
+
+    void EndFrame()
+    {
+        if (!enabled || !gameplayFrame) return;
+        frames++;
+        allocatingFrames += heapAllocations != frameStart;
+    }
+
+    void BeginTick() { tickStart = heapAllocations; }
+
+    void EndTick()
+    {
+        if (!enabled) return;
+        ticks++;
+        allocatingTicks += heapAllocations != tickStart;
+    }
+
+    int Report() const
+    {
+        if (!enabled) return 0;
+        printf("Allocation check: %ld of %ld gameplay ticks and %ld of %ld gameplay frames allocated\n", allocatingTicks, ticks, allocatingFrames, frames);
+        return allocatingTicks || allocatingFrames ? 1 : 0;
     }
 };
 
-// --- Game Class ---
-class Game
+// --- Ghost Replay ---
+// A finished single-player round kept as a ghost to race. The file holds the save state of the
+// round's first tick, so a race starts on the same map, food and RNG, and then one telemetry move
+// op per tick. GhostRecorder builds it on SimThread, and the best round per mode is kept in
+// bestrun_easy.ghost and bestrun_hard.ghost. A Ghost plays one back: a reader thread streams the
+// moves from disk into a small ring, so memory is the same for a run of any length and the
+// frame thread only pops bytes that are already there.
+//
+// File: magic, version, board size, score, ticks and save size (u32 each), the save, the moves.
+const uint32_t ghostMagic = 0x48475053;   // "SPGH"
+const uint32_t ghostVersion = 1;
+const int ghostHeaderBytes = 24;
+const size_t maxGhostTicks = 1 << 18;
+const uint8_t ghostRestartMarker = 0xFF;  // reader to frame thread: the moves start over; a generation byte follows
+const char* const ghostBestFileNames[2] = {"bestrun_easy.ghost", "bestrun_hard.ghost"};
+
+CellPos HeadCell(const Snake& snake)
+{
+    return CellPos{(int16_t)snake.body[0].x, (int16_t)snake.body[0].y};
+}
+
+// Telemetry move op for the step between two heads; -1 if it was not a single step.
+int GhostMove(CellPos from, CellPos to, bool grew, bool wraps)
 {
+    int dx = to.x - from.x, dy = to.y - from.y;
+    if (wraps && abs(dx) > 1) dx = dx > 0 ? -1 : 1;
+    if (wraps && abs(dy) > 1) dy = dy > 0 ? -1 : 1;
+    for (int dir = 0; dir < 4; dir++)
+    {
+        if (telemetryDirections[dir].x == dx && telemetryDirections[dir].y == dy) return TEL_MOVE | dir | (grew ? 4 : 0);
+    }
+    return -1;
+}
+
+// Begin() runs on the frame thread before SimThread starts the round; Record() runs on SimThread
+// after every tick. The move buffer is reserved up front, so recording never allocates.
+class GhostRecorder {
 public:
-    Snake snake = Snake();
-    Food food;
-    ExplosiveFood explosiveFood;
-    HardModeMap* hardMap = nullptr;
-    bool running = false;
-    int score = 0;
-    int highestscore = 0;
-    int foodEatenCount = 0;
-    Sound eatSound;
-    Sound wallSound;
-    Sound selectSound;
-    Sound menuMoveSound;
-    Sound gameStartSound;
-    Sound gameOverSound;
-    Sound menuenterSound;
-    Sound menuEnterEzSound;
-    Sound menuEnterHardSound;
-    Sound explosiveEatSound;
-    bool gameovermenu = false;
+    GhostRecorder() { moves.reserve(maxGhostTicks); }
 
-    Game() : food(snake.body, nullptr), explosiveFood(nullptr)
+    void Begin(const Game& game)
     {
-        InitAudioDevice();
-        eatSound = LoadSound("Sounds/eat.mp3");
-        wallSound = LoadSound("Sounds/wall.mp3");
-        selectSound = LoadSound("Sounds/select.mp3");
-        menuMoveSound = LoadSound("Sounds/menumove.mp3");
-        gameStartSound = LoadSound("Sounds/gamestart.mp3");
-        gameOverSound = LoadSound("Sounds/gameover.mp3");
-        menuenterSound = LoadSound("Sounds/menuenter.mp3");
-        menuEnterEzSound = LoadSound("Sounds/menuenterEz.mp3");
-        menuEnterHardSound = LoadSound("Sounds/menuenterHard.mp3");
-        explosiveEatSound = LoadSound("Sounds/explosive_eat.mp3");
-        highestscore = loadhighestscore();
+        startSize = EncodeGame(game, startSave);
+        startTick = game.tick;
+        hardMode = isHardMode;
+        wraps = wrapEdges;
+        moves.clear();
+        lastHead = HeadCell(game.snake);
+        lastLength = game.snake.body.size();
+        recording = startSize > 0;
+        finished = false;
     }
 
-    ~Game()
+    // rewound: sim was just restored to an earlier tick instead of stepping.
+    void Record(const Game& sim, bool rewound)
     {
-        UnloadSound(eatSound);
-        UnloadSound(wallSound);
-        UnloadSound(selectSound);
-        UnloadSound(menuMoveSound);
-        UnloadSound(gameStartSound);
-        UnloadSound(gameOverSound);
-        UnloadSound(menuenterSound);
-        UnloadSound(menuEnterEzSound);
-        UnloadSound(menuEnterHardSound); 
-        UnloadSound(explosiveEatSound);
-        if (hardMap) delete hardMap;
-        CloseAudioDevice();
+        if (!recording) return;
+        if (rewound)
+        {
+            if (sim.tick < startTick || sim.tick - startTick > moves.size())
+            {
+                recording = false;
+                return;
+            }
+            moves.resize(sim.tick - startTick);
+        }
+        else if (sim.gameovermenu)
+        {
+            recording = false;
+            finished = true;
+            score = sim.score;
+            return;
+        }
+        else
+        {
+            int move = -1;
+            if (sim.tick - startTick == moves.size() + 1 && moves.size() < maxGhostTicks)
+            {
+                move = GhostMove(lastHead, HeadCell(sim.snake), sim.snake.body.size() > lastLength, wraps);
+            }
+            if (move < 0)
+            {
+                recording = false;
+                return;
+            }
+            moves.push_back((uint8_t)move);
+        }
+        lastHead = HeadCell(sim.snake);
+        lastLength = sim.snake.body.size();
     }
 
-    void InitializeHardMode()
+    bool Finished() const { return finished; }
+    int Score() const { return score; }
+    bool HardMode() const { return hardMode; }
+    size_t Ticks() const { return moves.size(); }
+
+    // Written to a temporary file and renamed, so a ghost on disk is always whole.
+    bool Write(const char* path) const
     {
-        if (!hardMap) {
-            hardMap = new HardModeMap(cellSize);
+        string tempName = string(path) + ".tmp";
+        FILE* file = fopen(tempName.c_str(), "wb");
+        if (file == NULL)
+        {
+            printf("Error: Could not open %s for writing\n", tempName.c_str());
+            return false;
         }
-        food.map = hardMap;
-        explosiveFood.map = hardMap;
-        food.position = food.GenerateRandomPos(snake.body);
-        explosiveFood.eat();
+        uint8_t header[ghostHeaderBytes];
+        uint32_t fields[6] = {ghostMagic, ghostVersion, (uint32_t)cellCount, (uint32_t)score, (uint32_t)moves.size(), (uint32_t)startSize};
+        for (int i = 0; i < 6; i++) WriteU32(header + 4 * i, fields[i]);
+        bool written = fwrite(header, 1, ghostHeaderBytes, file) == (size_t)ghostHeaderBytes &&
+                       fwrite(startSave, 1, startSize, file) == (size_t)startSize &&
+                       fwrite(moves.data(), 1, moves.size(), file) == moves.size();
+        written = fclose(file) == 0 && written;
+        if (!written) return false;
+#ifdef _WIN32
+        remove(path);
+#endif
+        return rename(tempName.c_str(), path) == 0;
     }
 
-    void DisableHardMode()
+private:
+    uint8_t startSave[maxSaveBytes];
+    int startSize = 0;
+    unsigned int startTick = 0;
+    vector<uint8_t> moves;
+    CellPos lastHead = {0, 0};
+    size_t lastLength = 0;
+    bool hardMode = false;
+    bool wraps = false;
+    bool recording = false;
+    bool finished = false;
+    int score = 0;
+};
+
+class Ghost {
+public:
+    string path;
+    bool best = false;            // one of the bestrun files; reopened when a new best replaces it
+    bool hardMode = false;
+    bool racing = false;          // on the current round's map
+    GameState start;
+    vector<uint8_t> startSave;
+    int score = 0;
+    uint32_t ticks = 0;
+
+    ~Ghost() { Close(); }
+
+    bool Open(const char* filePath)
     {
-        if (hardMap) {
-            delete hardMap;
-            hardMap = nullptr;
+        path = filePath;
+        file = fopen(filePath, "rb");
+        if (file == NULL)
+        {
+            printf("Error: Could not open %s\n", filePath);
+            return false;
         }
-        food.map = nullptr;
-        explosiveFood.map = nullptr;
-        food.position = food.GenerateRandomPos(snake.body);
-        explosiveFood.eat();
+        uint8_t header[ghostHeaderBytes];
+        uint32_t saveSize = 0;
+        bool valid = fread(header, 1, ghostHeaderBytes, file) == (size_t)ghostHeaderBytes && ReadU32(header) == ghostMagic &&
+                     ReadU32(header + 4) == ghostVersion && ReadU32(header + 8) == (uint32_t)cellCount &&
+                     (saveSize = ReadU32(header + 20)) <= (uint32_t)maxSaveBytes;
+        if (valid)
+        {
+            startSave.resize(saveSize);
+            valid = fread(startSave.data(), 1, saveSize, file) == saveSize && DecodeSave(startSave.data(), (int)saveSize, start, hardMode);
+        }
+        if (!valid)
+        {
+            printf("Error: %s is not a ghost for this board\n", filePath);
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+        score = (int)ReadU32(header + 12);
+        ticks = ReadU32(header + 16);
+        movesOffset = ghostHeaderBytes + (long)saveSize;
+        Restart(0);
+        reader = thread(&Ghost::Run, this);
+        return true;
     }
 
-    void Draw()
+    void Close()
     {
-        if (hardMap) hardMap->Draw();
-        food.Draw();
-        explosiveFood.Draw();
-        snake.Draw();
+        stopping = true;
+        if (reader.joinable()) reader.join();
+        stopping = false;
+        if (file) fclose(file);
+        file = NULL;
     }
 
-    int loadhighestscore()
+    // Round starting at game tick roundStart: back to the first position, stream from the top.
+    void Restart(unsigned int roundStart)
     {
-        FILE* file = fopen("highestscore.txt", "r");
-        if (file != NULL)
+        startTick = roundStart;
+        applied = 0;
+        first = 0;
+        length = min((int)start.snakes[0].length, maxSnakeCells);
+        for (int i = 0; i < length; i++) body[i] = start.snakes[0].body[i];
+        wanted++;
+        stale = true;
+        generation.store(wanted, memory_order_release);
+    }
+
+    // Plays the moves up to the game's tick; whatever the reader has not delivered yet waits for a
+    // later frame. A tick earlier than the ghost's (rewind) starts it over.
+    void Advance(unsigned int tick)
+    {
+        if (tick < startTick) return;
+        uint32_t target = min(tick - startTick, ticks);
+        if (target < applied) Restart(startTick);
+        uint8_t op;
+        while (applied < target && ring.Pop(&op, 1) == 1)
         {
-            fscanf(file, "%d", &highestscore);
-            fclose(file);
+            if (op == ghostRestartMarker)
+            {
+                uint8_t markerGeneration = 0;
+                ring.Pop(&markerGeneration, 1);
+                if (markerGeneration == wanted) stale = false;
+            }
+            else if (!stale)
+            {
+                Step(op);
+            }
         }
-        else
+    }
+
+    // Hidden once the recorded round is over.
+    void Draw(Color color) const
+    {
+        if (applied >= ticks) return;
+        for (int i = 0; i < length; i++)
         {
-            file = fopen("highestscore.txt", "w");
-            if (file != NULL)
+            const CellPos& cell = body[(first + i) % maxSnakeCells];
+            Snake::DrawSegment(cell.x, cell.y, color);
+        }
+    }
+
+private:
+    FILE* file = NULL;
+    long movesOffset = 0;
+    thread reader;
+    atomic<bool> stopping{false};
+    atomic<uint8_t> generation{0};   // frame thread asks for a restart by bumping it
+    SpscRing<uint8_t, 4096> ring;
+    uint8_t wanted = 0;
+    bool stale = true;               // skipping moves from before the last restart
+    unsigned int startTick = 0;
+    uint32_t applied = 0;
+    CellPos body[maxSnakeCells];     // ring; body[first] is the head
+    int first = 0, length = 0;
+
+    void Step(uint8_t op)
+    {
+        const CellPos& head = body[first];
+        CellPos next = {(int16_t)(head.x + telemetryDirections[op & 3].x), (int16_t)(head.y + telemetryDirections[op & 3].y)};
+        if (start.wrapEdges) next = CellPos{(int16_t)((next.x + cellCount) % cellCount), (int16_t)((next.y + cellCount) % cellCount)};
+        first = (first + maxSnakeCells - 1) % maxSnakeCells;
+        body[first] = next;
+        if (op & 4) length = min(length + 1, maxSnakeCells);
+        applied++;
+    }
+
+    void Run()
+    {
+        uint8_t block[1024];
+        size_t blockSize = 0, at = 0;
+        uint32_t remaining = 0;
+        uint8_t served = 0;
+        bool markerPending = false;
+        while (!stopping)
+        {
+            uint8_t requested = generation.load(memory_order_acquire);
+            if (requested != served)
             {
-                fprintf(file, "%d", 0);
-                fclose(file);
+                served = requested;
+                fseek(file, movesOffset, SEEK_SET);
+                remaining = ticks;
+                blockSize = at = 0;
+                markerPending = true;
             }
-            highestscore = 0;
+            uint8_t marker[2] = {ghostRestartMarker, served};
+            if (markerPending && ring.Push(marker, 2)) markerPending = false;
+            if (!markerPending && at == blockSize && remaining > 0)
+            {
+                blockSize = fread(block, 1, min((uint32_t)sizeof(block), remaining), file);
+                at = 0;
+                remaining = blockSize > 0 ? remaining - (uint32_t)blockSize : 0;
+            }
+            size_t piece = min((size_t)64, blockSize - at);
+            if (!markerPending && piece > 0 && ring.Push(block + at, piece))
+            {
+                at += piece;
+                continue;
+            }
+            this_thread::sleep_for(chrono::milliseconds(2));
         }
-        return highestscore;
     }
+};
 
-    void savehighestscore()
+// The ghosts given on the command line, and the best round per mode.
+class GhostRace {
+public:
+    vector<unique_ptr<Ghost>> ghosts;
+    int bestScore[2] = {0, 0};
+
+    GhostRace()
     {
-        FILE* file = fopen("highestscore.txt", "w");
-        if (file != NULL)
+        for (int mode = 0; mode < 2; mode++)
         {
-            fprintf(file, "%d", highestscore);
+            FILE* file = fopen(ghostBestFileNames[mode], "rb");
+            if (file == NULL) continue;
+            uint8_t header[ghostHeaderBytes];
+            if (fread(header, 1, ghostHeaderBytes, file) == (size_t)ghostHeaderBytes && ReadU32(header) == ghostMagic) bestScore[mode] = (int)ReadU32(header + 12);
             fclose(file);
         }
-        else
+    }
+
+    // "best" races the best rounds on record, anything else is a ghost file.
+    void Add(const string& name)
+    {
+        if (name != "best")
         {
-            printf("Error: Could not open highestscore.txt for writing\n");
+            Open(name.c_str(), false);
+            return;
+        }
+        raceBest = true;
+        for (const char* bestFile : ghostBestFileNames)
+        {
+            FILE* file = fopen(bestFile, "rb");
+            if (file == NULL) continue;
+            fclose(file);
+            Open(bestFile, true);
         }
     }
 
-    void resetScores()
+    // After the usual round setup: a race switches to the first matching ghost's starting state,
+    // then every ghost on the same map starts with it. The round is recorded either way.
+    void StartRound(Game& game, GhostRecorder& recorder)
     {
-        score = 0;
-        highestscore = 0;
-        foodEatenCount = 0;
-        savehighestscore();
+        const Ghost* leader = nullptr;
+        for (const unique_ptr<Ghost>& ghost : ghosts)
+        {
+            ghost->racing = false;
+            if (!leader && ghost->hardMode == isHardMode) leader = ghost.get();
+        }
+        if (leader && LoadSave(game, leader->startSave.data(), (int)leader->startSave.size()))
+        {
+            for (const unique_ptr<Ghost>& ghost : ghosts)
+            {
+                const GameState& a = ghost->start;
+                const GameState& b = leader->start;
+                ghost->racing = ghost->hardMode == leader->hardMode && a.wrapEdges == b.wrapEdges &&
+                                (!ghost->hardMode || (a.mapStyle == b.mapStyle && (a.mapStyle == MAP_STYLE_FIXED || a.mapSeed == b.mapSeed)));
+                if (ghost->racing) ghost->Restart(game.tick);
+            }
+        }
+        recorder.Begin(game);
     }
 
-    void resetCurrentScore()
+    void Advance(unsigned int tick)
     {
-        score = 0;
-        foodEatenCount = 0;
+        for (const unique_ptr<Ghost>& ghost : ghosts)
+        {
+            if (ghost->racing) ghost->Advance(tick);
+        }
     }
 
-    void Update()
+    void Draw() const
     {
-        if (running)
+        for (size_t i = 0; i < ghosts.size(); i++)
         {
-            snake.Update();
-            explosiveFood.update();
-            CheckCollisionWithFood();
-            CheckCollisionWithExplosiveFood();
-            CheckCollisionWithEdges();
-            CheckCollisionWithTail();
+            if (ghosts[i]->racing) ghosts[i]->Draw(Fade(titleColors[(3 * i) % numTitleColors], 0.4f));
+        }
+    }
+
+    // Game over: a round that beats the best of its mode replaces the bestrun file.
+    void Finish(const GhostRecorder& recorder)
+    {
+        if (!recorder.Finished()) return;
+        int mode = recorder.HardMode() ? 1 : 0;
+        if (recorder.Score() <= bestScore[mode] || !recorder.Write(ghostBestFileNames[mode])) return;
+        bestScore[mode] = recorder.Score();
+        printf("Ghost: new best %s round, %d points in %zu ticks\n", mode ? "hard" : "easy", recorder.Score(), recorder.Ticks());
+        for (size_t i = 0; i < ghosts.size(); i++)
+        {
+            if (!ghosts[i]->best || ghosts[i]->path != ghostBestFileNames[mode]) continue;
+            ghosts[i].reset(new Ghost());
+            ghosts[i]->best = true;
+            if (!ghosts[i]->Open(ghostBestFileNames[mode])) ghosts.erase(ghosts.begin() + i);
+            return;
         }
+        if (raceBest) Open(ghostBestFileNames[mode], true);
+    }
+
+private:
+    bool raceBest = false;
+
+    void Open(const char* path, bool best)
+    {
+        unique_ptr<Ghost> ghost(new Ghost());
+        ghost->best = best;
+        if (ghost->Open(path)) ghosts.push_back(move(ghost));
+    }
+};
+
+// --- SimThread Class ---
+// Runs the local single-player game on its own thread at the exact tick rate: each deadline is the
+// previous one plus gameSpeed, not "whenever the frame loop noticed", so vsync waits and compositor
+// stalls no longer stretch ticks. Every tick publishes a SimFrame through a TripleBuffer; the frame
+// thread loads the newest one into its own Game and draws that. Turns go the other way through an
+// SPSC ring. The simulation copy of the game is only handed over between Stop() and Start().
+const int saveEveryTicks = 50;
+
+struct SimFrame {
+    GameState state;
+    int highestscore;
+    uint8_t trapMoves;
+    double turnStamp;    // GetTime() of the newest applied turn, -1 before the first
+};
+
+struct TurnInput {
+    int code;
+    double stamp;
+};
+
+class SimThread {
+public:
+    GhostRecorder ghost;        // like the game, only touched by the frame thread between Stop() and Start()
+
+private:
+    Game sim;
+    TripleBuffer<SimFrame> frames;
+    SpscRing<TurnInput, 64> turns;
+    InputQueue input;
+    SaveRing& saveRing;
+    SaveWriter& saveWriter;
+    AllocationCheck& allocationCheck;
+    DatasetRecorder* dataset;
+    atomic<bool> stopping{false};
+    atomic<bool> rewinding{false};
+    thread worker;
+    uint8_t saveBuffer[maxSaveBytes];
+    int ticksSinceSave = 0;
+    double turnStamp = -1;      // simulation thread
+    double shownStamp = -1;     // frame thread
+
+public:
+    SimThread(AudioMixer& mixer, AnalyticsLog* analytics, SaveRing& saveRing, SaveWriter& saveWriter, AllocationCheck& allocationCheck,
+              DatasetRecorder* dataset)
+        : sim(&mixer), saveRing(saveRing), saveWriter(saveWriter), allocationCheck(allocationCheck), dataset(dataset)
+    {
+        sim.analytics = analytics;
+    }
+
+    ~SimThread()
+    {
+        stopping = true;
+        if (worker.joinable()) worker.join();
+    }
+
+    bool Running() const { return worker.joinable(); }
+
+    void Start(Game& game)
+    {
+        sim.TakeOver(game);
+        TurnInput stale[64];
+        while (turns.Pop(stale, 64) > 0) {}
+        input.Clear();
+        Publish();
+        worker = thread(&SimThread::Run, this);
+    }
+
+    // Joins the thread and gives the game back to the frame thread's copy.
+    void Stop(Game& game)
+    {
+        if (!Running()) return;
+        stopping = true;
+        worker.join();
+        stopping = false;
+        game.TakeOver(sim);
+    }
+
+    void PushTurn(int code, double stamp)
+    {
+        TurnInput turn = {code, stamp};
+        turns.Push(&turn, 1);
+    }
+
+    void SetRewinding(bool held) { rewinding.store(held, memory_order_relaxed); }
+
+    void SetEffects(EffectRing* effects) { sim.effects = effects; }
+
+    // Frame thread: loads the newest tick into game; returns false if there is nothing new.
+    bool Present(Game& game, InputQueue& shown)
+    {
+        if (!frames.Acquire()) return false;
+        const SimFrame& frame = frames.Front();
+        game.LoadState(frame.state);
+        game.highestscore = frame.highestscore;
+        game.trapMoves = frame.trapMoves;
+        if (frame.turnStamp != shownStamp) shown.TurnShown(frame.turnStamp);
+        shownStamp = frame.turnStamp;
+        return true;
     }
 
-    void CheckCollisionWithFood()
+private:
+    // Sleeps in short slices so Stop() never waits long; after a stall of several ticks (a
+    // debugger, a suspended laptop) the clock resyncs instead of replaying the backlog at once.
+    void Run()
     {
-        if (Vector2Equals(snake.body[0], food.position))
+        double deadline = NowSeconds() + gameSpeed;
+        while (!stopping)
         {
-            food.position = food.GenerateRandomPos(snake.body);
-            snake.addSegment = true;
-            score++;
-            foodEatenCount++;
-            PlaySound(eatSound);
-            if (explosiveFood.shouldSpawn(foodEatenCount))
+            double now = NowSeconds();
+            if (now < deadline)
             {
-                explosiveFood.spawn(snake.body);
+                this_thread::sleep_for(chrono::duration<double>(min(deadline - now, 0.002)));
+                continue;
             }
+            deadline = now - deadline > 4 * gameSpeed ? now + gameSpeed : deadline + gameSpeed;
+            Tick();
+            Publish();
+            if (sim.gameovermenu) break;   // the frame thread shows the result and calls Stop()
         }
     }
 
-    void CheckCollisionWithExplosiveFood()
+    void Tick()
     {
-        if (explosiveFood.isFoodActive() && Vector2Equals(snake.body[0], explosiveFood.getPosition()))
+        TurnInput arrived[16];
+        size_t count;
+        while ((count = turns.Pop(arrived, 16)) > 0)
         {
-            score += explosiveFood.getPoints();
-            explosiveFood.eat();
-            snake.addSegment = true;
-            PlaySound(explosiveEatSound);
+            for (size_t i = 0; i < count; i++) input.Push(arrived[i].code, arrived[i].stamp, sim.snake.direction);
         }
-    }
 
-    void CheckCollisionWithEdges()
-    {
-        if (!isHardMode || !hardMap)
+        const uint8_t* rewindData;
+        int size;
+        if (rewinding.load(memory_order_relaxed) && saveRing.Rewind(rewindData, size))
         {
-            if (snake.body[0].x >= cellCount || snake.body[0].x < 0 ||
-                snake.body[0].y >= cellCount || snake.body[0].y < 0)
-            {
-                PlaySound(wallSound);
-                GameOver();
-            }
+            // Same round, so the map is already right and only the state is restored.
+            GameState state;
+            bool hardMode;
+            if (DecodeSave(rewindData, size, state, hardMode)) sim.LoadState(state);
+            ghost.Record(sim, true);
+            return;
         }
-        if (hardMap)
+
+        allocationCheck.BeginTick();
+        if (input.Apply(sim.snake)) turnStamp = input.AppliedStamp();
+        sim.Update();
+        ghost.Record(sim, false);
+        if (sim.gameovermenu)
         {
-            Rectangle snakeHead = {offset + snake.body[0].x * cellSize, offset + snake.body[0].y * cellSize, (float)cellSize, (float)cellSize};
-            if (hardMap->CheckCollisionWithRect(snakeHead)||snake.body[0].x >= cellCount || snake.body[0].x < 0 ||
-                snake.body[0].y >= cellCount || snake.body[0].y < 0)
-            {
-                PlaySound(wallSound);
-                GameOver();
-            }
+            saveRing.Clear();
+            saveWriter.Clear();
         }
-    }
-
-    void GameOver()
-    {
-        if (score > highestscore)
+        else if ((size = EncodeGame(sim, saveBuffer)) > 0)
         {
-            highestscore = score;
-            savehighestscore();
+            saveRing.Push(saveBuffer, size);
+            if (dataset) dataset->Push(saveBuffer, size);
+            if (++ticksSinceSave >= saveEveryTicks)
+            {
+                saveWriter.Request(saveBuffer, size);
+                ticksSinceSave = 0;
+            }
         }
-        snake.Reset();
-        food.position = food.GenerateRandomPos(snake.body);
-        explosiveFood.eat();
-        running = false;
-        gameovermenu = true;
-        PlaySound(gameOverSound);
+        allocationCheck.EndTick();
     }
 
-    void CheckCollisionWithTail()
+    void Publish()
     {
-        deque<Vector2> headlessBody = snake.body;
-        headlessBody.pop_front();
-        if (ElementInDeque(snake.body[0], headlessBody))
-        {
-            GameOver();
-        }
+        SimFrame& frame = frames.Back();
+        sim.SaveState(frame.state);
+        frame.highestscore = sim.highestscore;
+        frame.trapMoves = sim.trapMoves;
+        frame.turnStamp = turnStamp;
+        frames.Publish();
     }
 };
 
@@ -561,7 +9133,7 @@ public:
           isSelected(selected), isHovered(hovered) {}
 
     void Draw() {
-        DrawRectangleRounded(rect, 0.5, 6, (isHovered || isSelected) ? hoverColor : baseColor);
+        DrawRounded(rect, 0.5, 6, (isHovered || isSelected) ? hoverColor : baseColor);
         int textWidth = MeasureText(text.c_str(), 30);
         DrawText(text.c_str(), rect.x + rect.width / 2 - textWidth / 2, rect.y + rect.height / 2 - 15, 30, textColor);
     }
@@ -584,20 +9156,533 @@ public:
     bool IsHovered() const { return isHovered; }
 };
 
+// --- Screen Drawing ---
+// The fixed parts of the screens, shared by main() and --bench-render.
+void DrawMenuTitle(int screenWidth, int screenHeight)
+{
+    const char* titleText = "RETRO SNAKE";
+    int titleFontSize = 60;
+    int totalTextWidth = MeasureText(titleText, titleFontSize);
+    DrawTitle(titleText, screenWidth / 2 - totalTextWidth / 2, screenHeight / 4, titleFontSize);
+}
+
+void DrawMenuArt(int startY)
+{
+    const char* snakeAscii[] = {
+        "     ____ ",
+        " >-( __o )  23CVD",
+        "     / /      Nhóm 9        ~",
+        "   / //\\/\\/\\/\\",
+        "  (___/\\/\\/\\/\\"
+    };
+
+    int snakeFontSize = 30;
+    for (int i = 0; i < 5; i++)
+    {
+        DrawText(snakeAscii[i], offset, startY + i * (snakeFontSize + 2), snakeFontSize, darkGreen);
+    }
+}
+
+void DrawBoardChrome()
+{
+    DrawRectangleLinesEx(Rectangle{(float)offset - 5, (float)offset - 5, (float)cellSize * cellCount + 10, (float)cellSize * cellCount + 10}, 5, darkGreen);
+    DrawTitle("RETRO SNAKE", offset - 5, 20, 40);
+}
+
+void DrawScoreStrip(const Game& game)
+{
+    DrawText(TextFormat("Score: %i", game.score), offset - 5, offset + cellSize * cellCount + 10, 40, darkGreen);
+    int highestScoreTextWidth = MeasureText(TextFormat("Highest Score: %i", game.highestscore), 40);
+    int xPos = (2 * offset + cellSize * cellCount) - highestScoreTextWidth - 10;
+    DrawText(TextFormat("Highest Score: %i", game.highestscore), xPos, offset + cellSize * cellCount + 30, 40, darkGreen);
+}
+
+void DrawGameOverPanel(const Game& game, int panelX, int panelY, int panelWidth, int panelHeight)
+{
+    DrawRounded(Rectangle{(float)panelX, (float)panelY, (float)panelWidth, (float)panelHeight}, 0.2, 10, darkGreen);
+    DrawRectangleLinesEx(Rectangle{(float)panelX, (float)panelY, (float)panelWidth, (float)panelHeight}, 4, WHITE);
+    const char* overTitle = "GAME OVER";
+    if (game.versus)
+    {
+        overTitle = game.versusWinner == 2 ? "DRAW" : (game.versusWinner == 0 ? "P1 WINS" : "P2 WINS");
+    }
+    DrawText(overTitle, panelX + panelWidth / 2 - MeasureText(overTitle, 50) / 2, panelY + 40, 50, (Color){255, 0, 0, 255});
+
+    int scoreFontSize = 30;
+    int yourScoreY = panelY + 120;
+    int highestScoreY = panelY + 160;
+
+    const char* yourScoreStr = TextFormat("Your Score: %i", game.score);
+    const char* highestScoreStr = TextFormat("Highest Score: %i", game.highestscore);
+
+    DrawText(yourScoreStr, panelX + panelWidth / 2 - MeasureText(yourScoreStr, scoreFontSize) / 2, yourScoreY, scoreFontSize, WHITE);
+    DrawText(highestScoreStr, panelX + panelWidth / 2 - MeasureText(highestScoreStr, scoreFontSize) / 2, highestScoreY, scoreFontSize, WHITE);
+}
+
+// --- Render Benchmark ---
+// Scripted scenes drawn into an offscreen render texture for a number of frames, each through the
+// same drawing code the game uses. Frame times are what the CPU spends submitting a frame. Draw
+// calls, vertices and flushes per frame come from the null backend (make bench-render builds it).
+// In that build, any count more than the tolerance over the baseline file fails the run, and
+// --record writes a new baseline.
+enum RenderScene { SCENE_MENU, SCENE_LONG_SNAKE, SCENE_DENSE_MAZE, SCENE_GAME_OVER, SCENE_PARTICLES, SCENE_COUNT };
+const char* renderSceneNames[SCENE_COUNT] = {"menu", "long-snake", "dense-maze", "game-over", "particles"};
+const char* renderMetricNames[3] = {"draw calls", "vertices", "flushes"};
+
+struct RenderResult {
+    double frameMs = 0;
+    double worstMs = 0;
+    double counts[3] = {};    // per frame, in renderMetricNames order
+};
+
+void SetupRenderScene(RenderScene scene, Game& game)
+{
+    game.DisableHardMode();
+    game.snake.Reset();
+    game.explosiveFood.eat();
+    if (scene == SCENE_LONG_SNAKE)
+    {
+        // 600 cells back and forth across the board, head first.
+        game.snake.body.resize(0);
+        for (int i = 0; i < 600; i++)
+        {
+            int y = i / cellCount, x = i % cellCount;
+            game.snake.body.push_front(Vector2{(float)(y % 2 == 0 ? x : cellCount - 1 - x), (float)y});
+        }
+        game.food.position = game.food.GenerateRandomPos(game.snake.body);
+    }
+    else if (scene == SCENE_DENSE_MAZE)
+    {
+        game.UseProceduralMap(MAP_STYLE_MAZE, 1);
+        game.explosiveFood.spawn(game.snake.body, game.tick);
+    }
+}
+
+int BenchRender(int argc, char** argv)
+{
+    int frames = 300;
+    const char* baselinePath = "render_baseline.txt";
+    double tolerance = 10;
+    bool record = false;
+    for (int i = 0; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--baseline" && i + 1 < argc) baselinePath = argv[++i];
+        else if (arg == "--tolerance" && i + 1 < argc) tolerance = atof(argv[++i]);
+        else if (arg == "--record") record = true;
+        else if (isdigit((unsigned char)arg[0])) frames = max(1, atoi(argv[i]));
+    }
+
+    int screenWidth = 2 * offset + cellSize * cellCount;
+    int screenHeight = 2 * offset + cellSize * cellCount;
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    InitWindow(screenWidth, screenHeight, "Retro Snake render benchmark");
+    RenderTexture2D target = LoadRenderTextureTracked(screenWidth, screenHeight, "BenchRender");
+
+    AudioMixer mixer;
+    Game game(&mixer);
+    Image image = LoadImage("Graphics/food.png");
+    game.food.ReplaceTexture(image);
+    UnloadImage(image);
+    game.score = 123;
+    game.highestscore = 4567;
+    unique_ptr<ParticleSystem> particles(new ParticleSystem(7));
+    Rng cells(11);
+
+    // Same layout as main()'s menu and game over screens.
+    Color buttonColor = {145, 221, 60, 255}, buttonHover = {175, 251, 90, 255};
+    int mainStartY = screenHeight / 2 - (60 + 30) / 2;
+    Button playButton({(float)screenWidth / 2 - 125, (float)mainStartY, 250, 60}, "PLAY", buttonColor, buttonHover, darkGreen, true);
+    Button exitButton({(float)screenWidth / 2 - 125, (float)mainStartY + 90, 250, 60}, "EXIT", buttonColor, buttonHover, darkGreen);
+    int panelX = screenWidth / 2 - 250, panelY = screenHeight / 2 - 200;
+    Button retryButton({(float)panelX + 125, (float)panelY + 230, 250, 50}, "RETRY", buttonColor, buttonHover, darkGreen, true);
+    Button goMenuButton({(float)panelX + 125, (float)panelY + 300, 250, 50}, "MAIN MENU", buttonColor, buttonHover, darkGreen);
+
+    RenderResult results[SCENE_COUNT];
+    printf("%d frames per scene, %s\n", frames, renderCounting ? "counts from the null backend" : "no counts in a raylib build (make bench-render has them)");
+    printf("%-12s %9s %9s %11s %14s %13s\n", "scene", "ms/frame", "worst", "draws/frame", "vertices/frame", "flushes/frame");
+    for (int scene = 0; scene < SCENE_COUNT; scene++)
+    {
+        SetupRenderScene((RenderScene)scene, game);
+        RenderCounters before = renderCounters;
+        double total = 0, worst = 0;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            double start = NowSeconds();
+            BeginTextureMode(target);
+            ClearBackground(green);
+            switch (scene)
+            {
+                case SCENE_MENU:
+                    DrawMenuTitle(screenWidth, screenHeight);
+                    playButton.Draw();
+                    exitButton.Draw();
+                    DrawMenuArt(mainStartY + 90 + 60 + 20);
+                    break;
+                case SCENE_LONG_SNAKE:
+                case SCENE_DENSE_MAZE:
+                    DrawBoardChrome();
+                    DrawScoreStrip(game);
+                    game.Draw();
+                    break;
+                case SCENE_GAME_OVER:
+                    DrawGameOverPanel(game, panelX, panelY, 500, 400);
+                    retryButton.Draw();
+                    goMenuButton.Draw();
+                    break;
+                case SCENE_PARTICLES:
+                    while (particles->pool.count < 20000)
+                    {
+                        EffectEvent event = {EFFECT_EXPLOSION, (float)cells.Range(0, cellCount - 1), (float)cells.Range(0, cellCount - 1), explosiveFoodColor};
+                        particles->Spawn(event);
+                    }
+                    particles->Update(1 / 60.0f);
+                    DrawBoardChrome();
+                    particles->Draw();
+                    break;
+            }
+            EndTextureMode();
+            double seconds = NowSeconds() - start;
+            total += seconds;
+            worst = max(worst, seconds);
+        }
+        RenderResult& result = results[scene];
+        result.frameMs = total / frames * 1000;
+        result.worstMs = worst * 1000;
+        result.counts[0] = (double)(renderCounters.drawCalls - before.drawCalls) / frames;
+        result.counts[1] = (double)(renderCounters.vertices - before.vertices) / frames;
+        result.counts[2] = (double)(renderCounters.flushes - before.flushes) / frames;
+        if (!renderCounting) printf("%-12s %9.3f %9.3f %11s %14s %13s\n", renderSceneNames[scene], result.frameMs, result.worstMs, "-", "-", "-");
+        else printf("%-12s %9.3f %9.3f %11.1f %14.1f %13.1f\n", renderSceneNames[scene], result.frameMs, result.worstMs, result.counts[0],
+                    result.counts[1], result.counts[2]);
+    }
+
+    game.food.Unload();
+    UnloadRenderTextureTracked(target, "BenchRender");
+    resources.WindowClosed();
+    CloseWindow();
+    if (!renderCounting) return 0;
+
+    if (record)
+    {
+        FILE* file = fopen(baselinePath, "w");
+        if (!file)
+        {
+            printf("Error: Could not write %s\n", baselinePath);
+            return 1;
+        }
+        fprintf(file, "# scene draw-calls vertices flushes (per frame, null backend); written by --bench-render --record\n");
+        for (int scene = 0; scene < SCENE_COUNT; scene++)
+        {
+            fprintf(file, "%s %.1f %.1f %.1f\n", renderSceneNames[scene], results[scene].counts[0], results[scene].counts[1], results[scene].counts[2]);
+        }
+        fclose(file);
+        printf("Baseline written to %s\n", baselinePath);
+        return 0;
+    }
+
+    FILE* file = fopen(baselinePath, "r");
+    if (!file)
+    {
+        printf("No baseline at %s; rerun with --record to write one\n", baselinePath);
+        return 0;
+    }
+    int regressions = 0;
+    char line[256], name[64];
+    double baseline[3];
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#' || sscanf(line, "%63s %lf %lf %lf", name, &baseline[0], &baseline[1], &baseline[2]) != 4) continue;
+        for (int scene = 0; scene < SCENE_COUNT; scene++)
+        {
+            if (string(name) != renderSceneNames[scene]) continue;
+            for (int metric = 0; metric < 3; metric++)
+            {
+                double count = results[scene].counts[metric];
+                if (count > baseline[metric] * (1 + tolerance / 100) + 0.05)
+                {
+                    printf("Regression: %s %s %.1f per frame, baseline %.1f (+%.0f%% allowed)\n", name, renderMetricNames[metric], count,
+                           baseline[metric], tolerance);
+                    regressions++;
+                }
+                else if (count < baseline[metric] * (1 - tolerance / 100) - 0.05)
+                {
+                    printf("Improved: %s %s %.1f per frame, baseline %.1f; --record to lock it in\n", name, renderMetricNames[metric], count,
+                           baseline[metric]);
+                }
+            }
+        }
+    }
+    fclose(file);
+    printf("%s against %s\n", regressions ? "FAILED" : "OK", baselinePath);
+    return regressions ? 1 : 0;
+}
+
 // --- Main Function ---
-int main()
+// Usage: game                                            normal play
+//        game --net <player 0|1> <localPort> <peerHost> <peerPort> [seed]
+//        game --relay <port> [lossPercent] [latencyMs]
+//        game --spectate <host> <port> [file]             headless telemetry client; file keeps the stream as a replay
+//        game --bench-rules [ticks] [--analytics]         headless SimKernel throughput per rule set and a tick-by-tick check against Game::Update
+//        game --analytics-dump <file>                     print an analytics log
+//        game --bench-solver [size]                       Hamiltonian cycle build time and board fill check
+//        game --bench-reach [games]                       incremental region tracking cost and check; greedy vs careful autopilot
+//        game --attract                                   start in the solver demo (also shown after 30s idle on the menu)
+//        game --map <maze|caves|rooms> [--wrap]           HARD plays a new generated map each round; --wrap removes the edges
+//        game --hints                                     outline moves that lead into a pocket too small to get out of
+//        game --ghost <best|file>                         race a ghost on its round's map and seed; repeatable (best: bestrun_*.ghost)
+//        game --trail                                     particle trail behind the snake's head
+//        game --no-effects                                no particles for eating, wall hits and deaths
+//        game --quality <auto|full|lean|scaled|lowest>    auto lowers render quality while frames run over budget (default on PLATFORM_RPI)
+//        game --bench-maps [size]                         procedural map generation time
+//        game --bench-collide [boards]                    batched collision kernels vs the scalar game rules
+//        game --bench-particles [count]                   particle update cost per frame at a steady population
+//        game --bench-render [frames] [--baseline file] [--tolerance pct] [--record]
+//                                                         offscreen scene frame times; draw calls, vertices and flushes
+//                                                         with the null backend (make bench-render), failing on regressions
+//        game --tournament <file> [--maps easy,hard,portal,maze,caves,rooms] [--strategies greedy,solver,random,careful]
+//                  [--seeds n] [--seed s] [--ticks cap] [--threads n] [--shard i/n]
+//                                                         headless sweep; rerun the same command to resume
+//        game --tournament-report <file>...               score distribution per map/strategy and head-to-head wins
+//        game --export-video <replay> <out|-> [--hard] [--fps n] [--speed s] [--threads n]
+//                                                         render a --spectate recording to raw RGB24 or a PPM sequence
+//        game --bench-env [envs] [threads] [easy|hard|portal] RL environment step rate and observation check
+//        game --env-serve <name> <envs> [rules] [threads]  RL environment in shared memory /dev/shm/<name>
+//        game --env-client <name> [seconds]               random-action trainer stand-in for --env-serve
+//        game --dataset-build <file> [games] [easy|hard|portal] record greedy games as a position dataset and check it reads back
+//        game --dataset-show <file> <position>            print one recorded position
+//        game --dataset <file>                            append every single-player tick to a position dataset
+//        game --watch                                     reload snake.cfg, Maps/hard.map, Graphics/ and Sounds/ on change
+//        game --resources                                 live texture/sound counts, RSS and GPU memory on screen; warn on growth
+//        game --alloc-check                               report heap allocations during gameplay ticks and frames; exit 1 if any
+//        any of the above (except the headless ones) plus --telemetry <port>
+int main(int argc, char** argv)
 {
+    if (argc >= 3 && string(argv[1]) == "--relay")
+    {
+        return RunRelay(atoi(argv[2]), argc >= 4 ? atoi(argv[3]) : 0, argc >= 5 ? atoi(argv[4]) : 0);
+    }
+    if (argc >= 4 && string(argv[1]) == "--spectate")
+    {
+        return RunSpectator(argv[2], atoi(argv[3]), argc >= 5 ? argv[4] : nullptr);
+    }
+    if (argc >= 3 && string(argv[1]) == "--analytics-dump")
+    {
+        return DumpAnalytics(argv[2]);
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-rules")
+    {
+        long ticks = argc >= 3 ? atol(argv[2]) : 5000000;
+        unique_ptr<AnalyticsLog> log(argc >= 4 && string(argv[3]) == "--analytics" ? new AnalyticsLog() : nullptr);
+        BenchRules<EasyRules>("easy", ticks, 3, log.get());
+        BenchRules<HardRules>("hard", ticks, 4, log.get());
+        BenchRules<PortalRules>("portal", ticks, 5, log.get());
+        bool match = CheckRulesAgainstGame<EasyRules>("easy", 100, false, false);
+        match = CheckRulesAgainstGame<HardRules>("hard", 100, true, false) && match;
+        match = CheckRulesAgainstGame<PortalRules>("portal", 100, false, true) && match;
+        return match ? 0 : 1;
+    }
+    if (argc >= 3 && string(argv[1]) == "--tournament")
+    {
+        return RunTournament(argc - 2, argv + 2);
+    }
+    if (argc >= 3 && string(argv[1]) == "--tournament-report")
+    {
+        return TournamentReport(argc - 2, argv + 2);
+    }
+    if (argc >= 4 && string(argv[1]) == "--export-video")
+    {
+        return ExportReplay(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-env")
+    {
+        int envs = argc >= 3 ? atoi(argv[2]) : 4096;
+        int threads = argc >= 4 ? atoi(argv[3]) : max(1, (int)thread::hardware_concurrency());
+        BenchEnv(envs, threads, argc >= 5 ? argv[4] : "easy");
+        return 0;
+    }
+    if (argc >= 4 && string(argv[1]) == "--env-serve")
+    {
+        return RunEnvServer(argv[2], atoi(argv[3]), argc >= 5 ? argv[4] : "easy",
+                            argc >= 6 ? atoi(argv[5]) : max(1, (int)thread::hardware_concurrency()));
+    }
+    if (argc >= 3 && string(argv[1]) == "--env-client")
+    {
+        return RunEnvClient(argv[2], argc >= 4 ? atof(argv[3]) : 5.0);
+    }
+    if (argc >= 3 && string(argv[1]) == "--dataset-build")
+    {
+        int games = argc >= 4 ? atoi(argv[3]) : 1000;
+        string rules = argc >= 5 ? argv[4] : "easy";
+        if (rules == "hard") return BuildDataset<HardRules>(argv[2], games, true);
+        if (rules == "portal") return BuildDataset<PortalRules>(argv[2], games, false);
+        return BuildDataset<EasyRules>(argv[2], games, false);
+    }
+    if (argc >= 4 && string(argv[1]) == "--dataset-show")
+    {
+        return ShowDatasetPosition(argv[2], strtoull(argv[3], nullptr, 10));
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-collide")
+    {
+        BenchCollide(argc >= 3 ? atoi(argv[2]) : 4096);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-render")
+    {
+        return BenchRender(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-particles")
+    {
+        BenchParticles(argc >= 3 ? atoi(argv[2]) : 30000);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-maps")
+    {
+        BenchMaps(argc >= 3 ? atoi(argv[2]) : 512);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-reach")
+    {
+        BenchReach(argc >= 3 ? atoi(argv[2]) : 300);
+        return 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--bench-solver")
+    {
+        BenchSolver(argc >= 3 ? atoi(argv[2]) : 256);
+        return 0;
+    }
+
+    Tuning defaultTuning = CurrentTuning();
+    LoadConfigFiles(defaultTuning);
     int screenWidth = 2 * offset + cellSize * cellCount;
     int screenHeight = 2 * offset + cellSize * cellCount;
 
     InitWindow(screenWidth, screenHeight, "Retro Snake");
     SetExitKey(KEY_NULL);
     SetTargetFPS(60);
+    QualityGovernor governor;
+#if defined(PLATFORM_RPI)
+    governor.enabled = true;
+#endif
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (string(argv[i]) != "--quality") continue;
+        governor.enabled = string(argv[i + 1]) == "auto";
+        for (int quality = QUALITY_FULL; quality <= QUALITY_LOWEST; quality++)
+        {
+            if (string(argv[i + 1]) == QualityGovernor::Name(quality)) governor.Force(quality);
+        }
+    }
+    BoardRenderer boardRenderer;
+    boardRenderer.Load(screenWidth, screenHeight, QualityGovernor::BoardScale(renderQuality));
 
+    unique_ptr<AnalyticsLog> analytics(new AnalyticsLog());
     Game game;
+    game.analytics = analytics.get();
     GameScreen currentScreen(GameScreen::MENU);
     bool initialMenuEntry = true;
 
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--wrap") wrapEdges = true;
+        if (string(argv[i]) == "--hints") dangerHints = true;
+        if (string(argv[i]) != "--map" || i + 1 >= argc) continue;
+        for (int style = MAP_STYLE_MAZE; style <= MAP_STYLE_ROOMS; style++)
+        {
+            if (string(argv[i + 1]) == MapStyleName(style)) mapStyle = (MapStyle)style;
+        }
+    }
+
+    AllocationCheck allocationCheck;
+    unique_ptr<HotReloader> hotReload;
+    unique_ptr<MemoryWatchdog> watchdog;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--alloc-check") allocationCheck.enabled = true;
+        if (string(argv[i]) == "--resources") watchdog.reset(new MemoryWatchdog());
+        if (string(argv[i]) != "--watch") continue;
+        hotReload.reset(new HotReloader(defaultTuning));
+        hotReload->Start();
+    }
+
+    unique_ptr<TelemetryServer> telemetry;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (string(argv[i]) != "--telemetry") continue;
+        telemetry.reset(new TelemetryServer());
+        if (!telemetry->Start(atoi(argv[i + 1])))
+        {
+            printf("Error: could not start telemetry server on port %s\n", argv[i + 1]);
+            telemetry.reset();
+        }
+    }
+
+    unique_ptr<DatasetRecorder> dataset;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (string(argv[i]) != "--dataset") continue;
+        dataset.reset(new DatasetRecorder());
+        if (!dataset->Start(argv[i + 1])) dataset.reset();
+    }
+
+    unique_ptr<LockstepSession> net;
+    if (argc >= 6 && string(argv[1]) == "--net")
+    {
+        net.reset(new LockstepSession(game, atoi(argv[2])));
+        if (net->Open(atoi(argv[3]), argv[4], atoi(argv[5])))
+        {
+            game.StartVersus(argc >= 7 ? strtoull(argv[6], nullptr, 10) : 1);
+            currentScreen.SetScreen(GameScreen::GAME);
+            initialMenuEntry = false;
+        }
+        else
+        {
+            printf("Error: could not open UDP port %s\n", argv[3]);
+            net.reset();
+        }
+    }
+
+    // --- Save States ---
+    SaveWriter saveWriter;
+    unique_ptr<SaveRing> saveRing(new SaveRing());   // ~575 KB, too big for main's frame
+    uint8_t saveBuffer[maxSaveBytes];
+    int saveSize = 0;
+    InputQueue inputQueue;
+    SimThread simThread(game.audio, analytics.get(), *saveRing, saveWriter, allocationCheck, dataset.get());
+
+    GhostRace ghosts;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (string(argv[i]) == "--ghost") ghosts.Add(argv[i + 1]);
+    }
+
+    unique_ptr<ParticleSystem> particles(new ParticleSystem());
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--trail") particles->trail = true;
+        if (string(argv[i]) == "--no-effects") particles.reset();
+    }
+    if (particles)
+    {
+        game.effects = &particles->events;
+        simThread.SetEffects(&particles->events);
+    }
+
+    AttractMode attract;
+    double menuIdleSince = NowSeconds();
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--attract" && !net) attract.Start();
+    }
+    if (!net && (saveSize = SaveWriter::Load(saveBuffer)) > 0 && LoadSave(game, saveBuffer, saveSize))
+    {
+        // Resume an interrupted game straight into the pause menu.
+        saveRing->Push(saveBuffer, saveSize);
+        game.running = false;
+        currentScreen.SetScreen(GameScreen::PAUSED);
+        initialMenuEntry = false;
+    }
+
     // --- Initialize Main Menu Buttons ---
     int mainButtonWidth = 250;
     int mainButtonHeight = 60;
@@ -701,58 +9786,57 @@ int main()
     vector<Button*> pauseButtons = {&resumeButton, &pauseMenuButton};
     int selectedPauseButtonIndex = 0;
 
-    // --- Title Colors ---
-    Color titleColors[] = {
-        (Color){0, 121, 241, 255},
-        (Color){0, 173, 239, 255},
-        (Color){0, 204, 255, 255},
-        (Color){102, 0, 204, 255},
-        (Color){153, 51, 255, 255},
-        (Color){204, 0, 102, 255},
-        (Color){255, 0, 0, 255},
-        (Color){255, 128, 0, 255},
-        (Color){255, 255, 0, 255},
-        (Color){102, 255, 0, 255},
-        (Color){0, 204, 0, 255},
-        (Color){0, 153, 0, 255}
-    };
-    int numTitleColors = sizeof(titleColors) / sizeof(titleColors[0]);
-
     bool shouldExit = false;
+    double frameStart = NowSeconds();
 
     while (!shouldExit && !WindowShouldClose())
     {
+        double previousFrameStart = frameStart;
+        frameStart = NowSeconds();
          if (WindowShouldClose())
         {
             cout << "WindowShouldClose triggered. ESC pressed: " << IsKeyPressed(KEY_ESCAPE) << endl;
         }
 
+        if (hotReload && hotReload->Ready())
+        {
+            bool resume = simThread.Running();
+            simThread.Stop(game);
+            hotReload->Apply(game, boardRenderer, net != nullptr);
+            if (resume) simThread.Start(game);
+        }
+
+        if (currentScreen == GameScreen::GAME && !net && !simThread.Running()) simThread.Start(game);
+        allocationCheck.BeginFrame(currentScreen == GameScreen::GAME && game.running && !net);
         BeginDrawing();
+        double drawStart = NowSeconds();
         ClearBackground(green);
+        if (currentScreen != GameScreen::MENU) menuIdleSince = NowSeconds();
 
+        // --- ATTRACT Demo (on the menu) ---
+        if (currentScreen == GameScreen::MENU && attract.active)
+        {
+            if (GetKeyPressed() != 0 || IsMouseButtonPressed(MOUSE_LEFT_BUTTON))
+            {
+                attract.active = false;
+                menuIdleSince = NowSeconds();
+            }
+            else
+            {
+                attract.Update();
+                attract.Draw(game.food.texture);
+            }
+        }
         // --- MENU Screen ---
-        if (currentScreen == GameScreen::MENU)
+        else if (currentScreen == GameScreen::MENU)
         {
             if (initialMenuEntry)
             {
-                PlaySound(game.menuenterSound);
+                game.audio.Play(SOUND_MENU_ENTER);
                 initialMenuEntry = false;
             }
 
-            string titleText = "RETRO SNAKE";
-            int titleFontSize = 60;
-            int totalTextWidth = MeasureText(titleText.c_str(), titleFontSize);
-            int startX = screenWidth / 2 - totalTextWidth / 2;
-            int startY = screenHeight / 4;
-
-            int currentX = startX;
-            for (size_t i = 0; i < titleText.length(); ++i)
-            {
-                char currentLetter[2] = {titleText[i], '\0'};
-                Color color = titleColors[i % numTitleColors];
-                DrawText(currentLetter, currentX, startY, titleFontSize, color);
-                currentX += MeasureText(currentLetter, titleFontSize);
-            }
+            DrawMenuTitle(screenWidth, screenHeight);
 
             playButton.GetRect().y = mainStartY;
             exitButton.GetRect().y = mainStartY + (mainButtonHeight + mainButtonSpacing);
@@ -762,7 +9846,7 @@ int main()
                 btn->Draw();
                 if (btn->IsClicked())
                 {
-                    PlaySound(game.selectSound);
+                    game.audio.Play(SOUND_SELECT);
                     if (btn == &playButton)
                     {
                         currentScreen.SetScreen(GameScreen::DIFFICULTY_SELECTION);
@@ -779,40 +9863,25 @@ int main()
                 }
             }
 
-            const char* snakeAscii[] = {
-                "     ____ ",
-                " >-( __o )  23CVD",
-                "     / /      Nhóm 9        ~",
-                "   / //\\/\\/\\/\\",
-                "  (___/\\/\\/\\/\\"
-            };
-
-            int snakeFontSize = 30;
-            int snakeStartY = mainStartY + (mainButtonHeight + mainButtonSpacing) + mainButtonHeight + 20;
-            for (int i = 0; i < 5; i++)
-            {
-                int snakeX = offset;
-                int snakeY = snakeStartY + i * (snakeFontSize + 2);
-                DrawText(snakeAscii[i], snakeX, snakeY, snakeFontSize, darkGreen);
-            }
+            DrawMenuArt(mainStartY + (mainButtonHeight + mainButtonSpacing) + mainButtonHeight + 20);
 
             if (IsKeyPressed(KEY_DOWN))
             {
                 menuButtons[selectedMenuButtonIndex]->SetSelected(false);
                 selectedMenuButtonIndex = (selectedMenuButtonIndex + 1) % menuButtons.size();
                 menuButtons[selectedMenuButtonIndex]->SetSelected(true);
-                PlaySound(game.menuMoveSound);
+                game.audio.Play(SOUND_MENU_MOVE);
             }
             if (IsKeyPressed(KEY_UP))
             {
                 menuButtons[selectedMenuButtonIndex]->SetSelected(false);
                 selectedMenuButtonIndex = (selectedMenuButtonIndex - 1 + menuButtons.size()) % menuButtons.size();
                 menuButtons[selectedMenuButtonIndex]->SetSelected(true);
-                PlaySound(game.menuMoveSound);
+                game.audio.Play(SOUND_MENU_MOVE);
             }
             if (IsKeyPressed(KEY_ENTER))
             {
-                PlaySound(game.selectSound);
+                game.audio.Play(SOUND_SELECT);
                 if (selectedMenuButtonIndex == 0)
                 {
                     currentScreen.SetScreen(GameScreen::DIFFICULTY_SELECTION);
@@ -827,6 +9896,9 @@ int main()
                     shouldExit = true;
                 }
             }
+
+            if (GetKeyPressed() != 0 || IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) menuIdleSince = NowSeconds();
+            else if (NowSeconds() - menuIdleSince > attractIdleSeconds) attract.Start();
         }
         // --- DIFFICULTY SELECTION Screen ---
         else if (currentScreen == GameScreen::DIFFICULTY_SELECTION)
@@ -840,22 +9912,22 @@ int main()
                 difficultyButtons[selectedDifficultyButtonIndex]->SetSelected(false);
                 selectedDifficultyButtonIndex = (selectedDifficultyButtonIndex + 1) % difficultyButtons.size();
                 difficultyButtons[selectedDifficultyButtonIndex]->SetSelected(true);
-                PlaySound(game.menuMoveSound);
+                game.audio.Play(SOUND_MENU_MOVE);
             }
             if (IsKeyPressed(KEY_UP))
             {
                 difficultyButtons[selectedDifficultyButtonIndex]->SetSelected(false);
                 selectedDifficultyButtonIndex = (selectedDifficultyButtonIndex - 1 + difficultyButtons.size()) % difficultyButtons.size();
                 difficultyButtons[selectedDifficultyButtonIndex]->SetSelected(true);
-                PlaySound(game.menuMoveSound);
+                game.audio.Play(SOUND_MENU_MOVE);
             }
             if (IsKeyPressed(KEY_ENTER))
             {
-                PlaySound(game.selectSound);
+                game.audio.Play(SOUND_SELECT);
                 if (selectedDifficultyButtonIndex == 0) // EASY
                 {
                     isHardMode = false;
-                    gameSpeed = 0.2;
+                    gameSpeed = easySpeed;
                     game.DisableHardMode();
                     game.snake.Reset();
                     game.food.position = game.food.GenerateRandomPos(game.snake.body);
@@ -863,18 +9935,18 @@ int main()
                     game.resetCurrentScore();
                     game.running = true;
                     game.gameovermenu = false;
-                    allowMove = true;
-                    StopSound(game.menuenterSound);
+                    ghosts.StartRound(game, simThread.ghost);
+                    inputQueue.Clear();
+                    game.audio.Stop(SOUND_MENU_ENTER);
                     
                     currentScreen.SetScreen(GameScreen::GAME);
-                    PlaySound(game.gameStartSound);
-                     PlaySound(game.menuEnterEzSound);
+                    game.audio.Play(SOUND_GAME_START);
                     
                 }
                 else if (selectedDifficultyButtonIndex == 1) // HARD
                 {
                     isHardMode = true;
-                    gameSpeed = 0.1;
+                    gameSpeed = hardSpeed;
                     game.InitializeHardMode();
                     game.snake.Reset();
                     game.food.position = game.food.GenerateRandomPos(game.snake.body);
@@ -882,11 +9954,12 @@ int main()
                     game.resetCurrentScore();
                     game.running = true;
                     game.gameovermenu = false;
-                    allowMove = true;
-                    StopSound(game.menuenterSound);
+                    ghosts.StartRound(game, simThread.ghost);
+                    inputQueue.Clear();
+                    game.audio.Stop(SOUND_MENU_ENTER);
                     currentScreen.SetScreen(GameScreen::GAME);
-                    PlaySound(game.gameStartSound);
-                    PlaySound(game.menuEnterHardSound);
+                    game.audio.Play(SOUND_GAME_START);
+                    game.audio.Play(SOUND_MENU_ENTER_HARD);
                 }
                 else if (selectedDifficultyButtonIndex == 2) // BACK
                 {
@@ -896,7 +9969,7 @@ int main()
                     menuButtons[0]->SetSelected(true);
                     menuButtons[1]->SetSelected(false);
                     selectedMenuButtonIndex = 0;
-                    PlaySound(game.menuenterSound);
+                    game.audio.Play(SOUND_MENU_ENTER);
                 }
             }
 
@@ -905,11 +9978,11 @@ int main()
                 btn->Draw();
                 if (btn->IsClicked())
                 {
-                    PlaySound(game.selectSound);
+                    game.audio.Play(SOUND_SELECT);
                     if (btn == &easyButton)
                     {
                         isHardMode = false;
-                        gameSpeed = 0.2;
+                        gameSpeed = easySpeed;
                         game.DisableHardMode();
                         game.snake.Reset();
                         game.food.position = game.food.GenerateRandomPos(game.snake.body);
@@ -917,20 +9990,20 @@ int main()
                         game.resetCurrentScore();
                         game.running = true;
                         game.gameovermenu = false;
-                        allowMove = true;
-                        StopSound(game.menuenterSound);
+                        ghosts.StartRound(game, simThread.ghost);
+                        inputQueue.Clear();
+                        game.audio.Stop(SOUND_MENU_ENTER);
                         
                         currentScreen.SetScreen(GameScreen::GAME);
                         
-                        PlaySound(game.gameStartSound);
-                        PlaySound(game.menuEnterEzSound);
+                        game.audio.Play(SOUND_GAME_START);
                         
                         
                     }
                     else if (btn == &hardButton)
                     {
                         isHardMode = true;
-                        gameSpeed = 0.1;
+                        gameSpeed = hardSpeed;
                         game.InitializeHardMode();
                         game.snake.Reset();
                         game.food.position = game.food.GenerateRandomPos(game.snake.body);
@@ -938,11 +10011,12 @@ int main()
                         game.resetCurrentScore();
                         game.running = true;
                         game.gameovermenu = false;
-                        allowMove = true;
-                        StopSound(game.menuenterSound);
+                        ghosts.StartRound(game, simThread.ghost);
+                        inputQueue.Clear();
+                        game.audio.Stop(SOUND_MENU_ENTER);
                         currentScreen.SetScreen(GameScreen::GAME);
-                        PlaySound(game.gameStartSound);
-                        PlaySound(game.menuEnterHardSound);
+                        game.audio.Play(SOUND_GAME_START);
+                        game.audio.Play(SOUND_MENU_ENTER_HARD);
                         
 
                     }
@@ -954,7 +10028,7 @@ int main()
                         menuButtons[0]->SetSelected(true);
                         menuButtons[1]->SetSelected(false);
                         selectedMenuButtonIndex = 0;
-                        PlaySound(game.menuenterSound);
+                        game.audio.Play(SOUND_MENU_ENTER);
                     }
                 }
             }
@@ -962,74 +10036,74 @@ int main()
             
         }
         // --- GAME Screen ---
-        else if (currentScreen == GameScreen::GAME)
+        else if (currentScreen == GameScreen::GAME && net)
         {
-            if (EventTriggered(gameSpeed))
-            {
-                allowMove = true;
-                game.Update();
-            }
+            const Snake& localSnake = net->LocalPlayer() == 0 ? game.snake : game.rival;
+            inputQueue.Poll(net->QueuedDirection());
 
-            if (IsKeyPressed(KEY_UP) && game.snake.direction.y != 1 && allowMove)
-            {
-                game.snake.direction = {0, -1};
-                allowMove = false;
-            }
-            if (IsKeyPressed(KEY_DOWN) && game.snake.direction.y != -1 && allowMove)
+            net->Poll();
+            if (net->CanTick() && EventTriggered(gameSpeed))
             {
-                game.snake.direction = {0, 1};
-                allowMove = false;
+                int code = inputQueue.Pop(net->QueuedDirection());
+                if (code >= 0) net->SetLocalInput((uint8_t)(NET_UP + code));
+                net->Tick();
             }
-            if (IsKeyPressed(KEY_LEFT) && game.snake.direction.x != 1 && allowMove)
+
+            DrawRectangleLinesEx(Rectangle{(float)offset - 5, (float)offset - 5, (float)cellSize * cellCount + 10, (float)cellSize * cellCount + 10}, 5, darkGreen);
+            DrawText(net->IsConnected() ? "VERSUS" : "WAITING FOR PEER...", offset - 5, 20, 40, darkGreen);
+            DrawText(TextFormat("P1: %i   P2: %i", game.score, game.rivalScore), offset - 5, offset + cellSize * cellCount + 10, 40, darkGreen);
+            DrawText(TextFormat("rollback %.3f ms", net->lastRollbackMs), screenWidth - offset - 200, 30, 20, darkGreen);
+            game.Draw();
+            if (particles) particles->Trail(localSnake, game.tick);
+
+            if (net->IsMatchOver())
             {
-                game.snake.direction = {-1, 0};
-                allowMove = false;
+                currentScreen.SetScreen(GameScreen::GAME_OVER);
+                gameOverButtons[0]->SetSelected(true);
+                gameOverButtons[1]->SetSelected(false);
+                selectedGameOverButtonIndex = 0;
             }
-            if (IsKeyPressed(KEY_RIGHT) && game.snake.direction.x != -1 && allowMove)
+        }
+        else if (currentScreen == GameScreen::GAME)
+        {
+            // Ticks run on simThread; this thread forwards turns as they arrive and draws the newest tick.
+            int key;
+            while ((key = GetKeyPressed()) != 0)
             {
-                game.snake.direction = {1, 0};
-                allowMove = false;
+                int code = InputQueue::KeyToCode(key);
+                if (code >= 0) simThread.PushTurn(code, GetTime());
             }
+            simThread.SetRewinding(IsKeyDown(KEY_BACKSPACE));
+            simThread.Present(game, inputQueue);
+            ghosts.Advance(game.tick);
+            if (particles && game.running) particles->Trail(game.snake, game.tick);
 
             if (IsKeyPressed(KEY_ESCAPE))
             {
                 cout << "ESC pressed in GAME, switching to PAUSED" << endl;
-                PlaySound(game.selectSound);
+                simThread.Stop(game);
+                game.audio.Play(SOUND_SELECT);
                 currentScreen.SetScreen(GameScreen::PAUSED);
                 game.running = false;
+                if ((saveSize = EncodeGame(game, saveBuffer)) > 0) saveWriter.Request(saveBuffer, saveSize);
                 pauseButtons[0]->SetSelected(true);
                 pauseButtons[1]->SetSelected(false);
                 selectedPauseButtonIndex = 0;
             }
 
 
-            DrawRectangleLinesEx(Rectangle{(float)offset - 5, (float)offset - 5, (float)cellSize * cellCount + 10, (float)cellSize * cellCount + 10}, 5, darkGreen);
-            string gameTitleText = "RETRO SNAKE";
-            int gameTitleFontSize = 40;
-            int gameStartX = offset - 5;
-            int gameStartY = 20;
-            int currentGameX = gameStartX;
-            for (size_t i = 0; i < gameTitleText.length(); ++i)
-            {
-                char currentLetter[2] = {gameTitleText[i], '\0'};
-                Color color = titleColors[i % numTitleColors];
-                DrawText(currentLetter, currentGameX, gameStartY, gameTitleFontSize, color);
-                currentGameX += MeasureText(currentLetter, gameTitleFontSize);
-            }
-            DrawText(TextFormat("Score: %i", game.score), offset - 5, offset + cellSize * cellCount + 10, 40, darkGreen);
-            int highestScoreTextWidth = MeasureText(TextFormat("Highest Score: %i", game.highestscore), 40);
-            int xPos = (2 * offset + cellSize * cellCount) - highestScoreTextWidth - 10;
-            DrawText(TextFormat("Highest Score: %i", game.highestscore), xPos, offset + cellSize * cellCount + 30, 40, darkGreen);
-            game.Draw();
+            boardRenderer.Draw(game, DrawBoardChrome, [&]() { DrawScoreStrip(game); });
+            ghosts.Draw();
 
             if (game.gameovermenu)
             {
+                simThread.Stop(game);
+                ghosts.Finish(simThread.ghost);
                 currentScreen.SetScreen(GameScreen::GAME_OVER);
                 gameOverButtons[0]->SetSelected(true);
                 gameOverButtons[1]->SetSelected(false);
                 selectedGameOverButtonIndex = 0;
-                StopSound(game.menuEnterEzSound);
-                StopSound(game.menuEnterHardSound);
+                game.audio.Stop(SOUND_MENU_ENTER_HARD);
             }
         }
         // --- PAUSED Screen ---
@@ -1041,7 +10115,7 @@ int main()
             int panelHeight = 400;
             int panelX = screenWidth / 2 - panelWidth / 2;
             int panelY = screenHeight / 2 - panelHeight / 2;
-            DrawRectangleRounded(Rectangle{(float)panelX, (float)panelY, (float)panelWidth, (float)panelHeight}, 0.2, 10, darkGreen);
+            DrawRounded(Rectangle{(float)panelX, (float)panelY, (float)panelWidth, (float)panelHeight}, 0.2, 10, darkGreen);
             DrawRectangleLinesEx(Rectangle{(float)panelX, (float)panelY, (float)panelWidth, (float)panelHeight}, 4, WHITE);
             DrawText("PAUSED", panelX + panelWidth / 2 - MeasureText("PAUSED", 50) / 2, panelY + 40, 50, (Color){145, 221, 60, 255});
 
@@ -1055,18 +10129,18 @@ int main()
                 pauseButtons[selectedPauseButtonIndex]->SetSelected(false);
                 selectedPauseButtonIndex = (selectedPauseButtonIndex + 1) % pauseButtons.size();
                 pauseButtons[selectedPauseButtonIndex]->SetSelected(true);
-                PlaySound(game.menuMoveSound);
+                game.audio.Play(SOUND_MENU_MOVE);
             }
             if (IsKeyPressed(KEY_UP))
             {
                 pauseButtons[selectedPauseButtonIndex]->SetSelected(false);
                 selectedPauseButtonIndex = (selectedPauseButtonIndex - 1 + pauseButtons.size()) % pauseButtons.size();
                 pauseButtons[selectedPauseButtonIndex]->SetSelected(true);
-                PlaySound(game.menuMoveSound);
+                game.audio.Play(SOUND_MENU_MOVE);
             }
             if (IsKeyPressed(KEY_ENTER))
             {
-                PlaySound(game.selectSound);
+                game.audio.Play(SOUND_SELECT);
                 if (selectedPauseButtonIndex == 0)
                 {
                     currentScreen.SetScreen(GameScreen::GAME);
@@ -1074,14 +10148,17 @@ int main()
                 }
                 else if (selectedPauseButtonIndex == 1)
                 {
+                    game.EndSession();
                     game.resetScores();
                     game.DisableHardMode();
+                    saveRing->Clear();
+                    saveWriter.Clear();
                     currentScreen.SetScreen(GameScreen::MENU);
                     game.running = false;
                     menuButtons[0]->SetSelected(true);
                     menuButtons[1]->SetSelected(false);
                     selectedMenuButtonIndex = 0;
-                    PlaySound(game.menuenterSound);
+                    game.audio.Play(SOUND_MENU_ENTER);
                 }
             }
 
@@ -1090,7 +10167,7 @@ int main()
                 btn->Draw();
                 if (btn->IsClicked())
                 {
-                    PlaySound(game.selectSound);
+                    game.audio.Play(SOUND_SELECT);
                     if (btn == &resumeButton)
                     {
                         currentScreen.SetScreen(GameScreen::GAME);
@@ -1098,14 +10175,17 @@ int main()
                     }
                     else if (btn == &pauseMenuButton)
                     {
+                        game.EndSession();
                         game.resetScores();
                         game.DisableHardMode();
+                        saveRing->Clear();
+                        saveWriter.Clear();
                         currentScreen.SetScreen(GameScreen::MENU);
                         game.running = false;
                         menuButtons[0]->SetSelected(true);
                         menuButtons[1]->SetSelected(false);
                         selectedMenuButtonIndex = 0;
-                        PlaySound(game.menuenterSound);
+                        game.audio.Play(SOUND_MENU_ENTER);
                     }
                 }
             }
@@ -1115,25 +10195,15 @@ int main()
         // --- GAME OVER Screen ---
         else if (currentScreen == GameScreen::GAME_OVER)
         {
-            
+            // Keep answering the peer so it can confirm the final tick too.
+            if (net) net->Poll();
+
             int panelWidth = 500;
             int panelHeight = 400;
             int panelX = screenWidth / 2 - panelWidth / 2;
             int panelY = screenHeight / 2 - panelHeight / 2;
 
-            DrawRectangleRounded(Rectangle{(float)panelX, (float)panelY, (float)panelWidth, (float)panelHeight}, 0.2, 10, darkGreen);
-            DrawRectangleLinesEx(Rectangle{(float)panelX, (float)panelY, (float)panelWidth, (float)panelHeight}, 4, WHITE);
-            DrawText("GAME OVER", panelX + panelWidth / 2 - MeasureText("GAME OVER", 50) / 2, panelY + 40, 50, (Color){255, 0, 0, 255});
-
-            int scoreFontSize = 30;
-            int yourScoreY = panelY + 120;
-            int highestScoreY = panelY + 160;
-
-            string yourScoreStr = "Your Score: " + to_string(game.score);
-            string highestScoreStr = "Highest Score: " + to_string(game.highestscore);
-
-            DrawText(yourScoreStr.c_str(), panelX + panelWidth / 2 - MeasureText(yourScoreStr.c_str(), scoreFontSize) / 2, yourScoreY, scoreFontSize, WHITE);
-            DrawText(highestScoreStr.c_str(), panelX + panelWidth / 2 - MeasureText(highestScoreStr.c_str(), scoreFontSize) / 2, highestScoreY, scoreFontSize, WHITE);
+            DrawGameOverPanel(game, panelX, panelY, panelWidth, panelHeight);
 
             retryButton.GetRect().x = panelX + panelWidth / 2 - retryButton.GetRect().width / 2;
             retryButton.GetRect().y = panelY + 230;
@@ -1145,20 +10215,20 @@ int main()
                 gameOverButtons[selectedGameOverButtonIndex]->SetSelected(false);
                 selectedGameOverButtonIndex = (selectedGameOverButtonIndex + 1) % gameOverButtons.size();
                 gameOverButtons[selectedGameOverButtonIndex]->SetSelected(true);
-                PlaySound(game.menuMoveSound);
+                game.audio.Play(SOUND_MENU_MOVE);
             }
             if (IsKeyPressed(KEY_UP))
             {
                 gameOverButtons[selectedGameOverButtonIndex]->SetSelected(false);
                 selectedGameOverButtonIndex = (selectedGameOverButtonIndex - 1 + gameOverButtons.size()) % gameOverButtons.size();
                 gameOverButtons[selectedGameOverButtonIndex]->SetSelected(true);
-                PlaySound(game.menuMoveSound);
+                game.audio.Play(SOUND_MENU_MOVE);
                 
             }
             if (IsKeyPressed(KEY_ENTER))
             {
-                PlaySound(game.selectSound);
-                if (selectedGameOverButtonIndex == 0) // RESTART
+                game.audio.Play(SOUND_SELECT);
+                if (selectedGameOverButtonIndex == 0 && !net) // RESTART
                 {
                     if (isHardMode) game.InitializeHardMode();
                     else game.DisableHardMode();
@@ -1168,14 +10238,17 @@ int main()
                     game.resetCurrentScore();
                     game.running = true;
                     game.gameovermenu = false;
-                    allowMove = true;
+                    ghosts.StartRound(game, simThread.ghost);
+                    inputQueue.Clear();
                     
                     currentScreen.SetScreen(GameScreen::GAME);
-                    PlaySound(game.gameStartSound);
+                    game.audio.Play(SOUND_GAME_START);
                     
                 }
-                else if (selectedGameOverButtonIndex == 1) // MENU
+                else if (selectedGameOverButtonIndex == 1 || net) // MENU
                 {
+                    net.reset();
+                    game.versus = false;
                     game.resetScores();
                     game.DisableHardMode();
                     currentScreen.SetScreen(GameScreen::MENU);
@@ -1183,7 +10256,7 @@ int main()
                     menuButtons[0]->SetSelected(true);
                     menuButtons[1]->SetSelected(false);
                     selectedMenuButtonIndex = 0;
-                    PlaySound(game.menuenterSound);
+                    game.audio.Play(SOUND_MENU_ENTER);
                 }
             }
 
@@ -1192,15 +10265,14 @@ int main()
                     btn->Draw();
                     if (btn->IsClicked())
                     {
-                        PlaySound(game.selectSound);
-                        if (btn == &retryButton)
+                        game.audio.Play(SOUND_SELECT);
+                        if (btn == &retryButton && !net)
                         {
                             if (isHardMode){
-                             PlaySound(game.menuEnterHardSound);
+                             game.audio.Play(SOUND_MENU_ENTER_HARD);
                              game.InitializeHardMode();
                             }
                             else{
-                             PlaySound(game.menuEnterEzSound);
                              game.DisableHardMode();
                             }
                             game.snake.Reset();
@@ -1209,12 +10281,15 @@ int main()
                             game.resetCurrentScore();
                             game.running = true;
                             game.gameovermenu = false;
-                            allowMove = true;
+                            ghosts.StartRound(game, simThread.ghost);
+                            inputQueue.Clear();
                             currentScreen.SetScreen(GameScreen::GAME);
-                            PlaySound(game.gameStartSound);
+                            game.audio.Play(SOUND_GAME_START);
                         }
-                        else if (btn == &goMenuButton)
+                        else if (btn == &goMenuButton || net)
                         {
+                            net.reset();
+                            game.versus = false;
                             game.resetScores();
                             game.DisableHardMode();
                             currentScreen.SetScreen(GameScreen::MENU);
@@ -1222,7 +10297,7 @@ int main()
                             menuButtons[0]->SetSelected(true);
                             menuButtons[1]->SetSelected(false);
                             selectedMenuButtonIndex = 0;
-                            PlaySound(game.menuenterSound);
+                            game.audio.Play(SOUND_MENU_ENTER);
                         }
                     }
                 }
@@ -1230,9 +10305,39 @@ int main()
             
         }
 
+        // Paused, the effects hold still and stay hidden behind the menu until play resumes.
+        if (particles && currentScreen != GameScreen::PAUSED)
+        {
+            particles->Update(min(GetFrameTime(), 0.05f));
+            particles->Draw();
+        }
+
+        if (telemetry) telemetry->Record(game);
+        game.audio.Update();
+        if (watchdog)
+        {
+            watchdog->Sample(NowSeconds());
+            DrawResourceOverlay(*watchdog, screenWidth - 190, 4);
+        }
+
+        double workSeconds = NowSeconds() - drawStart;
         EndDrawing();
+        if (governor.Update(frameStart - previousFrameStart, workSeconds)) boardRenderer.SetQuality(renderQuality);
+        inputQueue.FramePresented(analytics.get());
+        allocationCheck.EndFrame();
     }
 
+    // Closing the window mid-game keeps the game for the next launch; saveWriter flushes on scope exit.
+    simThread.Stop(game);
+    if (!net && (currentScreen == GameScreen::GAME || currentScreen == GameScreen::PAUSED) && (saveSize = EncodeGame(game, saveBuffer)) > 0)
+    {
+        saveWriter.Request(saveBuffer, saveSize);
+    }
+    game.EndSession();
+
+    boardRenderer.Unload();
+    game.food.Unload();
+    resources.WindowClosed();
     CloseWindow();
-    return 0;
+    return allocationCheck.Report();
 }
\ No newline at end of file